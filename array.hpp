@@ -2,49 +2,129 @@
 
 #include "persistent_structure.hpp"
 #include "fat_nodes.hpp"
+#include "segmented_vector.hpp"
+#include "sliding_vector.hpp"
+#include "serialization.hpp"
+#include "timeline.hpp"
+#include "simd.hpp"
 #include "exception.hpp"
 
+#include <cstdint>
+#include <chrono>
+#include <istream>
+#include <ostream>
 #include <vector>
 #include <memory>
+#include <unordered_map>
 #include <algorithm>
+#include <iterator>
 #include <exception>
+#include <stdexcept>
+#include <atomic>
 #include <mutex>
+#include <type_traits>
+#include <utility>
 
 namespace pdc {
 
 using namespace internal;
 
-/*! \brief Partially persistent array. */
-template <typename T>
-class Array : public Persisent<Array<T>> {
-  mutable std::shared_ptr<std::vector<FatNodes<T>>> array_;
+/*! \brief Partially persistent array.
+ *
+ * Reading a published version takes no locks, only modifications of the
+ * latest version are serialized.
+ *
+ * \tparam Allocator Allocator used for the elements, their history and the
+ *                   shared state of all versions, may be a
+ *                   std::pmr::polymorphic_allocator.
+ */
+template <typename T, typename Allocator = std::allocator<T>>
+class Array : public Persisent<Array<T, Allocator>> {
+  template <typename U>
+  using Rebind = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+  using Item = FatNodes<T, Allocator>;
+  using Items = SegmentedVector<Item, Rebind<Item>>;
+  using Sizes = FatNodes<std::size_t, Rebind<std::size_t>>;
+  struct Compaction {
+    std::atomic<std::size_t> min_version{0};
+    std::size_t next = 0;
+  };
+  using Indices = SlidingVector<std::size_t, Rebind<std::size_t>>;
+  using Times = Timeline<Rebind<std::int64_t>>;
+  /* Change log: indices of the elements changed by every version in the
+   * order of versions, ends[v] is the end of the indices of version v, and
+   * the creation times of the versions. Compaction releases the log of the
+   * released versions. */
+  struct Log {
+    Log(const Allocator& alloc, std::int64_t ticks)
+      : indices(alloc), ends(alloc), times(alloc) { ends.EmplaceBack(0); times.Add(ticks); }
+    Indices indices;
+    Indices ends;
+    Times times;
+  };
+  /* State shared by all versions of the Array, kept in a single block so a
+   * version object costs one reference count. */
+  struct State {
+    State(const Allocator& alloc, std::int64_t ticks)
+      : items(alloc), sizes(0, 0, alloc), log(alloc, ticks) { }
+    Items items;
+    Sizes sizes;
+    std::atomic<std::size_t> max_version{0};
+    std::mutex mutex;
+    Compaction compaction;
+    Log log;
+  };
+  mutable std::shared_ptr<State> state_;
   std::size_t version_ = 0;
-  mutable std::shared_ptr<std::size_t> max_version_;
-  mutable std::shared_ptr<FatNodes<std::size_t>> size_;
-  mutable std::shared_ptr<std::mutex> mutex_;
 public:
+  class Changes;
+  class Builder;
+  class ChangeFeed;
+  class View;
+  /*! \brief Clock of the creation times of versions. */
+  using Clock = std::chrono::system_clock;
+
+  /*! \brief Change of an element. */
+  struct Change {
+    std::size_t version; /*!< Version which changed the element. */
+    std::size_t idx;     /*!< Index of the element. */
+  };
+
   /*! \brief Default constructor. Create empty Array. */
   Array();
 
+  /*! \brief Create empty Array with the allocator.
+   *
+   * \param alloc Allocator to use for all versions of the Array.
+   */
+  explicit Array(const Allocator& alloc);
+
   /*! \brief Constructor with count of elements.
    *
    * \param count Count elements with default value.
+   * \param alloc Allocator to use for all versions of the Array.
    */
-  Array(std::size_t count);
+  Array(std::size_t count, const Allocator& alloc = Allocator());
 
   /*! \brief Constructor with count of elements of a certain value.
    *
    * \param count Count of elements.
    * \param value The value to use for initialization.
+   * \param alloc Allocator to use for all versions of the Array.
    */
-  Array(std::size_t count, T value);
+  Array(std::size_t count, T value, const Allocator& alloc = Allocator());
+
+  /*! \brief Allocator of the Array.
+   *
+   * \return Copy of the allocator used by all versions of the Array.
+   */
+  Allocator GetAllocator() const { return Allocator(state_->items.GetAllocator()); }
   
   /*! \brief Size of array. 
    *
    * \return Array size. 
    */
-  std::size_t Size() const 
-    { std::lock_guard<std::mutex> lk(*mutex_); return GetSize(version_); }
+  std::size_t Size() const { return GetSize(version_); }
 
   /*! \brief Array empty? 
    *
@@ -60,7 +140,7 @@ public:
    * \exception IncorrectVersionException 
    *            If the method is not called on the latest version of the Array.
    */
-  Array<T> Update(std::size_t idx, T value) const;
+  Array<T, Allocator> Update(std::size_t idx, T value) const;
 
   /*! \brief Add a value at the end of the Array.
    *
@@ -69,95 +149,1159 @@ public:
    * \exception IncorrectVersionException 
    *            If the method is not called on the latest version of the Array.
    */
-  Array<T> PushBack(T value) const;
+  Array<T, Allocator> PushBack(T value) const;
+
+  /*! \brief Replaces the Array element by a value constructed in place.
+   *
+   * \param idx The index of the element to be changed.
+   * \param args Arguments of the constructor of the new value.
+   * \return New version of the Array with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Array.
+   */
+  template <typename... Args>
+  Array<T, Allocator> Emplace(std::size_t idx, Args&&... args) const;
+
+  /*! \brief Add a value constructed in place at the end of the Array.
+   *
+   * \param args Arguments of the constructor of the value.
+   * \return New version of the Array with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Array.
+   */
+  template <typename... Args>
+  Array<T, Allocator> EmplaceBack(Args&&... args) const;
+
+  /*! \brief Start collecting modifications to apply them as one version.
+   *
+   * \return Empty set of modifications of this version of the Array.
+   */
+  Changes Batch() const { return Changes(*this); }
+
+  /*! \brief Start a mutable builder of the next version.
+   *
+   * \return Builder holding the elements of this version.
+   */
+  Builder Transient() const { return Builder(*this); }
+
+  /*! \brief Borrowed view of this version for reading.
+   *
+   * Making, copying and dropping a view costs no reference counting. The
+   * view stays valid while any version of the Array exists.
+   * \return View of this version of the Array.
+   */
+  View Borrow() const { return View(state_.get(), version_); }
+
+  /*! \brief Releases the history of versions older than this version.
+   *
+   * Older versions of the Array must not be accessed after the call, Undo()
+   * does not go below this version. Their changes and times are released
+   * too, so the memory taken by the history follows the kept versions.
+   * Compaction is incremental: a call
+   * processes at most limit elements under the lock and the next call 
+   * continues from where it stopped.
+   * \param limit Maximum count of elements to process.
+   * \return true if all elements are processed, otherwise false.
+   */
+  bool Compact(std::size_t limit = SIZE_MAX) const;
+
+  /*! \brief Indices of the elements which differ between the versions.
+   *
+   * Complexity: O(k log k) for k changes between the versions.
+   * \param other Another version of the same Array, older or newer.
+   * \return Sorted indices of the elements changed or appended between the
+   *         versions.
+   * \exception std::invalid_argument If other is not a version of this Array.
+   * \exception std::out_of_range If the older version is released by
+   *            Compact().
+   */
+  std::vector<std::size_t> Diff(const Array<T, Allocator>& other) const;
+
+  /*! \brief Changes made after this version up to the given version.
+   *
+   * The changes are listed in the order of versions, an element changed by
+   * several versions is listed once per version. Iteration takes O(1) per
+   * change and reads only the change log.
+   * \param to A newer version of the same Array, for an older one the feed is
+   *           empty.
+   * \return Range of Change objects.
+   * \exception std::invalid_argument If to is not a version of this Array.
+   * \exception std::out_of_range If this version is released by Compact().
+   */
+  ChangeFeed Feed(const Array<T, Allocator>& to) const;
+
+  /*! \brief Writes all versions of the Array to the stream.
+   *
+   * Versions released by Compact() are not written. Modifications of the
+   * Array wait until the call returns.
+   * \param out Stream to write to.
+   * \param compression Compression of the written data.
+   * \exception std::runtime_error If writing to the stream fails.
+   * \exception std::invalid_argument If the compression is not supported.
+   */
+  void Save(std::ostream& out, Compression compression = Compression::None) const;
+
+  /*! \brief Writes only this version of the Array to the stream.
+   *
+   * The snapshot holds just the elements, it is loaded as an Array or a List
+   * with a single version.
+   * \param out Stream to write to.
+   * \param compression Compression of the written data.
+   * \exception std::runtime_error If writing to the stream fails.
+   * \exception std::invalid_argument If the compression is not supported.
+   */
+  void SaveSnapshot(std::ostream& out, Compression compression = Compression::None) const;
+
+  /*! \brief Reads an Array written by Save() or a snapshot.
+   *
+   * \param in Stream to read from.
+   * \param alloc Allocator to use for all versions of the loaded Array.
+   * \return The latest version of the loaded Array.
+   * \exception std::runtime_error If the stream does not contain an Array of
+   *            T or a snapshot of T.
+   */
+  static Array<T, Allocator> Load(std::istream& in, const Allocator& alloc = Allocator());
 
   /*! \brief Access the item for reading.
    *
+   * The element stays valid while the Array exists and its version is not
+   * released by Compact().
    * \param idx The index of the element.
    * \return Element to reading.
    */
-  T operator[](std::size_t idx) const 
-    { std::lock_guard<std::mutex> lk(*mutex_); return (*array_)[idx].Get(version_).value; }
+  const T& operator[](std::size_t idx) const 
+    { return state_->items[idx].Get(version_); }
+
+  /*! \brief Sum of a range of elements.
+   *
+   * Values are copied block by block into a buffer and added by SIMD kernels
+   * of the instruction set of the CPU (AVX2, AVX-512), in the arithmetic of
+   * T. The order of additions of floating point values depends on the
+   * kernel.
+   * \param first The index of the first element.
+   * \param count Count of elements, the range ends at the end of the Array
+   *              if count is larger.
+   * \return Sum of the elements, zero for an empty range.
+   * \exception std::out_of_range If first is larger than Size().
+   */
+  T Sum(std::size_t first = 0, std::size_t count = SIZE_MAX) const;
+
+  /*! \brief Smallest and largest elements of a range.
+   *
+   * Values are copied block by block and reduced by SIMD kernels, see Sum().
+   * \param first The index of the first element.
+   * \param count Count of elements, the range ends at the end of the Array
+   *              if count is larger.
+   * \return Pair of the smallest and the largest value.
+   * \exception std::out_of_range If first is larger than Size() or the range
+   *            is empty.
+   */
+  std::pair<T, T> MinMax(std::size_t first = 0, std::size_t count = SIZE_MAX) const;
+
+  /*! \brief Count of elements of a range satisfying the predicate.
+   *
+   * Arithmetic values are copied block by block and tested by a loop
+   * compiled for the instruction set of the CPU.
+   * \param pred Predicate taking const T&.
+   * \param first The index of the first element.
+   * \param count Count of elements, the range ends at the end of the Array
+   *              if count is larger.
+   * \return Count of elements for which pred returns true.
+   * \exception std::out_of_range If first is larger than Size().
+   */
+  template <typename Predicate>
+  std::size_t CountIf(Predicate pred, std::size_t first = 0, std::size_t count = SIZE_MAX) const;
+
+  /*! \brief Copies a range of elements to contiguous memory.
+   *
+   * \param out Destination of at least count elements.
+   * \param first The index of the first element.
+   * \param count Count of elements, the range ends at the end of the Array
+   *              if count is larger.
+   * \return Count of copied elements.
+   * \exception std::out_of_range If first is larger than Size().
+   */
+  std::size_t CopyTo(T* out, std::size_t first = 0, std::size_t count = SIZE_MAX) const;
 
   /*! \brief Returns the previous version of the Array.
    *
-   * Returns the same version of the Array if the version is minimal.
+   * Returns the same version of the Array if the version is minimal or the
+   * previous version is released by Compact().
    * \return Previous version of the Array.
    */
-  Array<T> Undo() const override
-    { return Array<T>(*this, version_ > 0 ? version_ - 1 : version_); }
+  Array<T, Allocator> Undo() const override
+    { return Array<T, Allocator>(*this, version_ > MinVersion() ? version_ - 1 : version_); }
 
   /*! \brief Returns the next version of the Array.
    *
    * Returns the same version of the Array if the version is maximum.
    * \return Next version of the Array.
    */
-  Array<T> Redo() const override
-    { return Array<T>(*this, version_ < *max_version_ ? version_ + 1 : version_); }
+  Array<T, Allocator> Redo() const override
+    { return Array<T, Allocator>(*this, version_ < MaxVersion() ? version_ + 1 : version_); }
+
+  /*! \brief Returns the version of the Array with the given number.
+   *
+   * Complexity: O(1).
+   * \param version Number of the version.
+   * \return The version of the Array.
+   * \exception std::out_of_range If version is not less than VersionCount()
+   *            or is released by Compact().
+   */
+  Array<T, Allocator> AtVersion(std::size_t version) const override;
+
+  /*! \brief Returns the latest version of the Array.
+   *
+   * \return The latest version of the Array.
+   */
+  Array<T, Allocator> Latest() const override
+    { return Array<T, Allocator>(*this, MaxVersion()); }
+
+  /*! \brief Count of versions of the Array.
+   *
+   * \return Count of versions, released ones included.
+   */
+  std::size_t VersionCount() const override { return MaxVersion() + 1; }
+
+  /*! \brief Number of this version.
+   *
+   * \return Number of the version.
+   */
+  std::size_t GetVersion() const override { return version_; }
+
+  /*! \brief Time the version was made.
+   *
+   * Times of versions never decrease even if the clock is set back.
+   * \return Creation time of this version.
+   */
+  Clock::time_point GetTime() const { return state_->log.times.Get(version_); }
+
+  /*! \brief Returns the version of the Array as of the given time.
+   *
+   * Complexity: O(log v) for v versions. The search waits for modifications
+   * and Compact() calls running at the same time.
+   * \param time Point in time.
+   * \return The latest version made at or before the time.
+   * \exception std::out_of_range If no kept version was made by the time.
+   */
+  Array<T, Allocator> AsOf(Clock::time_point time) const;
 
 private:
-  Array(const Array<T>& other, std::size_t version);
+  Array(const Array<T, Allocator>& other, std::size_t version);
   std::size_t GetSize(std::size_t version) const 
-    { return size_->Get(version).value; }
+    { return state_->sizes.Get(version); }
+  std::size_t MaxVersion() const 
+    { return state_->max_version.load(std::memory_order_acquire); }
+  std::size_t MinVersion() const 
+    { return state_->compaction.min_version.load(std::memory_order_acquire); }
   void CheckVersion() const 
-    { if (version_ != *max_version_) throw IncorrectVersionException(); }
+    { if (version_ != MaxVersion()) throw IncorrectVersionException(); }
+  void Publish(std::size_t version) const;
+  template <typename Modify>
+  void Write(std::size_t version, Modify&& modify) const
+    { Write(version, std::forward<Modify>(modify), [] { }); }
+  template <typename Modify, typename Restore>
+  void Write(std::size_t version, Modify&& modify, Restore&& restore) const;
+  void Rollback(std::size_t version, std::size_t items, std::size_t indices) const;
+  /* Values held by Changes and Builder are moved to the nodes of a version
+   * only if they can be moved back without throwing when the write fails,
+   * otherwise they are copied. Values which can be neither copied nor moved
+   * back are moved and lost if the write fails. */
+  static constexpr bool kMovesBack = std::is_nothrow_move_constructible<T>::value &&
+                                     std::is_nothrow_move_assignable<T>::value;
+  static constexpr bool kKeepsValues = kMovesBack || std::is_copy_constructible<T>::value;
+  using Passed = std::conditional_t<kMovesBack || !std::is_copy_constructible<T>::value, T&&, const T&>;
+  static Passed Pass(T& value) { return static_cast<Passed>(value); }
+  void TakeBack(std::size_t idx, std::size_t version, T& value) const;
+  std::size_t RangeEnd(std::size_t first, std::size_t count) const;
+  template <typename Visitor>
+  void ForEachBlock(std::size_t first, std::size_t last, Visitor&& visit) const;
+  void RebuildLog(std::size_t min_version, std::size_t max_version);
 };
 
-template <typename T>
-Array<T>::Array()
-  : Array(0)
+/*! \brief Changes of the Array between two versions.
+ *
+ * Returned by Array::Feed(), stays valid while any version of the Array
+ * exists.
+ */
+template <typename T, typename Allocator>
+class Array<T, Allocator>::ChangeFeed {
+  friend class Array<T, Allocator>;
+  std::shared_ptr<const Log> log_;
+  std::size_t from_;
+  std::size_t to_;
+  ChangeFeed(std::shared_ptr<const Log> log, std::size_t from, std::size_t to)
+    : log_(std::move(log)), from_(from), to_(std::max(from, to)) { }
+public:
+  /*! \brief Iterator over the changes. */
+  class Iterator {
+    friend class ChangeFeed;
+    const Log* log_;
+    std::size_t pos_;
+    std::size_t end_;
+    std::size_t version_;
+    Iterator(const Log* log, std::size_t pos, std::size_t end, std::size_t version)
+      : log_(log), pos_(pos), end_(end), version_(version) { Skip(); }
+    void Skip() { while (pos_ < end_ && log_->ends[version_] <= pos_) ++version_; }
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Change;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Change*;
+    using reference = Change;
+    Iterator& operator++() { ++pos_; Skip(); return *this; }
+    Change operator*() const { return Change{version_, log_->indices[pos_]}; }
+    bool operator==(const Iterator& rhs) const { return pos_ == rhs.pos_; }
+    bool operator!=(const Iterator& rhs) const { return !(*this == rhs); }
+  };
+
+  /*! \brief Count of changes.
+   *
+   * \return Count of changes in the feed.
+   */
+  std::size_t Size() const { return log_->ends[to_] - log_->ends[from_]; }
+
+  /*! \brief Iterator pointing to the first change. */
+  Iterator begin() const
+    { return Iterator(log_.get(), log_->ends[from_], log_->ends[to_], from_ + 1); }
+
+  /*! \brief Iterator pointing past the last change. */
+  Iterator end() const
+    { return Iterator(log_.get(), log_->ends[to_], log_->ends[to_], to_); }
+};
+
+/*! \brief Version of the Array read through a borrowed reference.
+ *
+ * Returned by Array::Borrow(), reads the same as the Array it came from
+ * without holding the shared state of the Array.
+ */
+template <typename T, typename Allocator>
+class Array<T, Allocator>::View {
+  friend class Array<T, Allocator>;
+  const State* state_;
+  std::size_t version_;
+  View(const State* state, std::size_t version) : state_(state), version_(version) { }
+public:
+  /*! \brief Size of array.
+   *
+   * \return Array size.
+   */
+  std::size_t Size() const { return state_->sizes.Get(version_); }
+
+  /*! \brief Array empty?
+   *
+   * \return true if the Array is empty, otherwise false.
+   */
+  bool IsEmpty() const { return Size() == 0; }
+
+  /*! \brief Access the item for reading.
+   *
+   * \param idx The index of the element.
+   * \return Element to reading.
+   */
+  const T& operator[](std::size_t idx) const { return state_->items[idx].Get(version_); }
+
+  /*! \brief Number of the viewed version.
+   *
+   * \return Number of the version.
+   */
+  std::size_t GetVersion() const { return version_; }
+
+  /*! \brief View of another version of the same Array.
+   *
+   * \param version Number of the version.
+   * \return View of the version.
+   * \exception std::out_of_range If the version does not exist or is released.
+   */
+  View AtVersion(std::size_t version) const;
+};
+
+/*! \brief Modifications of the Array applied as one version.
+ *
+ * Collected by Array::Batch() and applied by Commit() under a single lock.
+ * Applied modifications are cleared and the set continues from the version
+ * they made.
+ */
+template <typename T, typename Allocator>
+class Array<T, Allocator>::Changes {
+  friend class Array<T, Allocator>;
+  using Entry = std::pair<std::size_t, T>;
+  Array<T, Allocator> array_;
+  std::size_t size_;
+  std::vector<Entry, Rebind<Entry>> items_;
+  bool failed_ = false;
+  Changes(const Array<T, Allocator>& array) 
+    : array_(array), size_(array.Size()), items_(array.GetAllocator()) { }
+public:
+  /*! \brief Updates the value of the Array element.
+   *
+   * If the element is updated several times, the last value is kept.
+   * \param idx The index of the element to be changed.
+   * \param value The new value of the element.
+   * \return The same set of modifications.
+   * \exception std::out_of_range If idx is not less than the size of the 
+   *            Array with the modifications collected so far.
+   */
+  Changes& Update(std::size_t idx, T value);
+
+  /*! \brief Add a value at the end of the Array.
+   *
+   * \param value Value to add.
+   * \return The same set of modifications.
+   */
+  Changes& PushBack(T value);
+
+  /*! \brief Applies the modifications.
+   *
+   * If a value throws while it is written to the Array, no version is
+   * published and the modifications are kept, so they may be applied again.
+   * A value which has a throwing move and no copy is lost instead, and the
+   * modifications can not be applied any more.
+   * \return New version of the Array with changed state.
+   * \exception IncorrectVersionException 
+   *            If the Array was modified after the Batch() call.
+   * \exception std::logic_error If applying the modifications failed and
+   *            lost their values.
+   */
+  Array<T, Allocator> Commit();
+
+  /*! \brief Applies the modifications to the latest version of the Array.
+   *
+   * If the Array was modified after the Batch() call, the modifications are
+   * rebased onto the latest version unless they update elements changed
+   * since then. Appended values follow the values appended by the newer
+   * versions, so concurrent writers of different elements never fail.
+   * Nothing is applied if the modifications conflict. A failed write keeps
+   * the modifications as Commit() does.
+   * \return New version of the Array with changed state.
+   * \exception ConflictException If an updated element was changed after
+   *            the Batch() call or that version was released by Compact().
+   * \exception std::logic_error If applying the modifications failed and
+   *            lost their values.
+   */
+  Array<T, Allocator> Merge();
+
+private:
+  Array<T, Allocator> Apply(std::size_t base_size, std::size_t latest, std::size_t size);
+};
+
+/*! \brief Mutable builder of a version of the Array.
+ *
+ * Returned by Array::Transient(). Modifications are written in place to a
+ * private buffer, take no locks and make no versions; Persistent() publishes
+ * them as one new version. A builder must be used by one thread at a time.
+ */
+template <typename T, typename Allocator>
+class Array<T, Allocator>::Builder {
+  friend class Array<T, Allocator>;
+  using Updates = std::unordered_map<std::size_t, T, std::hash<std::size_t>, std::equal_to<std::size_t>,
+                                     Rebind<std::pair<const std::size_t, T>>>;
+  Array<T, Allocator> array_;
+  std::size_t size_;
+  Updates updates_;
+  std::vector<T, Rebind<T>> tail_;
+  bool failed_ = false;
+  explicit Builder(const Array<T, Allocator>& array)
+    : array_(array), size_(array.Size()), updates_(array.GetAllocator()), tail_(array.GetAllocator()) { }
+public:
+  /*! \brief Size of the array being built.
+   *
+   * \return Count of elements.
+   */
+  std::size_t Size() const { return size_ + tail_.size(); }
+
+  /*! \brief Array being built empty?
+   *
+   * \return true if the builder has no elements, otherwise false.
+   */
+  bool IsEmpty() const { return Size() == 0; }
+
+  /*! \brief Access the item for reading.
+   *
+   * The element stays valid until the next modification of the builder.
+   * \param idx The index of the element, less than Size().
+   * \return Element to reading.
+   */
+  const T& operator[](std::size_t idx) const;
+
+  /*! \brief Updates the value of the element in place.
+   *
+   * \param idx The index of the element to be changed.
+   * \param value The new value of the element.
+   * \return Reference to this builder.
+   * \exception std::out_of_range If idx is not less than Size().
+   */
+  Builder& Update(std::size_t idx, T value) { return Emplace(idx, std::move(value)); }
+
+  /*! \brief Replaces the element with a value constructed in place.
+   *
+   * \param idx The index of the element to be changed.
+   * \param args Arguments of the constructor of the value.
+   * \return Reference to this builder.
+   * \exception std::out_of_range If idx is not less than Size().
+   */
+  template <typename... Args>
+  Builder& Emplace(std::size_t idx, Args&&... args);
+
+  /*! \brief Add a value at the end.
+   *
+   * \param value Value to add.
+   * \return Reference to this builder.
+   */
+  Builder& PushBack(T value) { tail_.push_back(std::move(value)); return *this; }
+
+  /*! \brief Add a value constructed in place at the end.
+   *
+   * \param args Arguments of the constructor of the value.
+   * \return Reference to this builder.
+   */
+  template <typename... Args>
+  Builder& EmplaceBack(Args&&... args) { tail_.emplace_back(std::forward<Args>(args)...); return *this; }
+
+  /*! \brief Publishes the elements as a new version of the Array.
+   *
+   * The builder stays usable and continues from the published version. If
+   * a value throws while it is written to the Array, no version is published,
+   * the Array is unchanged and the builder keeps its elements. A builder
+   * whose values have a throwing move and no copy loses them instead and
+   * can not publish any more.
+   * \return New version of the Array.
+   * \exception IncorrectVersionException If the Array was modified after
+   *            the Transient() call.
+   * \exception std::logic_error If publishing failed and lost the values.
+   */
+  Array<T, Allocator> Persistent();
+};
+
+template <typename T, typename Allocator>
+Array<T, Allocator>::Array()
+  : Array(Allocator())
 {
 }
 
-template <typename T>
-Array<T>::Array(std::size_t count)
-  : Array(count, T())
+template <typename T, typename Allocator>
+Array<T, Allocator>::Array(const Allocator& alloc)
+  : state_(std::allocate_shared<State>(alloc, alloc, Times::Ticks(Clock::now())))
 {
 }
 
-template <typename T>
-Array<T>::Array(std::size_t count, T value)
-  : array_(std::make_shared<std::vector<FatNodes<T>>>())
-  , max_version_(std::make_shared<std::size_t>(0))
-  , size_(std::make_shared<FatNodes<std::size_t>>(0, count))
-  , mutex_(std::make_shared<std::mutex>())
+template <typename T, typename Allocator>
+Array<T, Allocator>::Array(std::size_t count, const Allocator& alloc)
+  : Array(alloc)
 {
-  array_->reserve(count);
+  state_->items.Reserve(count);
   for (std::size_t i = 0; i < count; ++i) {
-    array_->emplace_back(version_, value);
+    state_->items.EmplaceBack(version_, T(), alloc);
   }
+  state_->sizes.Add(version_, count);
 }
 
-template <typename T>
-Array<T>::Array(const Array<T>& other, std::size_t version)
-  : array_(other.array_)
+template <typename T, typename Allocator>
+Array<T, Allocator>::Array(std::size_t count, T value, const Allocator& alloc)
+  : Array(alloc)
+{
+  state_->items.Reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    state_->items.EmplaceBack(version_, value, alloc);
+  }
+  state_->sizes.Add(version_, count);
+}
+
+template <typename T, typename Allocator>
+Array<T, Allocator>::Array(const Array<T, Allocator>& other, std::size_t version)
+  : state_(other.state_)
   , version_(version)
-  , max_version_(other.max_version_)
-  , size_(other.size_)
 {
 }
 
-template <typename T>
-Array<T> Array<T>::Update(std::size_t idx, T value) const
+template <typename T, typename Allocator>
+Array<T, Allocator> Array<T, Allocator>::Update(std::size_t idx, T value) const
+{
+  return Emplace(idx, std::move(value));
+}
+
+template <typename T, typename Allocator>
+Array<T, Allocator> Array<T, Allocator>::PushBack(T value) const
+{
+  return EmplaceBack(std::move(value));
+}
+
+template <typename T, typename Allocator>
+template <typename... Args>
+Array<T, Allocator> Array<T, Allocator>::Emplace(std::size_t idx, Args&&... args) const
 {
-  std::lock_guard<std::mutex> lk(*mutex_);
+  std::lock_guard<std::mutex> lk(state_->mutex);
   CheckVersion();
-  if (idx < 0 || idx >= Size()) {
+  if (idx >= GetSize(version_)) {
     throw std::out_of_range("Update");
   }
-  (*array_)[idx].Add(++(*max_version_), std::move(value));
-  return Array<T>(*this, *max_version_);
+  const std::size_t version = version_ + 1;
+  Write(version, [&] {
+    state_->log.indices.EmplaceBack(idx);
+    state_->items[idx].Emplace(version, std::forward<Args>(args)...);
+  });
+  return Array<T, Allocator>(*this, version);
 }
 
-template <typename T>
-Array<T> Array<T>::PushBack(T value) const
+/* The first node of an element is stored inline, so the value is
+ * constructed right in the element. */
+template <typename T, typename Allocator>
+template <typename... Args>
+Array<T, Allocator> Array<T, Allocator>::EmplaceBack(Args&&... args) const
 {
-  std::lock_guard<std::mutex> lk(*mutex_);
+  std::lock_guard<std::mutex> lk(state_->mutex);
   CheckVersion();
-  ++(*max_version_);
-  array_->emplace_back(*max_version_, value);
-  size_->Add((*max_version_), GetSize((*max_version_)) + 1);
-  return Array<T>(*this, *max_version_);
+  const std::size_t version = version_ + 1;
+  const std::size_t size = GetSize(version_);
+  Write(version, [&] {
+    state_->log.indices.EmplaceBack(size);
+    state_->items.EmplaceBack(std::in_place, version, GetAllocator(), std::forward<Args>(args)...);
+    state_->sizes.Add(version, size + 1);
+  });
+  return Array<T, Allocator>(*this, version);
+}
+
+template <typename T, typename Allocator>
+bool Array<T, Allocator>::Compact(std::size_t limit) const
+{
+  std::lock_guard<std::mutex> lk(state_->mutex);
+  const std::size_t version = std::max(version_, MinVersion());
+  state_->compaction.min_version.store(version, std::memory_order_release);
+  std::size_t& next = state_->compaction.next;
+  if (next == 0) {
+    state_->sizes.Compact(version);
+    Log& log = state_->log;
+    log.indices.Release(log.ends[version]);
+    log.ends.Release(version);
+    log.times.Release(version);
+  }
+  const std::size_t size = state_->items.Size();
+  const std::size_t end = size - next > limit ? next + limit : size;
+  for (; next < end; ++next) {
+    state_->items[next].Compact(version);
+  }
+  if (next == size) {
+    next = 0;
+    return true;
+  }
+  return false;
+}
+
+template <typename T, typename Allocator>
+std::vector<std::size_t> Array<T, Allocator>::Diff(const Array<T, Allocator>& other) const
+{
+  const ChangeFeed feed = std::min(version_, other.version_) == version_
+    ? Feed(other) : other.Feed(*this);
+  std::vector<std::size_t> indices;
+  indices.reserve(feed.Size());
+  for (const Change change : feed) {
+    indices.push_back(change.idx);
+  }
+  std::sort(indices.begin(), indices.end());
+  indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+  return indices;
+}
+
+template <typename T, typename Allocator>
+typename Array<T, Allocator>::ChangeFeed
+Array<T, Allocator>::Feed(const Array<T, Allocator>& to) const
+{
+  if (to.state_ != state_) {
+    throw std::invalid_argument("Feed");
+  }
+  if (version_ < MinVersion()) {
+    throw std::out_of_range("Feed");
+  }
+  return ChangeFeed(std::shared_ptr<const Log>(state_, &state_->log), version_, to.version_);
+}
+
+template <typename T, typename Allocator>
+Array<T, Allocator> Array<T, Allocator>::AtVersion(std::size_t version) const
+{
+  if (version > MaxVersion() || version < MinVersion()) {
+    throw std::out_of_range("AtVersion");
+  }
+  return Array<T, Allocator>(*this, version);
+}
+
+template <typename T, typename Allocator>
+typename Array<T, Allocator>::View
+Array<T, Allocator>::View::AtVersion(std::size_t version) const
+{
+  if (version > state_->max_version.load(std::memory_order_acquire) ||
+      version < state_->compaction.min_version.load(std::memory_order_acquire)) {
+    throw std::out_of_range("AtVersion");
+  }
+  return View(state_, version);
+}
+
+/* Compact() releases the log of the released versions, their times
+ * included, so the times are searched under the lock. */
+template <typename T, typename Allocator>
+Array<T, Allocator> Array<T, Allocator>::AsOf(Clock::time_point time) const
+{
+  std::lock_guard<std::mutex> lk(state_->mutex);
+  const std::size_t min_version = MinVersion();
+  const std::size_t next = state_->log.times.Find(time, min_version, MaxVersion());
+  if (next == min_version) {
+    throw std::out_of_range("AsOf");
+  }
+  return Array<T, Allocator>(*this, next - 1);
+}
+
+/* The change log of the version is complete before the version is
+ * published, so readers of published versions see their changes. */
+template <typename T, typename Allocator>
+void Array<T, Allocator>::Publish(std::size_t version) const
+{
+  state_->log.ends.EmplaceBack(state_->log.indices.Size());
+  state_->log.times.Add(Clock::now());
+  state_->max_version.store(version, std::memory_order_release);
+}
+
+/* The modifications log every element before they add its node of the
+ * version, so a modification which throws is undone by Rollback() and no
+ * node of the version is left for the next one. Before that restore() takes
+ * back the values the modifications moved to the nodes, it must not throw. */
+template <typename T, typename Allocator>
+template <typename Modify, typename Restore>
+void Array<T, Allocator>::Write(std::size_t version, Modify&& modify, Restore&& restore) const
+{
+  const std::size_t items = state_->items.Size();
+  const std::size_t indices = state_->log.indices.Size();
+  try {
+    modify();
+    Publish(version);
+  } catch (...) {
+    restore();
+    Rollback(version, items, indices);
+    throw;
+  }
+}
+
+/* Moves the value of the unpublished node of the element back to its
+ * source. Copied values are left where they are. */
+template <typename T, typename Allocator>
+void Array<T, Allocator>::TakeBack(std::size_t idx, std::size_t version, T& value) const
+{
+  if constexpr (kMovesBack) {
+    if (T* node = state_->items[idx].Unpublished(version)) {
+      value = std::move(*node);
+    }
+  }
+}
+
+/* Drops the nodes, the appended elements, the size and the log entries of
+ * the unpublished version. */
+template <typename T, typename Allocator>
+void Array<T, Allocator>::Rollback(std::size_t version, std::size_t items, std::size_t indices) const
+{
+  Log& log = state_->log;
+  for (std::size_t i = indices; i < log.indices.Size(); ++i) {
+    if (log.indices[i] < items) {
+      state_->items[log.indices[i]].Rollback(version);
+    }
+  }
+  while (log.indices.Size() > indices) {
+    log.indices.PopBack();
+  }
+  while (state_->items.Size() > items) {
+    state_->items.PopBack();
+  }
+  state_->sizes.Rollback(version);
+  while (log.ends.Size() > version) {
+    log.ends.PopBack();
+  }
+  while (log.times.Size() > version) {
+    log.times.PopBack();
+  }
+}
+
+/* Histories start from the nodes visible in the oldest kept version, so the
+ * loaded Array has the same versions as this one. */
+template <typename T, typename Allocator>
+void Array<T, Allocator>::Save(std::ostream& out, Compression compression) const
+{
+  Writer writer(out, Format::ArrayHistory, compression);
+  std::lock_guard<std::mutex> lk(state_->mutex);
+  const std::size_t min_version = MinVersion();
+  writer.WriteVarint(sizeof(T));
+  writer.WriteVarint(min_version);
+  writer.WriteVarint(MaxVersion());
+  WriteHistory(writer, state_->sizes, min_version);
+  const std::size_t count = state_->items.Size();
+  writer.WriteVarint(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    WriteHistory(writer, state_->items[i], min_version);
+  }
+  writer.Write(state_->log.times.Ticks(min_version));
+  for (std::size_t version = min_version + 1; version <= MaxVersion(); ++version) {
+    writer.WriteVarint(state_->log.times.Ticks(version) - state_->log.times.Ticks(version - 1));
+  }
+  writer.Finish();
+}
+
+template <typename T, typename Allocator>
+void Array<T, Allocator>::SaveSnapshot(std::ostream& out, Compression compression) const
+{
+  Writer writer(out, Format::Snapshot, compression);
+  const std::size_t size = Size();
+  writer.WriteVarint(sizeof(T));
+  writer.WriteVarint(size);
+  for (std::size_t i = 0; i < size; ++i) {
+    writer.Write(state_->items[i].Get(version_));
+  }
+  writer.Finish();
+}
+
+template <typename T, typename Allocator>
+Array<T, Allocator> Array<T, Allocator>::Load(std::istream& in, const Allocator& alloc)
+{
+  Reader reader(in);
+  if ((reader.GetFormat() != Format::ArrayHistory && reader.GetFormat() != Format::Snapshot) ||
+      reader.ReadVarint() != sizeof(T)) {
+    throw std::runtime_error("Not an array of this type");
+  }
+  Array<T, Allocator> array(alloc);
+  if (reader.GetFormat() == Format::Snapshot) {
+    const std::size_t size = reader.ReadVarint();
+    T value;
+    for (std::size_t i = 0; i < size; ++i) {
+      reader.Read(value);
+      array.state_->items.EmplaceBack(0, std::move(value), alloc);
+    }
+    array.state_->sizes.Add(0, size);
+    reader.Finish();
+    return array;
+  }
+  const std::size_t min_version = reader.ReadVarint();
+  const std::size_t max_version = reader.ReadVarint();
+  if (min_version > max_version || max_version == SIZE_MAX) {
+    Corrupted();
+  }
+  Sizes& sizes = array.state_->sizes;
+  ReadHistory<std::size_t, Rebind<std::size_t>>(reader, max_version,
+    [&](std::size_t version, std::size_t size) -> Sizes& { sizes.Add(version, size); return sizes; });
+  const std::size_t count = reader.ReadVarint();
+  sizes.ForEach(0, [count](std::size_t, const std::size_t* size) {
+    if (size && *size > count) {
+      Corrupted();
+    }
+  });
+  for (std::size_t i = 0; i < count; ++i) {
+    ReadHistory<T, Allocator>(reader, max_version, [&](std::size_t version, T value) -> Item& {
+      return array.state_->items.EmplaceBack(version, std::move(value), alloc);
+    });
+  }
+  std::int64_t ticks;
+  reader.Read(ticks);
+  Times& times = array.state_->log.times;
+  times.Rebase(min_version);
+  times.Add(ticks);
+  for (std::size_t version = min_version + 1; version <= max_version; ++version) {
+    ticks += reader.ReadVarint();
+    times.Add(ticks);
+  }
+  reader.Finish();
+  array.RebuildLog(min_version, max_version);
+  array.version_ = max_version;
+  array.state_->max_version.store(max_version, std::memory_order_relaxed);
+  array.state_->compaction.min_version.store(min_version, std::memory_order_relaxed);
+  return array;
+}
+
+/* The log of a loaded Array is restored from the histories of the elements
+ * by counting sort on versions. It starts at the oldest kept version, the
+ * versions released by Compact() have no log. */
+template <typename T, typename Allocator>
+void Array<T, Allocator>::RebuildLog(std::size_t min_version, std::size_t max_version)
+{
+  std::vector<std::size_t> ends(max_version - min_version + 1);
+  const std::size_t count = state_->items.Size();
+  for (std::size_t i = 0; i < count; ++i) {
+    state_->items[i].ForEach(min_version, [&](std::size_t version, const T*) {
+      if (version > min_version) {
+        ++ends[version - min_version];
+      }
+    });
+  }
+  Log& log = state_->log;
+  log.ends.Rebase(min_version);
+  log.ends.EmplaceBack(0);
+  for (std::size_t i = 1; i < ends.size(); ++i) {
+    ends[i] += ends[i - 1];
+    log.ends.EmplaceBack(ends[i]);
+  }
+  for (std::size_t i = 0; i < ends.back(); ++i) {
+    log.indices.EmplaceBack();
+  }
+  for (std::size_t i = count; i-- > 0; ) {
+    state_->items[i].ForEach(min_version, [&](std::size_t version, const T*) {
+      if (version > min_version) {
+        log.indices[--ends[version - min_version]] = i;
+      }
+    });
+  }
+}
+
+template <typename T, typename Allocator>
+typename Array<T, Allocator>::Changes&
+Array<T, Allocator>::Changes::Update(std::size_t idx, T value)
+{
+  if (idx >= size_) {
+    throw std::out_of_range("Update");
+  }
+  items_.emplace_back(idx, std::move(value));
+  return *this;
+}
+
+template <typename T, typename Allocator>
+typename Array<T, Allocator>::Changes&
+Array<T, Allocator>::Changes::PushBack(T value)
+{
+  items_.emplace_back(size_++, std::move(value));
+  return *this;
+}
+
+template <typename T, typename Allocator>
+Array<T, Allocator> Array<T, Allocator>::Changes::Commit()
+{
+  std::lock_guard<std::mutex> lk(array_.state_->mutex);
+  array_.CheckVersion();
+  const std::size_t size = array_.GetSize(array_.version_);
+  return Apply(size, array_.version_, size);
+}
+
+/* An element changed after the base version has a node newer than it, so
+ * the check takes one look at the latest node of every updated element. */
+template <typename T, typename Allocator>
+Array<T, Allocator> Array<T, Allocator>::Changes::Merge()
+{
+  std::lock_guard<std::mutex> lk(array_.state_->mutex);
+  const std::size_t base = array_.version_;
+  const std::size_t latest = array_.MaxVersion();
+  if (base == latest) {
+    const std::size_t size = array_.GetSize(base);
+    return Apply(size, latest, size);
+  }
+  if (base < array_.MinVersion()) {
+    throw ConflictException();
+  }
+  const std::size_t base_size = array_.GetSize(base);
+  for (const auto& item : items_) {
+    if (item.first < base_size && array_.state_->items[item.first].LastVersion() > base) {
+      throw ConflictException();
+    }
+  }
+  return Apply(base_size, latest, array_.GetSize(latest));
+}
+
+/* Applies the modifications as the version after the latest one of the
+ * given size. Appended elements are moved from the base size to the end of
+ * the latest version. An element is modified once, at its first
+ * modification, with the value of its last one, so it gets a single node of
+ * the version. The modifications are rebased onto the latest version only
+ * after it is written, so a failed write leaves them relative to the base
+ * with their values taken back from the dropped nodes. */
+template <typename T, typename Allocator>
+Array<T, Allocator> Array<T, Allocator>::Changes::Apply(
+  std::size_t base_size, std::size_t latest, std::size_t size)
+{
+  if (failed_) {
+    throw std::logic_error("Apply");
+  }
+  std::unordered_map<std::size_t, std::size_t> order;
+  std::vector<std::size_t> writes;
+  for (std::size_t i = 0; i < items_.size(); ++i) {
+    const auto found = order.emplace(items_[i].first, writes.size());
+    if (found.second) {
+      writes.push_back(i);
+    } else {
+      writes[found.first->second] = i;
+    }
+  }
+  const auto target = [base_size, size](std::size_t idx) {
+    return idx < base_size ? idx : idx + size - base_size;
+  };
+  const std::size_t new_size = size_ + size - base_size;
+  State& state = *array_.state_;
+  const std::size_t version = latest + 1;
+  std::size_t written = 0;
+  array_.Write(version, [&] {
+    state.items.Reserve(new_size);
+    for (; written < writes.size(); ++written) {
+      Entry& item = items_[writes[written]];
+      const std::size_t idx = target(item.first);
+      state.log.indices.EmplaceBack(idx);
+      if (idx < size) {
+        state.items[idx].Emplace(version, Pass(item.second));
+      } else {
+        state.items.EmplaceBack(std::in_place, version, array_.GetAllocator(), Pass(item.second));
+      }
+    }
+    if (new_size != size) {
+      state.sizes.Add(version, new_size);
+    }
+  }, [&] {
+    for (std::size_t i = 0; i < written; ++i) {
+      Entry& item = items_[writes[i]];
+      array_.TakeBack(target(item.first), version, item.second);
+    }
+    failed_ = !kKeepsValues;
+  });
+  items_.clear();
+  size_ = new_size;
+  array_.version_ = version;
+  return Array<T, Allocator>(array_, version);
+}
+
+template <typename T, typename Allocator>
+T Array<T, Allocator>::Sum(std::size_t first, std::size_t count) const
+{
+  T sum = T();
+  ForEachBlock(first, RangeEnd(first, count), [&sum](const T* values, std::size_t n) {
+    sum += internal::Sum(values, n);
+  });
+  return sum;
+}
+
+template <typename T, typename Allocator>
+std::pair<T, T> Array<T, Allocator>::MinMax(std::size_t first, std::size_t count) const
+{
+  const std::size_t last = RangeEnd(first, count);
+  if (first == last) {
+    throw std::out_of_range("MinMax");
+  }
+  std::pair<T, T> result((*this)[first], (*this)[first]);
+  ForEachBlock(first, last, [&result](const T* values, std::size_t n) {
+    internal::MinMax(values, n, result.first, result.second);
+  });
+  return result;
+}
+
+template <typename T, typename Allocator>
+template <typename Predicate>
+std::size_t Array<T, Allocator>::CountIf(Predicate pred, std::size_t first, std::size_t count) const
+{
+  const std::size_t last = RangeEnd(first, count);
+  std::size_t result = 0;
+  if constexpr (std::is_arithmetic<T>::value) {
+    ForEachBlock(first, last, [&result, &pred](const T* values, std::size_t n) {
+      result += internal::CountIf(values, n, pred);
+    });
+  } else {
+    for (std::size_t idx = first; idx < last; ++idx) {
+      result += pred((*this)[idx]) ? 1 : 0;
+    }
+  }
+  return result;
+}
+
+template <typename T, typename Allocator>
+std::size_t Array<T, Allocator>::CopyTo(T* out, std::size_t first, std::size_t count) const
+{
+  const std::size_t last = RangeEnd(first, count);
+  const std::size_t version = version_;
+  state_->items.ForEach(first, last, [&out, version](const Item& item) {
+    *out++ = item.Get(version);
+  });
+  return last - first;
+}
+
+template <typename T, typename Allocator>
+std::size_t Array<T, Allocator>::RangeEnd(std::size_t first, std::size_t count) const
+{
+  const std::size_t size = Size();
+  if (first > size) {
+    throw std::out_of_range("Range");
+  }
+  return first + std::min(count, size - first);
+}
+
+/* The values of a block are looked up in the fat nodes one by one and
+ * copied to a buffer on the stack, which the kernels read contiguously. */
+template <typename T, typename Allocator>
+template <typename Visitor>
+void Array<T, Allocator>::ForEachBlock(std::size_t first, std::size_t last, Visitor&& visit) const
+{
+  constexpr std::size_t kBlock = 4096 / sizeof(T) > 0 ? 4096 / sizeof(T) : 1;
+  T block[kBlock];
+  while (first < last) {
+    const std::size_t n = std::min(kBlock, last - first);
+    CopyTo(block, first, n);
+    visit(block, n);
+    first += n;
+  }
+}
+
+template <typename T, typename Allocator>
+const T& Array<T, Allocator>::Builder::operator[](std::size_t idx) const
+{
+  if (idx >= size_) {
+    return tail_[idx - size_];
+  }
+  const auto update = updates_.find(idx);
+  return update != updates_.end() ? update->second : array_[idx];
+}
+
+template <typename T, typename Allocator>
+template <typename... Args>
+typename Array<T, Allocator>::Builder&
+Array<T, Allocator>::Builder::Emplace(std::size_t idx, Args&&... args)
+{
+  if (idx >= Size()) {
+    throw std::out_of_range("Update");
+  }
+  if (idx >= size_) {
+    tail_[idx - size_] = T(std::forward<Args>(args)...);
+  } else {
+    updates_.insert_or_assign(idx, T(std::forward<Args>(args)...));
+  }
+  return *this;
+}
+
+/* Every element gets one node of the new version, whatever count of
+ * modifications it had in the builder. A failed write takes the moved
+ * values back from the dropped nodes. */
+template <typename T, typename Allocator>
+Array<T, Allocator> Array<T, Allocator>::Builder::Persistent()
+{
+  if (failed_) {
+    throw std::logic_error("Persistent");
+  }
+  std::lock_guard<std::mutex> lk(array_.state_->mutex);
+  array_.CheckVersion();
+  State& state = *array_.state_;
+  const std::size_t version = array_.version_ + 1;
+  auto updated = updates_.begin();
+  std::size_t appended = 0;
+  array_.Write(version, [&] {
+    for (; updated != updates_.end(); ++updated) {
+      state.log.indices.EmplaceBack(updated->first);
+      state.items[updated->first].Emplace(version, Pass(updated->second));
+    }
+    state.items.Reserve(Size());
+    for (; appended < tail_.size(); ++appended) {
+      state.log.indices.EmplaceBack(size_ + appended);
+      state.items.EmplaceBack(std::in_place, version, array_.GetAllocator(), Pass(tail_[appended]));
+    }
+    if (!tail_.empty()) {
+      state.sizes.Add(version, Size());
+    }
+  }, [&] {
+    for (auto update = updates_.begin(); update != updated; ++update) {
+      array_.TakeBack(update->first, version, update->second);
+    }
+    for (std::size_t i = 0; i < appended; ++i) {
+      array_.TakeBack(size_ + i, version, tail_[i]);
+    }
+    failed_ = !kKeepsValues;
+  });
+  size_ = Size();
+  updates_.clear();
+  tail_.clear();
+  array_ = Array<T, Allocator>(array_, version);
+  return array_;
 }
 
-} // namespace pdc
+} // namespace pdc
\ No newline at end of file
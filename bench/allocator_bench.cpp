@@ -0,0 +1,97 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <memory_resource>
+
+#include "../array.hpp"
+#include "../list.hpp"
+#include "../version_arena.hpp"
+
+
+// Counts requests to the heap made by the containers or by the arena.
+class CountingResource : public std::pmr::memory_resource {
+public:
+  std::size_t allocations = 0;
+protected:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override
+  {
+    ++allocations;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override
+  {
+    std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+  {
+    return this == &other;
+  }
+};
+
+template <typename Container>
+static void UpdateHistory(benchmark::State& state, std::pmr::memory_resource* resource,
+                          CountingResource& heap)
+{
+  const std::size_t count = state.range(0);
+  std::pmr::polymorphic_allocator<int> alloc(resource);
+  for (auto _ : state) {
+    Container array(count, 0, alloc);
+    for (std::size_t i = 0; i < count; ++i) {
+      array = array.Update(i, i);
+      array = array.PushBack(i);
+    }
+  }
+  state.counters["allocs/op"] =
+    double(heap.allocations) / (state.iterations() * 2 * count);
+  state.SetItemsProcessed(state.iterations() * 2 * count);
+}
+
+using PmrArray = pdc::Array<int, std::pmr::polymorphic_allocator<int>>;
+using PmrList = pdc::List<int, std::pmr::polymorphic_allocator<int>>;
+
+static void BM_ArrayHistoryHeap(benchmark::State& state)
+{
+  CountingResource heap;
+  UpdateHistory<PmrArray>(state, &heap, heap);
+}
+BENCHMARK(BM_ArrayHistoryHeap)->Range(1 << 10, 1 << 16);
+
+static void BM_ArrayHistoryArena(benchmark::State& state)
+{
+  CountingResource heap;
+  pdc::VersionArena arena(std::size_t(1) << 20, &heap);
+  UpdateHistory<PmrArray>(state, &arena, heap);
+}
+BENCHMARK(BM_ArrayHistoryArena)->Range(1 << 10, 1 << 16);
+
+template <typename Container>
+static void PushBackHistory(benchmark::State& state, std::pmr::memory_resource* resource,
+                            CountingResource& heap)
+{
+  const std::size_t count = state.range(0);
+  std::pmr::polymorphic_allocator<int> alloc(resource);
+  for (auto _ : state) {
+    Container list(alloc);
+    for (std::size_t i = 0; i < count; ++i) {
+      list = list.PushBack(i);
+    }
+  }
+  state.counters["allocs/op"] =
+    double(heap.allocations) / (state.iterations() * count);
+  state.SetItemsProcessed(state.iterations() * count);
+}
+
+static void BM_ListHistoryHeap(benchmark::State& state)
+{
+  CountingResource heap;
+  PushBackHistory<PmrList>(state, &heap, heap);
+}
+BENCHMARK(BM_ListHistoryHeap)->Range(1 << 10, 1 << 14);
+
+static void BM_ListHistoryArena(benchmark::State& state)
+{
+  CountingResource heap;
+  pdc::VersionArena arena(std::size_t(1) << 20, &heap);
+  PushBackHistory<PmrList>(state, &arena, heap);
+}
+BENCHMARK(BM_ListHistoryArena)->Range(1 << 10, 1 << 14);
@@ -0,0 +1,265 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "../array.hpp"
+
+
+static const pdc::Array<int>& SharedArray()
+{
+  static const pdc::Array<int> array = [] {
+    pdc::Array<int> array(1 << 16, 0);
+    for (int i = 0; i < (1 << 16); ++i) {
+      array = array.Update(i, i);
+    }
+    return array;
+  }();
+  return array;
+}
+
+// Read throughput of a published version against the number of readers.
+static void BM_ArrayRead(benchmark::State& state)
+{
+  const auto& array = SharedArray();
+  const auto snapshot = array.Undo();
+  std::size_t idx = state.thread_index() * 4099;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(snapshot[idx & 0xFFFF]);
+    idx += 7919;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ArrayRead)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_ArraySize(benchmark::State& state)
+{
+  const auto& array = SharedArray();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(array.Size());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ArraySize)->ThreadRange(1, 8)->UseRealTime();
+
+// Ingesting a batch of updates one version per update against one version
+// for the whole batch.
+static void BM_ArrayUpdatePerOp(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  pdc::Array<int> array(count, 0);
+  for (auto _ : state) {
+    for (std::size_t i = 0; i < count; ++i) {
+      array = array.Update(i, i);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ArrayUpdatePerOp)->Range(1 << 10, 1 << 16);
+
+static void BM_ArrayUpdateBatch(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  pdc::Array<int> array(count, 0);
+  for (auto _ : state) {
+    auto changes = array.Batch();
+    for (std::size_t i = 0; i < count; ++i) {
+      changes.Update(i, i);
+    }
+    array = changes.Commit();
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ArrayUpdateBatch)->Range(1 << 10, 1 << 16);
+
+static void BM_ArrayPushBackPerOp(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  for (auto _ : state) {
+    pdc::Array<int> array;
+    for (std::size_t i = 0; i < count; ++i) {
+      array = array.PushBack(i);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ArrayPushBackPerOp)->Range(1 << 10, 1 << 16);
+
+static void BM_ArrayPushBackBatch(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  for (auto _ : state) {
+    pdc::Array<int> array;
+    auto changes = array.Batch();
+    for (std::size_t i = 0; i < count; ++i) {
+      changes.PushBack(i);
+    }
+    benchmark::DoNotOptimize(changes.Commit());
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ArrayPushBackBatch)->Range(1 << 10, 1 << 16);
+
+static void BM_ArrayPushBackTransient(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  for (auto _ : state) {
+    auto builder = pdc::Array<int>().Transient();
+    for (std::size_t i = 0; i < count; ++i) {
+      builder.PushBack(i);
+    }
+    benchmark::DoNotOptimize(builder.Persistent());
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ArrayPushBackTransient)->Range(1 << 10, 1 << 16);
+
+// Reading the oldest and the latest version of elements with a history of
+// the given depth: every element is updated depth times.
+static pdc::Array<int> HistoryArray(std::size_t size, std::size_t depth)
+{
+  pdc::Array<int> array(size, 0);
+  for (std::size_t d = 0; d < depth; ++d) {
+    auto changes = array.Batch();
+    for (std::size_t i = 0; i < size; ++i) {
+      changes.Update(i, d);
+    }
+    array = changes.Commit();
+  }
+  return array;
+}
+
+static void ReadAtVersion(benchmark::State& state, bool oldest)
+{
+  const std::size_t size = state.range(0);
+  auto array = HistoryArray(size, state.range(1));
+  if (oldest) {
+    for (std::size_t d = 0; d < std::size_t(state.range(1)); ++d) {
+      array = array.Undo();
+    }
+  }
+  std::size_t idx = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(array[idx]);
+    idx = (idx + 7919) % size;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_ArrayReadLatest(benchmark::State& state) { ReadAtVersion(state, false); }
+BENCHMARK(BM_ArrayReadLatest)->ArgsProduct({{1 << 10, 1 << 16}, {1, 16, 256}});
+
+static void BM_ArrayReadOldest(benchmark::State& state) { ReadAtVersion(state, true); }
+BENCHMARK(BM_ArrayReadOldest)->ArgsProduct({{1 << 10, 1 << 16}, {1, 16, 256}});
+
+// Single updates of an array whose elements already have a deep history.
+static void BM_ArrayUpdateDeep(benchmark::State& state)
+{
+  const std::size_t size = state.range(0);
+  auto array = HistoryArray(size, state.range(1));
+  std::size_t idx = 0;
+  for (auto _ : state) {
+    array = array.Update(idx, idx);
+    idx = (idx + 7919) % size;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ArrayUpdateDeep)->ArgsProduct({{1 << 10, 1 << 16}, {1, 16, 256}});
+
+// Jumping to a version and reading one element of it: an Array object takes
+// a reference to the shared state, a borrowed view takes none.
+static void BM_ArrayVersionHandle(benchmark::State& state)
+{
+  const auto& array = SharedArray();
+  const std::size_t versions = array.VersionCount();
+  std::size_t version = state.thread_index() * 4099;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(array.AtVersion(version % versions)[version & 0xFFFF]);
+    version += 7919;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ArrayVersionHandle)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_ArrayVersionView(benchmark::State& state)
+{
+  const auto view = SharedArray().Borrow();
+  const std::size_t versions = SharedArray().VersionCount();
+  std::size_t version = state.thread_index() * 4099;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(view.AtVersion(version % versions)[version & 0xFFFF]);
+    version += 7919;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ArrayVersionView)->ThreadRange(1, 8)->UseRealTime();
+
+// Range reductions over a version whose elements have several nodes each,
+// against a loop over operator[].
+static pdc::Array<double> HistoryArray(std::size_t count)
+{
+  pdc::Array<double> array(count, 1.0);
+  for (int round = 0; round < 4; ++round) {
+    auto changes = array.Batch();
+    for (std::size_t i = round; i < count; i += 2) {
+      changes.Update(i, i * 0.5);
+    }
+    array = changes.Commit();
+  }
+  return array;
+}
+
+static void BM_ArraySumIndexed(benchmark::State& state)
+{
+  const auto array = HistoryArray(state.range(0));
+  for (auto _ : state) {
+    double sum = 0;
+    for (std::size_t i = 0; i < array.Size(); ++i) {
+      sum += array[i];
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * array.Size());
+}
+BENCHMARK(BM_ArraySumIndexed)->Range(1 << 10, 1 << 20);
+
+static void BM_ArraySum(benchmark::State& state)
+{
+  const auto array = HistoryArray(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(array.Sum());
+  }
+  state.SetItemsProcessed(state.iterations() * array.Size());
+}
+BENCHMARK(BM_ArraySum)->Range(1 << 10, 1 << 20);
+
+static void BM_ArrayMinMax(benchmark::State& state)
+{
+  const auto array = HistoryArray(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(array.MinMax());
+  }
+  state.SetItemsProcessed(state.iterations() * array.Size());
+}
+BENCHMARK(BM_ArrayMinMax)->Range(1 << 10, 1 << 20);
+
+static void BM_ArrayCountIf(benchmark::State& state)
+{
+  const auto array = HistoryArray(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(array.CountIf([](double value) { return value > 100.0; }));
+  }
+  state.SetItemsProcessed(state.iterations() * array.Size());
+}
+BENCHMARK(BM_ArrayCountIf)->Range(1 << 10, 1 << 20);
+
+static void BM_ArrayCopyTo(benchmark::State& state)
+{
+  const auto array = HistoryArray(state.range(0));
+  std::vector<double> out(array.Size());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(array.CopyTo(out.data()));
+  }
+  state.SetItemsProcessed(state.iterations() * array.Size());
+}
+BENCHMARK(BM_ArrayCopyTo)->Range(1 << 10, 1 << 20);
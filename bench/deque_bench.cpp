@@ -0,0 +1,94 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+
+#include "../deque.hpp"
+#include "../list.hpp"
+
+
+static pdc::Deque<int> MakeDeque(std::size_t count)
+{
+  pdc::Deque<int> deque;
+  for (std::size_t i = 0; i < count; ++i) {
+    deque = deque.PushBack(i);
+  }
+  return deque;
+}
+
+static void BM_DequePushBack(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(MakeDeque(count));
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_DequePushBack)->Range(1 << 10, 1 << 16);
+
+static void BM_DequePushFront(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  for (auto _ : state) {
+    pdc::Deque<int> deque;
+    for (std::size_t i = 0; i < count; ++i) {
+      deque = deque.PushFront(i);
+    }
+    benchmark::DoNotOptimize(deque);
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_DequePushFront)->Range(1 << 10, 1 << 16);
+
+static void BM_ListPushFront(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  for (auto _ : state) {
+    pdc::List<int> list;
+    for (std::size_t i = 0; i < count; ++i) {
+      list = list.PushFront(i);
+    }
+    benchmark::DoNotOptimize(list);
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ListPushFront)->Range(1 << 10, 1 << 16);
+
+// A work queue of steady length: one element enters at the back and one
+// leaves at the front per step, each step makes two versions.
+static void BM_DequeQueue(benchmark::State& state)
+{
+  auto deque = MakeDeque(state.range(0));
+  int i = 0;
+  for (auto _ : state) {
+    deque = deque.PushBack(i++).PopFront();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DequeQueue)->Range(1 << 4, 1 << 16);
+
+static void BM_DequeAt(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  const auto deque = MakeDeque(count);
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(deque[i]);
+    i = (i + 7919) % count;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DequeAt)->Range(1 << 10, 1 << 20);
+
+static void BM_DequeScan(benchmark::State& state)
+{
+  const auto deque = MakeDeque(state.range(0));
+  for (auto _ : state) {
+    long sum = 0;
+    for (int value : deque) {
+      sum += value;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * deque.Size());
+}
+BENCHMARK(BM_DequeScan)->Range(1 << 10, 1 << 20);
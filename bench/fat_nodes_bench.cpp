@@ -0,0 +1,39 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+
+#include "../fat_nodes.hpp"
+
+
+// Read latency of a single cell against the depth of its history.
+static void BM_FatNodesGet(benchmark::State& state)
+{
+  const std::size_t depth = state.range(0);
+  internal::FatNodes<int> cell(0, 0);
+  for (std::size_t version = 1; version < depth; ++version) {
+    cell.Add(version, static_cast<int>(version));
+  }
+
+  std::size_t version = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cell.Get(version));
+    version = (version + 7919) % depth;
+  }
+  state.SetComplexityN(depth);
+}
+BENCHMARK(BM_FatNodesGet)->RangeMultiplier(8)->Range(8, 1 << 21)->Complexity();
+
+static void BM_FatNodesGetOldest(benchmark::State& state)
+{
+  const std::size_t depth = state.range(0);
+  internal::FatNodes<int> cell(0, 0);
+  for (std::size_t version = 1; version < depth; ++version) {
+    cell.Add(version, static_cast<int>(version));
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cell.Get(0));
+  }
+  state.SetComplexityN(depth);
+}
+BENCHMARK(BM_FatNodesGetOldest)->RangeMultiplier(8)->Range(8, 1 << 21)->Complexity();
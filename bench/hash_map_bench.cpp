@@ -0,0 +1,120 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "../hash_map.hpp"
+
+
+// The baseline keeps every version as an immutable std::unordered_map and
+// copies the whole map to make the next version.
+using CowHashMap = std::shared_ptr<const std::unordered_map<std::int64_t, std::int64_t>>;
+
+static std::vector<std::int64_t> Keys(std::size_t count)
+{
+  std::vector<std::int64_t> keys(count);
+  std::mt19937_64 random(42);
+  for (auto& key : keys) {
+    key = random();
+  }
+  return keys;
+}
+
+static pdc::HashMap<std::int64_t, std::int64_t> MakeHashMap(const std::vector<std::int64_t>& keys)
+{
+  pdc::HashMap<std::int64_t, std::int64_t> map;
+  for (std::int64_t key : keys) {
+    map = map.Insert(key, key);
+  }
+  return map;
+}
+
+// Versions made one insertion each, every version copies one path.
+static void BM_HashMapInsert(benchmark::State& state)
+{
+  const auto keys = Keys(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(MakeHashMap(keys));
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_HashMapInsert)->Range(1 << 8, 1 << 14);
+
+// Bulk load of one version through a builder, which changes its own nodes in
+// place.
+static void BM_HashMapTransientInsert(benchmark::State& state)
+{
+  const auto keys = Keys(state.range(0));
+  for (auto _ : state) {
+    auto builder = pdc::HashMap<std::int64_t, std::int64_t>().Transient();
+    for (std::int64_t key : keys) {
+      builder.Insert(key, key);
+    }
+    benchmark::DoNotOptimize(builder.Persistent());
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_HashMapTransientInsert)->Range(1 << 8, 1 << 14);
+
+static void BM_CowHashMapInsert(benchmark::State& state)
+{
+  const auto keys = Keys(state.range(0));
+  for (auto _ : state) {
+    std::vector<CowHashMap> versions(1, std::make_shared<const std::unordered_map<std::int64_t, std::int64_t>>());
+    for (std::int64_t key : keys) {
+      auto next = std::make_shared<std::unordered_map<std::int64_t, std::int64_t>>(*versions.back());
+      (*next)[key] = key;
+      versions.push_back(std::move(next));
+    }
+    benchmark::DoNotOptimize(versions);
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_CowHashMapInsert)->Range(1 << 8, 1 << 11);
+
+static void BM_HashMapFind(benchmark::State& state)
+{
+  const auto keys = Keys(state.range(0));
+  const auto map = MakeHashMap(keys);
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.Find(keys[i]));
+    i = (i + 7919) % keys.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HashMapFind)->Range(1 << 10, 1 << 18);
+
+static void BM_UnorderedMapFind(benchmark::State& state)
+{
+  const auto keys = Keys(state.range(0));
+  std::unordered_map<std::int64_t, std::int64_t> map;
+  for (std::int64_t key : keys) {
+    map[key] = key;
+  }
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.find(keys[i]));
+    i = (i + 7919) % keys.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_UnorderedMapFind)->Range(1 << 10, 1 << 18);
+
+static void BM_HashMapIterate(benchmark::State& state)
+{
+  const auto map = MakeHashMap(Keys(state.range(0)));
+  for (auto _ : state) {
+    std::int64_t sum = 0;
+    for (const auto& element : map) {
+      sum += element.second;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * map.Size());
+}
+BENCHMARK(BM_HashMapIterate)->Range(1 << 10, 1 << 16);
@@ -0,0 +1,171 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <iterator>
+#include <list>
+#include <numeric>
+#include <vector>
+
+#include "../list.hpp"
+
+
+static void BM_ListPushBackPerOp(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  for (auto _ : state) {
+    pdc::List<int> list;
+    for (std::size_t i = 0; i < count; ++i) {
+      list = list.PushBack(i);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ListPushBackPerOp)->Range(1 << 10, 1 << 16);
+
+static void BM_ListAppend(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  std::vector<int> values(count);
+  std::iota(values.begin(), values.end(), 0);
+  for (auto _ : state) {
+    pdc::List<int> list;
+    benchmark::DoNotOptimize(list.Append(values.begin(), values.end()));
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ListAppend)->Range(1 << 10, 1 << 16);
+
+static void BM_ListPushBackTransient(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  for (auto _ : state) {
+    auto builder = pdc::List<int>().Transient();
+    for (std::size_t i = 0; i < count; ++i) {
+      builder.PushBack(i);
+    }
+    benchmark::DoNotOptimize(builder.Persistent());
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ListPushBackTransient)->Range(1 << 10, 1 << 16);
+
+static void BM_ListSize(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  std::vector<int> values(count);
+  const auto list = pdc::List<int>().Append(values.begin(), values.end());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(list.Size());
+  }
+}
+BENCHMARK(BM_ListSize)->Range(1 << 10, 1 << 20);
+
+static void BM_ListAt(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  std::vector<int> values(count);
+  std::iota(values.begin(), values.end(), 0);
+  const auto list = pdc::List<int>().Append(values.begin(), values.end());
+  std::size_t idx = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(list.At(idx));
+    idx = (idx + 7919) % count;
+  }
+}
+BENCHMARK(BM_ListAt)->Range(1 << 10, 1 << 20);
+
+// Full scan of a published version against the number of readers, with
+// std::list as the baseline.
+static void BM_ListScan(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  std::vector<int> values(count);
+  std::iota(values.begin(), values.end(), 0);
+  static pdc::List<int> list;
+  if (state.thread_index() == 0) {
+    list = pdc::List<int>().Append(values.begin(), values.end());
+  }
+  for (auto _ : state) {
+    long sum = 0;
+    for (const int value : list) {
+      sum += value;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ListScan)->Range(1 << 10, 1 << 20)->ThreadRange(1, 4)->UseRealTime();
+
+static void BM_StdListScan(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  std::list<int> list(count);
+  std::iota(list.begin(), list.end(), 0);
+  for (auto _ : state) {
+    long sum = 0;
+    for (const int value : list) {
+      sum += value;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_StdListScan)->Range(1 << 10, 1 << 20);
+
+static pdc::List<int> MakeList(std::size_t count)
+{
+  std::vector<int> values(count);
+  std::iota(values.begin(), values.end(), 0);
+  return pdc::List<int>().Append(values.begin(), values.end());
+}
+
+// Insertion and removal at varying positions, one version per operation.
+static void BM_ListInsert(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  auto list = MakeList(count);
+  std::size_t idx = 0;
+  for (auto _ : state) {
+    auto it = list.begin();
+    std::advance(it, idx % 64);
+    list = list.Insert(it, idx);
+    idx += 7919;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ListInsert)->Range(1 << 10, 1 << 20);
+
+static void BM_ListRemove(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  auto list = MakeList(count);
+  for (auto _ : state) {
+    if (list.Size() == 1) {
+      state.PauseTiming();
+      list = MakeList(count);
+      state.ResumeTiming();
+    }
+    list = list.Remove(list.begin());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ListRemove)->Range(1 << 10, 1 << 20);
+
+// Random access to an old version against the count of newer versions.
+static void BM_ListAtOldVersion(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  const std::size_t depth = state.range(1);
+  auto list = MakeList(count);
+  const auto old = list;
+  for (std::size_t d = 0; d < depth; ++d) {
+    list = list.PushBack(d);
+  }
+  std::size_t idx = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(old.At(idx));
+    idx = (idx + 7919) % count;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ListAtOldVersion)->ArgsProduct({{1 << 10, 1 << 16}, {1, 256, 4096}});
@@ -0,0 +1,152 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../map.hpp"
+
+
+// The baseline keeps every version as an immutable std::map and copies the
+// whole map to make the next version.
+using CowMap = std::shared_ptr<const std::map<std::int64_t, std::int64_t>>;
+
+static std::vector<std::int64_t> Keys(std::size_t count)
+{
+  std::vector<std::int64_t> keys(count);
+  std::mt19937_64 random(42);
+  for (auto& key : keys) {
+    key = random();
+  }
+  return keys;
+}
+
+static pdc::Map<std::int64_t, std::int64_t> MakeMap(const std::vector<std::int64_t>& keys)
+{
+  pdc::Map<std::int64_t, std::int64_t> map;
+  for (std::int64_t key : keys) {
+    map = map.Insert(key, key);
+  }
+  return map;
+}
+
+static CowMap MakeCowMap(const std::vector<std::int64_t>& keys)
+{
+  auto map = std::make_shared<std::map<std::int64_t, std::int64_t>>();
+  for (std::int64_t key : keys) {
+    (*map)[key] = key;
+  }
+  return map;
+}
+
+// Versions made one insertion each: O(1) amortized new space per version
+// against a full copy.
+static void BM_MapInsert(benchmark::State& state)
+{
+  const auto keys = Keys(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(MakeMap(keys));
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_MapInsert)->Range(1 << 8, 1 << 14);
+
+static void BM_CowMapInsert(benchmark::State& state)
+{
+  const auto keys = Keys(state.range(0));
+  for (auto _ : state) {
+    std::vector<CowMap> versions(1, std::make_shared<const std::map<std::int64_t, std::int64_t>>());
+    for (std::int64_t key : keys) {
+      auto next = std::make_shared<std::map<std::int64_t, std::int64_t>>(*versions.back());
+      (*next)[key] = key;
+      versions.push_back(std::move(next));
+    }
+    benchmark::DoNotOptimize(versions);
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_CowMapInsert)->Range(1 << 8, 1 << 11);
+
+// Updates of existing keys of a large map.
+static void BM_MapUpdate(benchmark::State& state)
+{
+  const auto keys = Keys(state.range(0));
+  auto map = MakeMap(keys);
+  std::size_t i = 0;
+  for (auto _ : state) {
+    map = map.Insert(keys[i], i);
+    i = (i + 7919) % keys.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MapUpdate)->Range(1 << 10, 1 << 18);
+
+static void BM_CowMapUpdate(benchmark::State& state)
+{
+  const auto keys = Keys(state.range(0));
+  CowMap map = MakeCowMap(keys);
+  std::size_t i = 0;
+  for (auto _ : state) {
+    auto next = std::make_shared<std::map<std::int64_t, std::int64_t>>(*map);
+    (*next)[keys[i]] = i;
+    map = std::move(next);
+    i = (i + 7919) % keys.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CowMapUpdate)->Range(1 << 10, 1 << 14);
+
+// Lookups in the latest version and in the first version holding all keys,
+// whose nodes have later entries in their histories.
+static void FindAtVersion(benchmark::State& state, bool old)
+{
+  const auto keys = Keys(state.range(0));
+  auto map = MakeMap(keys);
+  const auto first = map;
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    map = map.Remove(keys[i]).Insert(keys[i], i);
+  }
+  const auto& version = old ? first : map;
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(version.Find(keys[i]));
+    i = (i + 7919) % keys.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_MapFindLatest(benchmark::State& state) { FindAtVersion(state, false); }
+BENCHMARK(BM_MapFindLatest)->Range(1 << 10, 1 << 18);
+
+static void BM_MapFindOld(benchmark::State& state) { FindAtVersion(state, true); }
+BENCHMARK(BM_MapFindOld)->Range(1 << 10, 1 << 18);
+
+static void BM_CowMapFind(benchmark::State& state)
+{
+  const auto keys = Keys(state.range(0));
+  const CowMap map = MakeCowMap(keys);
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map->find(keys[i]));
+    i = (i + 7919) % keys.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CowMapFind)->Range(1 << 10, 1 << 18);
+
+static void BM_MapIterate(benchmark::State& state)
+{
+  const auto map = MakeMap(Keys(state.range(0)));
+  for (auto _ : state) {
+    std::int64_t sum = 0;
+    for (const auto& element : map) {
+      sum += element.second;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * map.Size());
+}
+BENCHMARK(BM_MapIterate)->Range(1 << 10, 1 << 16);
@@ -0,0 +1,75 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "../mapped_array.hpp"
+
+
+static const std::string kPath = "mapped_array_bench.pdc";
+
+static void CreateHistory(std::size_t count)
+{
+  pdc::MappedArray<std::int64_t> array(kPath, count, 0);
+  for (std::size_t i = 0; i < count; ++i) {
+    array = array.Update(i, i);
+  }
+}
+
+// Reopening maps a segment per doubling of the history and reads no records.
+static void BM_MappedArrayOpen(benchmark::State& state)
+{
+  CreateHistory(state.range(0));
+  for (auto _ : state) {
+    pdc::MappedArray<std::int64_t> array(kPath);
+    benchmark::DoNotOptimize(array.Size());
+  }
+}
+BENCHMARK(BM_MappedArrayOpen)->Range(1 << 10, 1 << 20);
+
+static void BM_MappedArrayRead(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  CreateHistory(count);
+  const pdc::MappedArray<std::int64_t> array(kPath);
+  std::size_t idx = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(array[idx]);
+    idx = (idx + 7919) % count;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MappedArrayRead)->Range(1 << 10, 1 << 20);
+
+// Reads of the first version of an element with a long history follow the
+// skip pointers, O(log m) records for m modifications.
+static void BM_MappedArrayReadOld(benchmark::State& state)
+{
+  {
+    pdc::MappedArray<std::int64_t> array(kPath, 1, 0);
+    for (std::int64_t i = 0; i < state.range(0); ++i) {
+      array = array.Update(0, i);
+    }
+  }
+  const pdc::MappedArray<std::int64_t> array(kPath);
+  const auto first = array.AtVersion(1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(first[0]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MappedArrayReadOld)->Range(1 << 10, 1 << 20);
+
+static void BM_MappedArrayUpdate(benchmark::State& state)
+{
+  const std::size_t count = state.range(0);
+  pdc::MappedArray<std::int64_t> array(kPath, count, 0);
+  std::size_t idx = 0;
+  for (auto _ : state) {
+    array = array.Update(idx, idx);
+    idx = (idx + 1) % count;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MappedArrayUpdate)->Range(1 << 10, 1 << 20);
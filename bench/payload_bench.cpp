@@ -0,0 +1,77 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <string>
+
+#include "../array.hpp"
+#include "../list.hpp"
+
+
+// Writes of large values: a copied value against a moved or emplaced one.
+static void BM_ArrayPushBackCopy(benchmark::State& state)
+{
+  const std::string value(state.range(0), 'x');
+  for (auto _ : state) {
+    pdc::Array<std::string> array;
+    for (int i = 0; i < 256; ++i) {
+      array = array.PushBack(value);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 256);
+}
+BENCHMARK(BM_ArrayPushBackCopy)->Range(64, 1 << 16);
+
+static void BM_ArrayPushBackMove(benchmark::State& state)
+{
+  for (auto _ : state) {
+    pdc::Array<std::string> array;
+    for (int i = 0; i < 256; ++i) {
+      std::string value(state.range(0), 'x');
+      array = array.PushBack(std::move(value));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 256);
+}
+BENCHMARK(BM_ArrayPushBackMove)->Range(64, 1 << 16);
+
+static void BM_ArrayEmplace(benchmark::State& state)
+{
+  for (auto _ : state) {
+    pdc::Array<std::string> array(16);
+    for (int i = 0; i < 256; ++i) {
+      array = array.Emplace(i % 16, state.range(0), 'x');
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 256);
+}
+BENCHMARK(BM_ArrayEmplace)->Range(64, 1 << 16);
+
+// Every modification copies the chunk of the changed position, large values
+// are shared between the copies instead of being copied.
+static void BM_ListInsertMiddle(benchmark::State& state)
+{
+  for (auto _ : state) {
+    pdc::List<std::string> list;
+    for (int i = 0; i < 256; ++i) {
+      auto it = list.begin();
+      for (int j = 0; j < i / 2; ++j) {
+        ++it;
+      }
+      list = list.Emplace(it, state.range(0), 'x');
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 256);
+}
+BENCHMARK(BM_ListInsertMiddle)->Range(64, 1 << 16);
+
+static void BM_ListEmplaceBack(benchmark::State& state)
+{
+  for (auto _ : state) {
+    pdc::List<std::string> list;
+    for (int i = 0; i < 256; ++i) {
+      list = list.EmplaceBack(state.range(0), 'x');
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 256);
+}
+BENCHMARK(BM_ListEmplaceBack)->Range(64, 1 << 16);
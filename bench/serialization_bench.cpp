@@ -0,0 +1,120 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <sstream>
+#include <vector>
+
+#include "../array.hpp"
+#include "../list.hpp"
+
+
+// An array of 64-bit values with one update of every element after creation.
+static pdc::Array<std::int64_t> MakeArray(std::size_t count)
+{
+  pdc::Array<std::int64_t> array(count, 0);
+  auto changes = array.Batch();
+  for (std::size_t i = 0; i < count; ++i) {
+    changes.Update(i, i);
+  }
+  return changes.Commit();
+}
+
+static pdc::List<std::int64_t> MakeList(std::size_t count)
+{
+  std::vector<std::int64_t> values(count);
+  std::iota(values.begin(), values.end(), 0);
+  pdc::List<std::int64_t> list;
+  list = list.Append(values.begin(), values.end());
+  for (std::size_t i = 0; i < 64; ++i) {
+    list = list.PushBack(i);
+  }
+  return list;
+}
+
+static void BM_ArraySave(benchmark::State& state)
+{
+  const auto array = MakeArray(state.range(0));
+  std::size_t bytes = 0;
+  for (auto _ : state) {
+    std::stringstream stream;
+    array.Save(stream);
+    bytes = stream.tellp();
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK(BM_ArraySave)->Range(1 << 10, 1 << 20);
+
+static void BM_ArrayLoad(benchmark::State& state)
+{
+  std::stringstream stream;
+  MakeArray(state.range(0)).Save(stream);
+  const std::string data = stream.str();
+  for (auto _ : state) {
+    std::istringstream in(data);
+    benchmark::DoNotOptimize(pdc::Array<std::int64_t>::Load(in));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_ArrayLoad)->Range(1 << 10, 1 << 20);
+
+static void BM_ArraySaveSnapshot(benchmark::State& state)
+{
+  const auto array = MakeArray(state.range(0));
+  for (auto _ : state) {
+    std::stringstream stream;
+    array.SaveSnapshot(stream);
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0) * sizeof(std::int64_t));
+}
+BENCHMARK(BM_ArraySaveSnapshot)->Range(1 << 10, 1 << 20);
+
+static void BM_ListSave(benchmark::State& state)
+{
+  const auto list = MakeList(state.range(0));
+  std::size_t bytes = 0;
+  for (auto _ : state) {
+    std::stringstream stream;
+    list.Save(stream);
+    bytes = stream.tellp();
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK(BM_ListSave)->Range(1 << 10, 1 << 20);
+
+static void BM_ListLoad(benchmark::State& state)
+{
+  std::stringstream stream;
+  MakeList(state.range(0)).Save(stream);
+  const std::string data = stream.str();
+  for (auto _ : state) {
+    std::istringstream in(data);
+    benchmark::DoNotOptimize(pdc::List<std::int64_t>::Load(in));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_ListLoad)->Range(1 << 10, 1 << 20);
+
+// A flat snapshot is written chunk by chunk, its speed is bounded by copying.
+static void BM_ListSaveSnapshot(benchmark::State& state)
+{
+  const auto list = MakeList(state.range(0));
+  for (auto _ : state) {
+    std::stringstream stream;
+    list.SaveSnapshot(stream);
+  }
+  state.SetBytesProcessed(state.iterations() * list.Size() * sizeof(std::int64_t));
+}
+BENCHMARK(BM_ListSaveSnapshot)->Range(1 << 10, 1 << 20);
+
+static void BM_ArraySaveCompressed(benchmark::State& state)
+{
+  const auto array = MakeArray(state.range(0));
+  for (auto _ : state) {
+    std::stringstream stream;
+    array.Save(stream, pdc::Compression::Zlib);
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0) * sizeof(std::int64_t) * 2);
+}
+BENCHMARK(BM_ArraySaveCompressed)->Range(1 << 10, 1 << 20);
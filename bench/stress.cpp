@@ -0,0 +1,334 @@
+// Scaling harness for concurrent readers and writers.
+//
+// Readers read random elements of versions up to --skew versions behind the
+// latest one, writers modify the latest version and retry when another
+// writer wins the race. The report shows the throughput and the latency
+// distribution of reads and writes. A single read takes about as long as
+// reading the clock, so reads are timed in batches and the latency of a read
+// is the mean of its batch.
+//
+// With --merge Array writers prepare their update against the version they
+// have and merge it into the latest one instead of retrying.
+//
+//   ./stress --container=list --readers=4 --writers=2 --skew=64 --seconds=5
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../array.hpp"
+#include "../list.hpp"
+
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string container = "array";
+  unsigned readers = 4;
+  unsigned writers = 1;
+  std::size_t size = 1 << 16;
+  std::size_t skew = 16;
+  std::size_t refresh = 1024;
+  double seconds = 2;
+  bool merge = false;
+};
+
+// Log-linear histogram of latencies in nanoseconds: 32 buckets per power of
+// two, so percentiles are accurate to about 3%.
+class Histogram {
+  static constexpr unsigned kSub = 32;
+  std::vector<std::uint64_t> counts_ = std::vector<std::uint64_t>(64 * kSub);
+  std::uint64_t total_ = 0;
+  std::uint64_t max_ = 0;
+  static unsigned Bucket(std::uint64_t ns)
+  {
+    if (ns < kSub) {
+      return ns;
+    }
+    const unsigned log = 63 - __builtin_clzll(ns);
+    return (log - 4) * kSub + (ns >> (log - 5)) - kSub;
+  }
+  static std::uint64_t Lower(unsigned bucket)
+  {
+    if (bucket < kSub) {
+      return bucket;
+    }
+    const unsigned log = bucket / kSub + 4;
+    return (bucket % kSub + kSub) << (log - 5);
+  }
+public:
+  void Add(std::uint64_t ns)
+  {
+    ++counts_[Bucket(ns)];
+    ++total_;
+    max_ = std::max(max_, ns);
+  }
+  void Merge(const Histogram& other)
+  {
+    for (std::size_t i = 0; i < counts_.size(); ++i) {
+      counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    max_ = std::max(max_, other.max_);
+  }
+  std::uint64_t Max() const { return max_; }
+  std::uint64_t Percentile(double p) const
+  {
+    const std::uint64_t rank = std::ceil(p * total_);
+    std::uint64_t seen = 0;
+    for (unsigned i = 0; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen >= rank && seen > 0) {
+        return Lower(i);
+      }
+    }
+    return max_;
+  }
+};
+
+constexpr std::size_t kReadBatch = 64;
+
+struct Stats {
+  Histogram latency;
+  std::uint64_t ops = 0;
+  std::uint64_t conflicts = 0;
+};
+
+// The latest published version, writers replace it after every commit.
+// Writers finish in any order, so a version replaces only an older one.
+template <typename Container>
+class Published {
+  std::shared_ptr<const Container> latest_;
+public:
+  explicit Published(Container c) : latest_(std::make_shared<const Container>(std::move(c))) { }
+  Container Load() const { return *std::atomic_load(&latest_); }
+  void Store(Container c)
+  {
+    auto next = std::make_shared<const Container>(std::move(c));
+    auto latest = std::atomic_load(&latest_);
+    while (latest->GetVersion() < next->GetVersion() &&
+           !std::atomic_compare_exchange_weak(&latest_, &latest, next)) { }
+  }
+};
+
+struct ArrayOps {
+  using Container = pdc::Array<std::int64_t>;
+  static Container Make(std::size_t size) { return Container(size, 0); }
+  static std::int64_t Read(const Container& c, std::size_t idx) { return c[idx % c.Size()]; }
+  static Container Write(const Container& c, std::size_t idx, std::uint64_t)
+    { return c.Update(idx % c.Size(), idx); }
+  static Container Merge(const Container& c, std::size_t idx)
+    { return c.Batch().Update(idx % c.Size(), idx).Merge(); }
+};
+
+// Writers push at the back and remove at the front in turns, so the size of
+// the List stays about the same.
+struct ListOps {
+  using Container = pdc::List<std::int64_t>;
+  static Container Make(std::size_t size)
+  {
+    std::vector<std::int64_t> values(size);
+    return Container().Append(values.begin(), values.end());
+  }
+  static std::int64_t Read(const Container& c, std::size_t idx)
+    { return c.IsEmpty() ? 0 : c.At(idx % c.Size()); }
+  static Container Write(const Container& c, std::size_t idx, std::uint64_t n)
+    { return n % 2 ? c.Remove(c.begin()) : c.PushBack(idx); }
+};
+
+template <typename Ops>
+void Reader(const Options& options, const Published<typename Ops::Container>& published,
+            const std::atomic<bool>& stop, unsigned seed, Stats& stats)
+{
+  std::mt19937_64 random(seed);
+  std::int64_t sum = 0;
+  while (!stop.load(std::memory_order_relaxed)) {
+    auto version = published.Load();
+    const std::size_t back = random() % (options.skew + 1);
+    version = version.AtVersion(version.GetVersion() - std::min(back, version.GetVersion()));
+    for (std::size_t i = 0; i < options.refresh; i += kReadBatch) {
+      const std::size_t count = std::min(kReadBatch, options.refresh - i);
+      const auto start = Clock::now();
+      for (std::size_t j = 0; j < count; ++j) {
+        sum += Ops::Read(version, random());
+      }
+      stats.latency.Add(std::chrono::nanoseconds(Clock::now() - start).count() / count);
+      stats.ops += count;
+    }
+  }
+  volatile std::int64_t sink = sum;
+  (void)sink;
+}
+
+// Merging writers keep their own version, which falls behind the latest one
+// as other writers commit.
+template <typename Ops>
+void MergingWriter(Published<typename Ops::Container>& published, const std::atomic<bool>& stop,
+                   unsigned seed, Stats& stats)
+{
+  std::mt19937_64 random(seed);
+  auto version = published.Load();
+  while (!stop.load(std::memory_order_relaxed)) {
+    const std::size_t idx = random();
+    const auto start = Clock::now();
+    for (;;) {
+      try {
+        version = Ops::Merge(version, idx);
+        break;
+      } catch (const pdc::ConflictException&) {
+        ++stats.conflicts;
+        version = published.Load();
+      }
+    }
+    published.Store(version);
+    stats.latency.Add(std::chrono::nanoseconds(Clock::now() - start).count());
+    ++stats.ops;
+  }
+}
+
+template <typename Ops>
+void Writer(Published<typename Ops::Container>& published, const std::atomic<bool>& stop,
+            unsigned seed, Stats& stats)
+{
+  std::mt19937_64 random(seed);
+  for (std::uint64_t n = 0; !stop.load(std::memory_order_relaxed); ++n) {
+    const std::size_t idx = random();
+    const auto start = Clock::now();
+    for (;;) {
+      try {
+        published.Store(Ops::Write(published.Load(), idx, n));
+        break;
+      } catch (const pdc::IncorrectVersionException&) {
+        ++stats.conflicts;
+      }
+    }
+    stats.latency.Add(std::chrono::nanoseconds(Clock::now() - start).count());
+    ++stats.ops;
+  }
+}
+
+void Report(const char* name, const std::vector<Stats>& stats, double seconds)
+{
+  Stats total;
+  for (const Stats& s : stats) {
+    total.latency.Merge(s.latency);
+    total.ops += s.ops;
+    total.conflicts += s.conflicts;
+  }
+  const Histogram& h = total.latency;
+  std::printf("%-7s %8zu %12.0f %8llu %8llu %8llu %8llu %10llu\n", name, stats.size(),
+              total.ops / seconds,
+              static_cast<unsigned long long>(h.Percentile(0.5)),
+              static_cast<unsigned long long>(h.Percentile(0.99)),
+              static_cast<unsigned long long>(h.Percentile(0.999)),
+              static_cast<unsigned long long>(h.Max()),
+              static_cast<unsigned long long>(total.conflicts));
+}
+
+template <typename Ops, bool kMerge>
+void Run(const Options& options)
+{
+  Published<typename Ops::Container> published(Ops::Make(options.size));
+  std::atomic<bool> stop{false};
+  std::vector<Stats> readers(options.readers);
+  std::vector<Stats> writers(options.writers);
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < options.readers; ++i) {
+    threads.emplace_back([&, i] { Reader<Ops>(options, published, stop, i + 1, readers[i]); });
+  }
+  for (unsigned i = 0; i < options.writers; ++i) {
+    threads.emplace_back([&, i] {
+      if constexpr (kMerge) {
+        MergingWriter<Ops>(published, stop, 1000 + i, writers[i]);
+      } else {
+        Writer<Ops>(published, stop, 1000 + i, writers[i]);
+      }
+    });
+  }
+  const auto start = Clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+  stop.store(true);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::printf("%s%s: size %zu, skew %zu, %.1f s\n", options.container.c_str(),
+              kMerge ? " (merge)" : "", options.size, options.skew, seconds);
+  std::printf("%-7s %8s %12s %8s %8s %8s %8s %10s\n",
+              "", "threads", "ops/s", "p50 ns", "p99 ns", "p99.9 ns", "max ns", "conflicts");
+  Report("read", readers, seconds);
+  Report("write", writers, seconds);
+}
+
+bool Parse(const char* arg, const char* name, std::string& value)
+{
+  const std::size_t length = std::strlen(name);
+  if (std::strncmp(arg, name, length) != 0 || arg[length] != '=') {
+    return false;
+  }
+  value = arg + length + 1;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string value;
+    if (Parse(argv[i], "--container", value)) {
+      options.container = value;
+    } else if (Parse(argv[i], "--readers", value)) {
+      options.readers = std::stoul(value);
+    } else if (Parse(argv[i], "--writers", value)) {
+      options.writers = std::stoul(value);
+    } else if (Parse(argv[i], "--size", value)) {
+      options.size = std::stoull(value);
+    } else if (Parse(argv[i], "--skew", value)) {
+      options.skew = std::stoull(value);
+    } else if (Parse(argv[i], "--refresh", value)) {
+      options.refresh = std::stoull(value);
+    } else if (Parse(argv[i], "--seconds", value)) {
+      options.seconds = std::stod(value);
+    } else if (std::strcmp(argv[i], "--merge") == 0) {
+      options.merge = true;
+    } else {
+      std::fprintf(stderr,
+        "usage: %s [--container=array|list] [--readers=N] [--writers=N] [--size=N]\n"
+        "          [--skew=VERSIONS] [--refresh=READS] [--seconds=S] [--merge]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (options.container == "array") {
+    if (options.merge) {
+      Run<ArrayOps, true>(options);
+    } else {
+      Run<ArrayOps, false>(options);
+    }
+  } else if (options.container == "list") {
+    if (options.merge) {
+      std::fprintf(stderr, "--merge is supported only by array\n");
+      return 2;
+    }
+    Run<ListOps, false>(options);
+  } else {
+    std::fprintf(stderr, "unknown container %s\n", options.container.c_str());
+    return 2;
+  }
+  return 0;
+}
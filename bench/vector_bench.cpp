@@ -0,0 +1,75 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "../array.hpp"
+#include "../vector.hpp"
+
+
+// Forking a historic snapshot: a branching update of a Vector against
+// copying the same version of an Array into a plain vector to modify it.
+static void BM_VectorBranch(benchmark::State& state)
+{
+  const std::size_t size = state.range(0);
+  pdc::Vector<int> vector(size, 0);
+  vector = vector.Update(size / 2, 1).Update(size / 3, 2);
+  const auto snapshot = vector.Undo();
+  std::size_t idx = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(snapshot.Update(idx, 3));
+    idx = (idx + 7919) % size;
+  }
+  state.SetComplexityN(size);
+}
+BENCHMARK(BM_VectorBranch)->RangeMultiplier(8)->Range(64, 1 << 18)->Complexity();
+
+static void BM_ArrayFullCopy(benchmark::State& state)
+{
+  const std::size_t size = state.range(0);
+  pdc::Array<int> array(size, 0);
+  array = array.Update(size / 2, 1).Update(size / 3, 2);
+  const auto snapshot = array.Undo();
+  std::size_t idx = 0;
+  for (auto _ : state) {
+    std::vector<int> copy(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      copy[i] = snapshot[i];
+    }
+    copy[idx] = 3;
+    benchmark::DoNotOptimize(copy.data());
+    idx = (idx + 7919) % size;
+  }
+  state.SetComplexityN(size);
+}
+BENCHMARK(BM_ArrayFullCopy)->RangeMultiplier(8)->Range(64, 1 << 18)->Complexity();
+
+static void BM_VectorPushBack(benchmark::State& state)
+{
+  const std::size_t size = state.range(0);
+  for (auto _ : state) {
+    pdc::Vector<int> vector;
+    for (std::size_t i = 0; i < size; ++i) {
+      vector = vector.PushBack(i);
+    }
+    benchmark::DoNotOptimize(vector.Size());
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_VectorPushBack)->RangeMultiplier(8)->Range(64, 1 << 18);
+
+static void BM_VectorConcat(benchmark::State& state)
+{
+  const std::size_t size = state.range(0);
+  pdc::Vector<int> vector;
+  for (std::size_t i = 0; i < size; ++i) {
+    vector = vector.PushBack(i);
+  }
+  const auto left = vector.Slice(0, size / 2 + 3);
+  const auto right = vector.Slice(size / 2 + 3, size);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(left.Concat(right));
+  }
+  state.SetComplexityN(size);
+}
+BENCHMARK(BM_VectorConcat)->RangeMultiplier(8)->Range(64, 1 << 18)->Complexity();
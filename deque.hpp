@@ -0,0 +1,703 @@
+#pragma once
+
+#include "persistent_structure.hpp"
+#include "segmented_vector.hpp"
+#include "timeline.hpp"
+#include "exception.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace pdc {
+
+using namespace internal;
+
+/*! \brief Partially persistent double-ended queue.
+ *
+ * The Deque is a 2-3 finger tree annotated with sizes. Every level keeps up
+ * to four items at each end, an item of level k is a node of 2 or 3 items of
+ * level k - 1 and the elements are the items of level 0. A modification
+ * copies the ends it changes and shares everything else with the previous
+ * version. Only the latest version can be modified, so the versions form one
+ * sequence and the amortized bounds hold without lazy evaluation. Reading
+ * any version takes no locks, only modifications of the latest version are
+ * serialized.
+ *
+ * Complexity: PushFront(), PushBack(), PopFront() and PopBack() take O(1)
+ * amortized, Front() and Back() take O(1). At() takes O(log n).
+ *
+ * \tparam Allocator Allocator used for the nodes and the shared state of all
+ *                   versions, may be a std::pmr::polymorphic_allocator.
+ */
+template <typename T, typename Allocator = std::allocator<T>>
+class Deque : public Persisent<Deque<T, Allocator>> {
+  template <typename U>
+  using Rebind = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+  /* A node of level 0 is a Leaf holding an element, a node of a higher level
+   * is a Branch; the level of a node is known from where it is found. */
+  struct Node {
+    explicit Node(std::size_t s) : size(s) { }
+    std::size_t size;
+  };
+  using NodePtr = std::shared_ptr<const Node>;
+  struct Leaf : Node {
+    template <typename... Args>
+    explicit Leaf(Args&&... args) : Node(1), value(std::forward<Args>(args)...) { }
+    T value;
+  };
+  struct Branch : Node {
+    Branch(std::size_t s, std::uint8_t n) : Node(s), count(n) { }
+    std::uint8_t count;
+    NodePtr children[3];
+  };
+  struct Digit {
+    std::uint8_t count = 0;
+    NodePtr items[4];
+  };
+  struct Tree;
+  using TreePtr = std::shared_ptr<const Tree>;
+  /* A tree with an empty back holds the single item of its front. */
+  struct Tree {
+    std::size_t size;
+    Digit front;
+    TreePtr middle;
+    Digit back;
+  };
+  using Versions = SegmentedVector<TreePtr, Rebind<TreePtr>>;
+  using Times = Timeline<Rebind<std::int64_t>>;
+  struct State {
+    explicit State(const Allocator& alloc) : versions(alloc), times(alloc) { }
+    Versions versions;
+    Times times;
+    std::mutex mutex;
+  };
+  mutable std::shared_ptr<State> state_;
+  std::size_t version_ = 0;
+  TreePtr root_;
+public:
+  /*! \brief Clock of the creation times of versions. */
+  using Clock = std::chrono::system_clock;
+
+  /*! \brief Iterator over the elements from the front to the back.
+   *
+   * The iterator reads only its version and takes no locks.
+   */
+  class Iterator {
+    friend class Deque<T, Allocator>;
+    struct Level {
+      const Digit* digit;
+      std::size_t depth;
+    };
+    struct Frame {
+      const Branch* branch;
+      std::size_t child;
+      std::size_t depth;
+    };
+    std::vector<Level> digits_;
+    std::vector<Frame> path_;
+    std::size_t digit_ = 0;
+    std::size_t item_ = 0;
+    const Leaf* leaf_ = nullptr;
+    Iterator() = default;
+    explicit Iterator(const Tree* root);
+    void Dive(const Node* node, std::size_t depth);
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = const T&;
+    Iterator& operator++();
+    const T& operator*() const { return leaf_->value; }
+    const T* operator->() const { return &leaf_->value; }
+    bool operator==(const Iterator& rhs) const { return leaf_ == rhs.leaf_; }
+    bool operator!=(const Iterator& rhs) const { return !(*this == rhs); }
+  };
+
+  /*! \brief Default constructor. Create empty Deque.
+   *
+   * \param alloc Allocator to use for all versions of the Deque.
+   */
+  explicit Deque(const Allocator& alloc = Allocator());
+
+  /*! \brief Allocator of the Deque.
+   *
+   * \return Copy of the allocator used by all versions of the Deque.
+   */
+  Allocator GetAllocator() const { return Allocator(state_->versions.GetAllocator()); }
+
+  /*! \brief Count of elements.
+   *
+   * \return Deque size.
+   */
+  std::size_t Size() const { return root_ ? root_->size : 0; }
+
+  /*! \brief Deque empty?
+   *
+   * \return true if the Deque is empty, otherwise false.
+   */
+  bool IsEmpty() const { return Size() == 0; }
+
+  /*! \brief Access the element for reading without bounds check.
+   *
+   * \param idx Position of the element, less than Size().
+   * \return Value of the element.
+   */
+  const T& operator[](std::size_t idx) const;
+
+  /*! \brief Access the element for reading.
+   *
+   * \param idx Position of the element.
+   * \return Value of the element.
+   * \exception std::out_of_range If idx is not less than Size().
+   */
+  const T& At(std::size_t idx) const;
+
+  /*! \brief First element.
+   *
+   * \return Value of the first element.
+   * \exception std::out_of_range If the Deque is empty.
+   */
+  const T& Front() const;
+
+  /*! \brief Last element.
+   *
+   * \return Value of the last element.
+   * \exception std::out_of_range If the Deque is empty.
+   */
+  const T& Back() const;
+
+  /*! \brief Adds an element before the first one.
+   *
+   * \param value The value of the element.
+   * \return New version of the Deque with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Deque.
+   */
+  Deque<T, Allocator> PushFront(T value) const { return EmplaceFront(std::move(value)); }
+
+  /*! \brief Adds an element after the last one.
+   *
+   * \param value The value of the element.
+   * \return New version of the Deque with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Deque.
+   */
+  Deque<T, Allocator> PushBack(T value) const { return EmplaceBack(std::move(value)); }
+
+  /*! \brief Adds an element constructed in place before the first one.
+   *
+   * \param args Arguments of the constructor of the element.
+   * \return New version of the Deque with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Deque.
+   */
+  template <typename... Args>
+  Deque<T, Allocator> EmplaceFront(Args&&... args) const;
+
+  /*! \brief Adds an element constructed in place after the last one.
+   *
+   * \param args Arguments of the constructor of the element.
+   * \return New version of the Deque with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Deque.
+   */
+  template <typename... Args>
+  Deque<T, Allocator> EmplaceBack(Args&&... args) const;
+
+  /*! \brief Removes the first element.
+   *
+   * \return New version of the Deque with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Deque.
+   * \exception std::out_of_range If the Deque is empty.
+   */
+  Deque<T, Allocator> PopFront() const;
+
+  /*! \brief Removes the last element.
+   *
+   * \return New version of the Deque with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Deque.
+   * \exception std::out_of_range If the Deque is empty.
+   */
+  Deque<T, Allocator> PopBack() const;
+
+  /*! \brief STL-based begin().
+   *
+   * \return Iterator pointing to the first element.
+   */
+  Iterator begin() const { return Iterator(root_.get()); }
+
+  /*! \brief STL-based end().
+   *
+   * \return Iterator pointing past the last element.
+   */
+  Iterator end() const { return Iterator(); }
+
+  /*! \brief Returns the previous version of the Deque.
+   *
+   * Returns the same version of the Deque if the version is minimal.
+   * \return Previous version of the Deque.
+   */
+  Deque<T, Allocator> Undo() const override
+    { return Deque<T, Allocator>(*this, version_ > 0 ? version_ - 1 : version_); }
+
+  /*! \brief Returns the next version of the Deque.
+   *
+   * Returns the same version of the Deque if the version is maximum.
+   * \return Next version of the Deque.
+   */
+  Deque<T, Allocator> Redo() const override
+    { return Deque<T, Allocator>(*this, version_ < MaxVersion() ? version_ + 1 : version_); }
+
+  /*! \brief Returns the version of the Deque with the given number.
+   *
+   * Complexity: O(1).
+   * \param version Number of the version.
+   * \return The version of the Deque.
+   * \exception std::out_of_range If version is not less than VersionCount().
+   */
+  Deque<T, Allocator> AtVersion(std::size_t version) const override;
+
+  /*! \brief Returns the latest version of the Deque.
+   *
+   * \return The latest version of the Deque.
+   */
+  Deque<T, Allocator> Latest() const override { return Deque<T, Allocator>(*this, MaxVersion()); }
+
+  /*! \brief Count of versions of the Deque.
+   *
+   * \return Count of versions.
+   */
+  std::size_t VersionCount() const override { return MaxVersion() + 1; }
+
+  /*! \brief Number of this version.
+   *
+   * \return Number of the version.
+   */
+  std::size_t GetVersion() const override { return version_; }
+
+  /*! \brief Time the version was made.
+   *
+   * Times of versions never decrease even if the clock is set back.
+   * \return Creation time of this version.
+   */
+  Clock::time_point GetTime() const { return state_->times.Get(version_); }
+
+  /*! \brief Returns the version of the Deque as of the given time.
+   *
+   * Complexity: O(log v) for v versions.
+   * \param time Point in time.
+   * \return The latest version made at or before the time.
+   * \exception std::out_of_range If no version was made by the time.
+   */
+  Deque<T, Allocator> AsOf(Clock::time_point time) const;
+
+private:
+  Deque(const Deque<T, Allocator>& other, std::size_t version);
+  std::size_t MaxVersion() const { return state_->versions.Size() - 1; }
+  void CheckVersion() const;
+  Deque<T, Allocator> Commit(TreePtr root) const;
+  static const Leaf* First(const Tree* tree) { return static_cast<const Leaf*>(tree->front.items[0].get()); }
+  static const Leaf* Last(const Tree* tree);
+  NodePtr MakeBranch(const NodePtr* items, std::uint8_t count) const;
+  TreePtr MakeTree(const Digit& front, TreePtr middle, const Digit& back) const;
+  TreePtr PushFront(const TreePtr& tree, NodePtr item) const;
+  TreePtr PushBack(const TreePtr& tree, NodePtr item) const;
+  std::pair<NodePtr, TreePtr> PopFront(const TreePtr& tree) const;
+  std::pair<NodePtr, TreePtr> PopBack(const TreePtr& tree) const;
+};
+
+template <typename T, typename Allocator>
+Deque<T, Allocator>::Deque(const Allocator& alloc)
+  : state_(std::allocate_shared<State>(alloc, alloc))
+{
+  state_->times.Add(Clock::now());
+  state_->versions.EmplaceBack(nullptr);
+}
+
+template <typename T, typename Allocator>
+Deque<T, Allocator>::Deque(const Deque<T, Allocator>& other, std::size_t version)
+  : state_(other.state_)
+  , version_(version)
+  , root_(version == other.version_ ? other.root_ : state_->versions[version])
+{
+}
+
+/* Finds the item holding the element on the spine of middle trees, then
+ * descends the nodes of the item. */
+template <typename T, typename Allocator>
+const T& Deque<T, Allocator>::operator[](std::size_t idx) const
+{
+  const Tree* tree = root_.get();
+  std::size_t depth = 0;
+  const Node* node = nullptr;
+  while (!node) {
+    for (std::uint8_t i = 0; !node && i < tree->front.count; ++i) {
+      const Node* item = tree->front.items[i].get();
+      if (idx < item->size) {
+        node = item;
+      } else {
+        idx -= item->size;
+      }
+    }
+    if (node) {
+      break;
+    }
+    if (tree->middle) {
+      if (idx < tree->middle->size) {
+        tree = tree->middle.get();
+        ++depth;
+        continue;
+      }
+      idx -= tree->middle->size;
+    }
+    for (std::uint8_t i = 0; !node && i < tree->back.count; ++i) {
+      const Node* item = tree->back.items[i].get();
+      if (idx < item->size) {
+        node = item;
+      } else {
+        idx -= item->size;
+      }
+    }
+  }
+  for (; depth > 0; --depth) {
+    const Branch* branch = static_cast<const Branch*>(node);
+    std::uint8_t i = 0;
+    while (idx >= branch->children[i]->size) {
+      idx -= branch->children[i++]->size;
+    }
+    node = branch->children[i].get();
+  }
+  return static_cast<const Leaf*>(node)->value;
+}
+
+template <typename T, typename Allocator>
+const T& Deque<T, Allocator>::At(std::size_t idx) const
+{
+  if (idx >= Size()) {
+    throw std::out_of_range("At");
+  }
+  return (*this)[idx];
+}
+
+template <typename T, typename Allocator>
+const T& Deque<T, Allocator>::Front() const
+{
+  if (IsEmpty()) {
+    throw std::out_of_range("Front");
+  }
+  return First(root_.get())->value;
+}
+
+template <typename T, typename Allocator>
+const T& Deque<T, Allocator>::Back() const
+{
+  if (IsEmpty()) {
+    throw std::out_of_range("Back");
+  }
+  return Last(root_.get())->value;
+}
+
+template <typename T, typename Allocator>
+template <typename... Args>
+Deque<T, Allocator> Deque<T, Allocator>::EmplaceFront(Args&&... args) const
+{
+  NodePtr leaf = std::allocate_shared<Leaf>(GetAllocator(), std::forward<Args>(args)...);
+  std::lock_guard<std::mutex> l(state_->mutex);
+  CheckVersion();
+  return Commit(PushFront(root_, std::move(leaf)));
+}
+
+template <typename T, typename Allocator>
+template <typename... Args>
+Deque<T, Allocator> Deque<T, Allocator>::EmplaceBack(Args&&... args) const
+{
+  NodePtr leaf = std::allocate_shared<Leaf>(GetAllocator(), std::forward<Args>(args)...);
+  std::lock_guard<std::mutex> l(state_->mutex);
+  CheckVersion();
+  return Commit(PushBack(root_, std::move(leaf)));
+}
+
+template <typename T, typename Allocator>
+Deque<T, Allocator> Deque<T, Allocator>::PopFront() const
+{
+  std::lock_guard<std::mutex> l(state_->mutex);
+  CheckVersion();
+  if (IsEmpty()) {
+    throw std::out_of_range("PopFront");
+  }
+  return Commit(PopFront(root_).second);
+}
+
+template <typename T, typename Allocator>
+Deque<T, Allocator> Deque<T, Allocator>::PopBack() const
+{
+  std::lock_guard<std::mutex> l(state_->mutex);
+  CheckVersion();
+  if (IsEmpty()) {
+    throw std::out_of_range("PopBack");
+  }
+  return Commit(PopBack(root_).second);
+}
+
+template <typename T, typename Allocator>
+Deque<T, Allocator> Deque<T, Allocator>::AtVersion(std::size_t version) const
+{
+  if (version > MaxVersion()) {
+    throw std::out_of_range("AtVersion");
+  }
+  return Deque<T, Allocator>(*this, version);
+}
+
+template <typename T, typename Allocator>
+Deque<T, Allocator> Deque<T, Allocator>::AsOf(Clock::time_point time) const
+{
+  const std::size_t next = state_->times.Find(time, 0, MaxVersion());
+  if (next == 0) {
+    throw std::out_of_range("AsOf");
+  }
+  return Deque<T, Allocator>(*this, next - 1);
+}
+
+template <typename T, typename Allocator>
+void Deque<T, Allocator>::CheckVersion() const
+{
+  if (version_ != MaxVersion()) {
+    throw IncorrectVersionException();
+  }
+}
+
+template <typename T, typename Allocator>
+Deque<T, Allocator> Deque<T, Allocator>::Commit(TreePtr root) const
+{
+  const std::size_t version = MaxVersion() + 1;
+  state_->times.Add(Clock::now());
+  try {
+    state_->versions.EmplaceBack(std::move(root));
+  } catch (...) {
+    state_->times.PopBack();
+    throw;
+  }
+  return Deque<T, Allocator>(*this, version);
+}
+
+template <typename T, typename Allocator>
+const typename Deque<T, Allocator>::Leaf* Deque<T, Allocator>::Last(const Tree* tree)
+{
+  const Digit& digit = tree->back.count > 0 ? tree->back : tree->front;
+  return static_cast<const Leaf*>(digit.items[digit.count - 1].get());
+}
+
+template <typename T, typename Allocator>
+typename Deque<T, Allocator>::NodePtr
+Deque<T, Allocator>::MakeBranch(const NodePtr* items, std::uint8_t count) const
+{
+  std::size_t size = 0;
+  for (std::uint8_t i = 0; i < count; ++i) {
+    size += items[i]->size;
+  }
+  auto branch = std::allocate_shared<Branch>(GetAllocator(), size, count);
+  std::copy(items, items + count, branch->children);
+  return branch;
+}
+
+template <typename T, typename Allocator>
+typename Deque<T, Allocator>::TreePtr
+Deque<T, Allocator>::MakeTree(const Digit& front, TreePtr middle, const Digit& back) const
+{
+  std::size_t size = middle ? middle->size : 0;
+  for (std::uint8_t i = 0; i < front.count; ++i) {
+    size += front.items[i]->size;
+  }
+  for (std::uint8_t i = 0; i < back.count; ++i) {
+    size += back.items[i]->size;
+  }
+  return std::allocate_shared<Tree>(GetAllocator(), Tree{size, front, std::move(middle), back});
+}
+
+/* A full front digit keeps the new item and one old item and pushes the
+ * other three as a node into the middle tree. The middle tree of a level is
+ * changed only after the digit of the level filled up again, which gives
+ * the amortized O(1). */
+template <typename T, typename Allocator>
+typename Deque<T, Allocator>::TreePtr
+Deque<T, Allocator>::PushFront(const TreePtr& tree, NodePtr item) const
+{
+  Digit front;
+  front.count = 1;
+  front.items[0] = std::move(item);
+  if (!tree) {
+    return MakeTree(front, nullptr, Digit());
+  }
+  if (tree->back.count == 0) {
+    Digit back;
+    back.count = 1;
+    back.items[0] = tree->front.items[0];
+    return MakeTree(front, nullptr, back);
+  }
+  const Digit& old = tree->front;
+  if (old.count < 4) {
+    std::copy(old.items, old.items + old.count, front.items + 1);
+    front.count += old.count;
+    return MakeTree(front, tree->middle, tree->back);
+  }
+  front.count = 2;
+  front.items[1] = old.items[0];
+  return MakeTree(front, PushFront(tree->middle, MakeBranch(old.items + 1, 3)), tree->back);
+}
+
+template <typename T, typename Allocator>
+typename Deque<T, Allocator>::TreePtr
+Deque<T, Allocator>::PushBack(const TreePtr& tree, NodePtr item) const
+{
+  Digit back;
+  if (!tree) {
+    back.count = 1;
+    back.items[0] = std::move(item);
+    return MakeTree(back, nullptr, Digit());
+  }
+  if (tree->back.count == 0) {
+    back.count = 1;
+    back.items[0] = std::move(item);
+    return MakeTree(tree->front, nullptr, back);
+  }
+  const Digit& old = tree->back;
+  if (old.count < 4) {
+    back = old;
+    back.items[back.count++] = std::move(item);
+    return MakeTree(tree->front, tree->middle, back);
+  }
+  back.count = 2;
+  back.items[0] = old.items[3];
+  back.items[1] = std::move(item);
+  return MakeTree(tree->front, PushBack(tree->middle, MakeBranch(old.items, 3)), back);
+}
+
+/* An emptied front digit takes the items of the first node of the middle
+ * tree, or the first item of the back digit if the middle tree is empty. */
+template <typename T, typename Allocator>
+std::pair<typename Deque<T, Allocator>::NodePtr, typename Deque<T, Allocator>::TreePtr>
+Deque<T, Allocator>::PopFront(const TreePtr& tree) const
+{
+  NodePtr item = tree->front.items[0];
+  if (tree->back.count == 0) {
+    return {std::move(item), nullptr};
+  }
+  Digit front;
+  if (tree->front.count > 1) {
+    front.count = tree->front.count - 1;
+    std::copy(tree->front.items + 1, tree->front.items + tree->front.count, front.items);
+    return {std::move(item), MakeTree(front, tree->middle, tree->back)};
+  }
+  if (tree->middle) {
+    auto popped = PopFront(tree->middle);
+    const Branch* branch = static_cast<const Branch*>(popped.first.get());
+    front.count = branch->count;
+    std::copy(branch->children, branch->children + branch->count, front.items);
+    return {std::move(item), MakeTree(front, std::move(popped.second), tree->back)};
+  }
+  const Digit& old = tree->back;
+  front.count = 1;
+  front.items[0] = old.items[0];
+  Digit back;
+  back.count = old.count - 1;
+  std::copy(old.items + 1, old.items + old.count, back.items);
+  return {std::move(item), MakeTree(front, nullptr, back)};
+}
+
+template <typename T, typename Allocator>
+std::pair<typename Deque<T, Allocator>::NodePtr, typename Deque<T, Allocator>::TreePtr>
+Deque<T, Allocator>::PopBack(const TreePtr& tree) const
+{
+  if (tree->back.count == 0) {
+    return {tree->front.items[0], nullptr};
+  }
+  NodePtr item = tree->back.items[tree->back.count - 1];
+  Digit back;
+  if (tree->back.count > 1) {
+    back.count = tree->back.count - 1;
+    std::copy(tree->back.items, tree->back.items + back.count, back.items);
+    return {std::move(item), MakeTree(tree->front, tree->middle, back)};
+  }
+  if (tree->middle) {
+    auto popped = PopBack(tree->middle);
+    const Branch* branch = static_cast<const Branch*>(popped.first.get());
+    back.count = branch->count;
+    std::copy(branch->children, branch->children + branch->count, back.items);
+    return {std::move(item), MakeTree(tree->front, std::move(popped.second), back)};
+  }
+  const Digit& old = tree->front;
+  back.count = old.count > 1 ? 1 : 0;
+  back.items[0] = old.items[old.count - 1];
+  Digit front;
+  front.count = old.count > 1 ? old.count - 1 : 1;
+  std::copy(old.items, old.items + front.count, front.items);
+  return {std::move(item), MakeTree(front, nullptr, back)};
+}
+
+/* The elements are the items of the front digits from the outermost tree
+ * inwards, then the items of the back digits outwards. */
+template <typename T, typename Allocator>
+Deque<T, Allocator>::Iterator::Iterator(const Tree* root)
+{
+  std::vector<const Tree*> spine;
+  for (const Tree* tree = root; tree; tree = tree->middle.get()) {
+    spine.push_back(tree);
+  }
+  for (std::size_t depth = 0; depth < spine.size(); ++depth) {
+    digits_.push_back(Level{&spine[depth]->front, depth});
+  }
+  for (std::size_t depth = spine.size(); depth-- > 0;) {
+    if (spine[depth]->back.count > 0) {
+      digits_.push_back(Level{&spine[depth]->back, depth});
+    }
+  }
+  if (!digits_.empty()) {
+    Dive(digits_[0].digit->items[0].get(), digits_[0].depth);
+  }
+}
+
+template <typename T, typename Allocator>
+void Deque<T, Allocator>::Iterator::Dive(const Node* node, std::size_t depth)
+{
+  for (; depth > 0; --depth) {
+    const Branch* branch = static_cast<const Branch*>(node);
+    path_.push_back(Frame{branch, 0, depth - 1});
+    node = branch->children[0].get();
+  }
+  leaf_ = static_cast<const Leaf*>(node);
+}
+
+template <typename T, typename Allocator>
+typename Deque<T, Allocator>::Iterator& Deque<T, Allocator>::Iterator::operator++()
+{
+  while (!path_.empty()) {
+    Frame& frame = path_.back();
+    if (++frame.child < frame.branch->count) {
+      Dive(frame.branch->children[frame.child].get(), frame.depth);
+      return *this;
+    }
+    path_.pop_back();
+  }
+  if (++item_ == digits_[digit_].digit->count) {
+    item_ = 0;
+    if (++digit_ == digits_.size()) {
+      leaf_ = nullptr;
+      return *this;
+    }
+  }
+  Dive(digits_[digit_].digit->items[item_].get(), digits_[digit_].depth);
+  return *this;
+}
+
+} // namespace pdc
@@ -19,4 +19,19 @@ public:
   }
 };
 
+/*! Concurrent modifications of the same elements.
+ *
+ * Exception that is dropped when modifications prepared against an older
+ * version can not be rebased onto the latest version because they change
+ * elements which were changed after that version.
+ */
+class ConflictException : public IncorrectVersionException {
+public:
+  ConflictException() = default;
+  ~ConflictException() override = default;
+  const char* what() const noexcept override {
+    return "The modified elements were changed in a newer version.";
+  }
+};
+
 }
\ No newline at end of file
@@ -1,113 +1,393 @@
 #pragma once
 
 #include <cstddef>
-#include <vector>
+#include <cstdint>
 #include <algorithm>
 #include <stdexcept>
-#include <mutex>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 
 namespace internal {
 
-template <typename T>
-struct Node {
-  Node() = default;
-  Node(std::size_t ver, const T& val) : version(ver), value(val) { }
-  std::size_t version = 0;
-  T value;
-  bool is_deleted = false;
-};
-
-template <typename T>
-class FatNodes {  
-  std::vector<Node<T>> nodes_;
-  mutable std::unique_ptr<std::mutex> mutex_;
+/* History of values of an item.
+ *
+ * The first node is stored inline, so an item which was never changed needs
+ * no allocations. Later nodes are kept in a chain of chunks of growing
+ * capacity, newest chunk first. A chunk stores versions and values in separate
+ * arrays: the version of a node is a 32-bit offset from the first version of
+ * the chunk with the deleted flag in the lowest bit. A node whose offset does
+ * not fit starts a new chunk. A deleted node has no value.
+ *
+ * Published nodes are never moved or changed, so readers look them up without
+ * locking: a node is published by a release store of the chunk size, a new
+ * chunk by a release store of the head. Writers must be serialized by the
+ * owner of the item. Rollback() drops the node of a version which failed to
+ * be published; a chunk it empties stays linked, since readers may be
+ * passing it. It takes the next node only if that node is of its first
+ * version, otherwise the node starts a new chunk, so the first node of a
+ * chunk is always of its base version and searches skip empty chunks.
+ *
+ * Chunks are allocated by the allocator rebound to aligned blocks, the
+ * allocator is kept together with the head of the chain, so a stateless
+ * allocator takes no space. */
+template <typename T, typename Allocator = std::allocator<T>>
+class FatNodes {
+  struct Chunk {
+    std::size_t base;
+    std::uint32_t capacity;
+    std::atomic<std::uint32_t> size;
+    Chunk* prev;
+  };
+  static constexpr std::uint32_t kFirstChunk = 2;
+  static constexpr std::uint32_t kMaxChunk = std::uint32_t(1) << 30;
+  static constexpr std::size_t kMaxOffset = (std::size_t(1) << 31) - 1;
+  static constexpr std::size_t kAlign = std::max(alignof(Chunk), alignof(T));
+  static constexpr std::size_t kHeader = (sizeof(Chunk) + kAlign - 1) / kAlign * kAlign;
+  using Block = std::aligned_storage_t<kAlign, kAlign>;
+  using BlockAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Block>;
+  using BlockTraits = std::allocator_traits<BlockAllocator>;
+  struct Head : BlockAllocator {
+    explicit Head(const Allocator& alloc) : BlockAllocator(alloc) { }
+    std::atomic<Chunk*> chunk{nullptr};
+  };
+  std::size_t first_version_;
+  T first_value_;
+  Head head_;
 public:
   FatNodes();
   FatNodes(const T& v);
-  FatNodes(std::size_t version, const T& v);
-  const Node<T>& Get(std::size_t version) const;
-  Node<T>& Get(std::size_t version);
-  void Add(std::size_t version, T value);
+  FatNodes(std::size_t version, T v, const Allocator& alloc = Allocator());
+  template <typename... Args>
+  FatNodes(std::in_place_t, std::size_t version, const Allocator& alloc, Args&&... args);
+  FatNodes(const FatNodes&) = delete;
+  FatNodes& operator=(const FatNodes&) = delete;
+  ~FatNodes();
+  const T& Get(std::size_t version) const;
+  void Add(std::size_t version, T value) { Emplace(version, std::move(value)); }
+  template <typename... Args>
+  void Emplace(std::size_t version, Args&&... args);
   void Remove(std::size_t version);
-  bool HasItem(std::size_t version) const;
+  void Rollback(std::size_t version);
+  T* Unpublished(std::size_t version);
+  bool HasItem(std::size_t version) const { return Find(version) != nullptr; }
+  std::size_t LastVersion() const;
+  void Compact(std::size_t version);
+  template <typename Visitor>
+  void ForEach(std::size_t from, Visitor&& visit) const
+    { Visit(head_.chunk.load(std::memory_order_acquire), from, visit); }
+private:
+  const T* Find(std::size_t version) const;
+  const T* FindOlder(const Chunk* chunk, std::size_t version) const;
+  template <typename Visitor>
+  void Visit(const Chunk* chunk, std::size_t from, Visitor& visit) const;
+  template <typename... Args>
+  void Append(std::size_t version, bool deleted, Args&&... args);
+  Chunk* NewChunk(std::size_t base, std::uint32_t capacity, Chunk* prev);
+  void DeleteChunk(Chunk* chunk);
+  static std::size_t ChunkBlocks(std::uint32_t capacity)
+    { return (kHeader + ValuesOffset(capacity) + capacity * sizeof(T) + kAlign - 1) / kAlign; }
+  static std::size_t ValuesOffset(std::uint32_t capacity)
+    { return (capacity * sizeof(std::uint32_t) + kAlign - 1) / kAlign * kAlign; }
+  static std::uint32_t* Versions(const Chunk* chunk)
+    { return reinterpret_cast<std::uint32_t*>(reinterpret_cast<char*>(const_cast<Chunk*>(chunk)) + kHeader); }
+  static T* Values(const Chunk* chunk)
+    { return reinterpret_cast<T*>(reinterpret_cast<char*>(Versions(chunk)) + ValuesOffset(chunk->capacity)); }
 };
 
-template <typename T>
-FatNodes<T>::FatNodes()
+template <typename T, typename Allocator>
+FatNodes<T, Allocator>::FatNodes()
   : FatNodes(T())
 {
 }
 
-template <typename T>
-FatNodes<T>::FatNodes(const T& v)
+template <typename T, typename Allocator>
+FatNodes<T, Allocator>::FatNodes(const T& v)
   : FatNodes(1, v)
 {
 }
 
-template <typename T>
-FatNodes<T>::FatNodes(std::size_t version, const T& v)
-  : nodes_(1, {version, v})
-  , mutex_(std::make_unique<std::mutex>())
+template <typename T, typename Allocator>
+FatNodes<T, Allocator>::FatNodes(std::size_t version, T v, const Allocator& alloc)
+  : FatNodes(std::in_place, version, alloc, std::move(v))
 {
 }
 
-template <typename T>
-const Node<T>& FatNodes<T>::Get(std::size_t version) const
+template <typename T, typename Allocator>
+template <typename... Args>
+FatNodes<T, Allocator>::FatNodes(
+  std::in_place_t, std::size_t version, const Allocator& alloc, Args&&... args)
+  : first_version_(version)
+  , first_value_(std::forward<Args>(args)...)
+  , head_(alloc)
 {
-  std::lock_guard<std::mutex> lk(*mutex_);
-  auto it = std::find_if(nodes_.rbegin(), nodes_.rend(), 
-    [&version](const Node<T>& node) {
-      if (node.version <= version) {
-        if (node.is_deleted) {
-          throw std::runtime_error("Not found  node");
-        }
-        return true;
-      }
-      return false;
-    });
-  if (it == nodes_.rend()) {
-    throw std::runtime_error("Not found node");
+}
+
+template <typename T, typename Allocator>
+FatNodes<T, Allocator>::~FatNodes()
+{
+  Chunk* chunk = head_.chunk.load(std::memory_order_relaxed);
+  while (chunk) {
+    Chunk* prev = chunk->prev;
+    DeleteChunk(chunk);
+    chunk = prev;
   }
-  return *it;
 }
 
-template <typename T>
-Node<T>& FatNodes<T>::Get(std::size_t version) 
+template <typename T, typename Allocator>
+const T& FatNodes<T, Allocator>::Get(std::size_t version) const
 {
-  std::lock_guard<std::mutex> lk(*mutex_);
-  const auto& item = const_cast<const FatNodes<T>*>(this)->Get(version);
-  return const_cast<Node<T>&>(item);
+  const T* value = Find(version);
+  if (!value) {
+    throw std::runtime_error("Not found node");
+  }
+  return *value;
 }
 
-template <typename T>
-void FatNodes<T>::Add(std::size_t version, T value)
+/* A new node is constructed in place from the arguments. Adding a value in
+ * the version of the latest node replaces its value, so a version made of
+ * several modifications keeps only the last one. */
+template <typename T, typename Allocator>
+template <typename... Args>
+void FatNodes<T, Allocator>::Emplace(std::size_t version, Args&&... args)
 {
-  std::lock_guard<std::mutex> lk(*mutex_);
-  nodes_.emplace_back(version, value);
+  Chunk* head = head_.chunk.load(std::memory_order_relaxed);
+  if (!head) {
+    if (version == first_version_) {
+      first_value_ = T(std::forward<Args>(args)...);
+      return;
+    }
+  } else {
+    const std::uint32_t size = head->size.load(std::memory_order_relaxed);
+    const std::uint32_t word = size > 0 ? Versions(head)[size - 1] : 1;
+    if (!(word & 1) && head->base + (word >> 1) == version) {
+      Values(head)[size - 1] = T(std::forward<Args>(args)...);
+      return;
+    }
+  }
+  Append(version, false, std::forward<Args>(args)...);
 }
 
-template <typename T>
-void FatNodes<T>::Remove(std::size_t version)
+/* Removal appends a deleted node, so the item stays visible in older
+ * versions and published nodes are never modified under the readers. */
+template <typename T, typename Allocator>
+void FatNodes<T, Allocator>::Remove(std::size_t version)
 {
-  std::lock_guard<std::mutex> lk(*mutex_);
   if (HasItem(version)) {
-    Get(version).is_deleted = true;
+    Append(version, true);
+  }
+}
+
+/* Drops the latest node if it belongs to the version, which must not be
+ * published. The inline first node is never dropped, an item created in the
+ * version is dropped as a whole by its owner. */
+template <typename T, typename Allocator>
+void FatNodes<T, Allocator>::Rollback(std::size_t version)
+{
+  Chunk* head = head_.chunk.load(std::memory_order_relaxed);
+  const std::uint32_t size = head ? head->size.load(std::memory_order_relaxed) : 0;
+  if (size == 0 || head->base + (Versions(head)[size - 1] >> 1) != version) {
+    return;
+  }
+  if (!(Versions(head)[size - 1] & 1)) {
+    Values(head)[size - 1].~T();
+  }
+  head->size.store(size - 1, std::memory_order_release);
+}
+
+/* Value of the latest node if it belongs to the version, which must not be
+ * published, so the writer can take the value back before Rollback().
+ * Returns nullptr if the item has no node of the version or it is deleted. */
+template <typename T, typename Allocator>
+T* FatNodes<T, Allocator>::Unpublished(std::size_t version)
+{
+  Chunk* head = head_.chunk.load(std::memory_order_relaxed);
+  if (!head) {
+    return version == first_version_ ? &first_value_ : nullptr;
+  }
+  const std::uint32_t size = head->size.load(std::memory_order_relaxed);
+  if (size == 0 || head->base + (Versions(head)[size - 1] >> 1) != version ||
+      (Versions(head)[size - 1] & 1)) {
+    return nullptr;
+  }
+  return Values(head) + (size - 1);
+}
+
+/* Frees the chunks which hold only nodes hidden in the version and all newer
+ * versions. Readers of these versions stop at the chunk of the node visible
+ * in the version and never follow its link to the older chunks, so they are
+ * not disturbed. Older versions must not be read any more. An empty head
+ * chunk holds no visible node, so it never stops the walk. */
+template <typename T, typename Allocator>
+void FatNodes<T, Allocator>::Compact(std::size_t version)
+{
+  Chunk* chunk = head_.chunk.load(std::memory_order_relaxed);
+  while (chunk && (chunk->base > version || chunk->size.load(std::memory_order_relaxed) == 0)) {
+    chunk = chunk->prev;
+  }
+  if (!chunk) {
+    return;
+  }
+  Chunk* prev = chunk->prev;
+  chunk->prev = nullptr;
+  while (prev) {
+    Chunk* next = prev->prev;
+    DeleteChunk(prev);
+    prev = next;
+  }
+}
+
+template <typename T, typename Allocator>
+std::size_t FatNodes<T, Allocator>::LastVersion() const
+{
+  const Chunk* head = head_.chunk.load(std::memory_order_acquire);
+  std::uint32_t size = head ? head->size.load(std::memory_order_acquire) : 0;
+  while (head && size == 0) {
+    head = head->prev;
+    size = head ? head->size.load(std::memory_order_acquire) : 0;
+  }
+  if (!head) {
+    return first_version_;
+  }
+  return head->base + (Versions(head)[size - 1] >> 1);
+}
+
+/* Nodes are appended in increasing order of versions, so the node visible in
+ * the version is the last one not newer than it. Returns nullptr if the item
+ * did not exist yet or was deleted. Reads of the latest node, the common case
+ * of scans, take no search and are small enough to be inlined. */
+template <typename T, typename Allocator>
+const T* FatNodes<T, Allocator>::Find(std::size_t version) const
+{
+  const Chunk* chunk = head_.chunk.load(std::memory_order_acquire);
+  if (!chunk) {
+    return version >= first_version_ ? &first_value_ : nullptr;
   }
+  if (chunk->base <= version) {
+    const std::uint32_t size = chunk->size.load(std::memory_order_acquire);
+    if (size == 0) {
+      return FindOlder(chunk->prev, version);
+    }
+    const std::uint32_t last = Versions(chunk)[size - 1];
+    if ((last >> 1) <= version - chunk->base) {
+      return (last & 1) ? nullptr : Values(chunk) + (size - 1);
+    }
+  }
+  return FindOlder(chunk, version);
 }
 
-template <typename T>
-bool FatNodes<T>::HasItem(std::size_t version) const
+template <typename T, typename Allocator>
+const T* FatNodes<T, Allocator>::FindOlder(const Chunk* chunk, std::size_t version) const
 {
-  std::lock_guard<std::mutex> lk(*mutex_);
-  auto it = std::find_if(nodes_.rbegin(), nodes_.rend(), 
-    [&version](const Node<T>& node) {
-      if (node.version <= version) {
-        return !node.is_deleted;
+  while (chunk && (chunk->base > version || chunk->size.load(std::memory_order_acquire) == 0)) {
+    chunk = chunk->prev;
+  }
+  if (!chunk) {
+    return version >= first_version_ ? &first_value_ : nullptr;
+  }
+  const std::size_t offset = std::min(version - chunk->base, kMaxOffset);
+  const std::uint32_t* begin = Versions(chunk);
+  const std::uint32_t* end = begin + chunk->size.load(std::memory_order_acquire);
+  const std::uint32_t* it = std::upper_bound(begin, end, offset,
+    [](std::size_t off, std::uint32_t word) { return off < (word >> 1); }) - 1;
+  return (*it & 1) ? nullptr : Values(chunk) + (it - begin);
+}
+
+/* Visits the nodes from the one visible in the version to the latest, oldest
+ * first, as visit(version, value) with nullptr value for deleted nodes. The
+ * chain is followed back to the chunk of the node visible in the version, so
+ * the recursion is as deep as the count of newer chunks. A head chunk emptied
+ * by Rollback() holds no node to search, the visible one is in an older
+ * chunk. */
+template <typename T, typename Allocator>
+template <typename Visitor>
+void FatNodes<T, Allocator>::Visit(const Chunk* chunk, std::size_t from, Visitor& visit) const
+{
+  if (!chunk) {
+    visit(first_version_, &first_value_);
+    return;
+  }
+  const std::uint32_t* versions = Versions(chunk);
+  const std::uint32_t size = chunk->size.load(std::memory_order_acquire);
+  if (size == 0) {
+    Visit(chunk->prev, from, visit);
+    return;
+  }
+  std::uint32_t begin = 0;
+  if (chunk->base > from) {
+    Visit(chunk->prev, from, visit);
+  } else {
+    const std::size_t offset = std::min(from - chunk->base, kMaxOffset);
+    begin = std::upper_bound(versions, versions + size, offset,
+      [](std::size_t off, std::uint32_t word) { return off < (word >> 1); }) - versions - 1;
+  }
+  for (std::uint32_t i = begin; i < size; ++i) {
+    visit(chunk->base + (versions[i] >> 1), (versions[i] & 1) ? nullptr : Values(chunk) + i);
+  }
+}
+
+template <typename T, typename Allocator>
+template <typename... Args>
+void FatNodes<T, Allocator>::Append(std::size_t version, bool deleted, Args&&... args)
+{
+  Chunk* head = head_.chunk.load(std::memory_order_relaxed);
+  if (head) {
+    const std::uint32_t size = head->size.load(std::memory_order_relaxed);
+    if (size < head->capacity && version - head->base <= kMaxOffset &&
+        (size > 0 || version == head->base)) {
+      if (!deleted) {
+        new (Values(head) + size) T(std::forward<Args>(args)...);
       }
-      return false;
-    });
-  return it != nodes_.rend();
+      Versions(head)[size] = static_cast<std::uint32_t>((version - head->base) << 1 | deleted);
+      head->size.store(size + 1, std::memory_order_release);
+      return;
+    }
+  }
+  const std::uint32_t capacity = head ? std::min(2 * head->capacity, kMaxChunk) : kFirstChunk;
+  Chunk* chunk = NewChunk(version, capacity, head);
+  if (!deleted) {
+    try {
+      new (Values(chunk)) T(std::forward<Args>(args)...);
+    } catch (...) {
+      DeleteChunk(chunk);
+      throw;
+    }
+  }
+  Versions(chunk)[0] = deleted;
+  chunk->size.store(1, std::memory_order_relaxed);
+  head_.chunk.store(chunk, std::memory_order_release);
+}
+
+template <typename T, typename Allocator>
+typename FatNodes<T, Allocator>::Chunk* FatNodes<T, Allocator>::NewChunk(
+  std::size_t base, std::uint32_t capacity, Chunk* prev)
+{
+  void* memory = BlockTraits::allocate(head_, ChunkBlocks(capacity));
+  Chunk* chunk = new (memory) Chunk;
+  chunk->base = base;
+  chunk->capacity = capacity;
+  chunk->size.store(0, std::memory_order_relaxed);
+  chunk->prev = prev;
+  return chunk;
 }
 
-}
\ No newline at end of file
+template <typename T, typename Allocator>
+void FatNodes<T, Allocator>::DeleteChunk(Chunk* chunk)
+{
+  const std::uint32_t size = chunk->size.load(std::memory_order_relaxed);
+  const std::uint32_t* versions = Versions(chunk);
+  T* values = Values(chunk);
+  for (std::uint32_t i = 0; i < size; ++i) {
+    if (!(versions[i] & 1)) {
+      values[i].~T();
+    }
+  }
+  const std::uint32_t capacity = chunk->capacity;
+  chunk->~Chunk();
+  BlockTraits::deallocate(head_, reinterpret_cast<Block*>(chunk), ChunkBlocks(capacity));
+}
+
+}
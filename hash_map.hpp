@@ -0,0 +1,784 @@
+#pragma once
+
+#include "persistent_structure.hpp"
+#include "segmented_vector.hpp"
+#include "timeline.hpp"
+#include "exception.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <bitset>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+namespace internal {
+
+/* Count of set bits, a single instruction when the target has one (e.g.
+ * -mpopcnt or -march=native on x86). */
+inline unsigned PopCount(std::uint32_t bits)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcount(bits);
+#else
+  return static_cast<unsigned>(std::bitset<32>(bits).count());
+#endif
+}
+
+}
+
+
+namespace pdc {
+
+using namespace internal;
+
+/*! \brief Partially persistent hash map.
+ *
+ * The HashMap is a hash array mapped trie: every level of the trie takes 5
+ * bits of the hash, a node keeps only its occupied slots, found by the count
+ * of set bits of its bitmap below the slot. Entries and children of a node
+ * are kept in separate arrays (the CHAMP layout), so lookups compare keys
+ * only in the slot of the hash. A modification copies the path to the
+ * changed entry and shares the rest with the previous version. Reading any
+ * version takes no locks, only modifications of the latest version are
+ * serialized.
+ *
+ * Complexity: Find() takes O(1) expected, at most 13 levels for a 64-bit
+ * hash. Insert() and Remove() copy O(1) expected nodes.
+ *
+ * Bulk loads go through Transient(): the Builder changes the nodes it made
+ * in place and publishes them as one version.
+ *
+ * \tparam Hash Hash function of keys.
+ * \tparam KeyEqual Equality of keys.
+ * \tparam Allocator Allocator used for the nodes and the shared state of all
+ *                   versions, may be a std::pmr::polymorphic_allocator.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>,
+          typename Allocator = std::allocator<std::pair<const K, V>>>
+class HashMap : public Persisent<HashMap<K, V, Hash, KeyEqual, Allocator>> {
+  template <typename U>
+  using Rebind = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+  static constexpr unsigned kBits = 5;
+  static constexpr unsigned kHashBits = std::numeric_limits<std::size_t>::digits;
+  struct Entry {
+    std::size_t hash;
+    K key;
+    V value;
+  };
+  struct Node;
+  using NodePtr = std::shared_ptr<Node>;
+  /* Entries and children are ordered by slot, the index of a slot is the
+   * count of lower bits set in the bitmap. A node below the last level of
+   * the hash holds colliding entries without bitmaps. Nodes are changed in
+   * place only by the Builder which made them, published nodes are never
+   * changed. */
+  struct Node {
+    Node(std::uint64_t own, const Allocator& alloc) : owner(own), entries(alloc), children(alloc) { }
+    std::uint64_t owner;
+    std::uint32_t datamap = 0;
+    std::uint32_t nodemap = 0;
+    std::vector<Entry, Rebind<Entry>> entries;
+    std::vector<NodePtr, Rebind<NodePtr>> children;
+  };
+  struct Version {
+    NodePtr root;
+    std::size_t size;
+  };
+  using Versions = SegmentedVector<Version, Rebind<Version>>;
+  using Times = Timeline<Rebind<std::int64_t>>;
+  struct State {
+    State(const Hash& h, const KeyEqual& eq, const Allocator& alloc)
+      : hash(h), equal(eq), versions(alloc), times(alloc) { }
+    Hash hash;
+    KeyEqual equal;
+    Versions versions;
+    Times times;
+    std::mutex mutex;
+    std::uint64_t owners = 0;
+  };
+  mutable std::shared_ptr<State> state_;
+  std::size_t version_ = 0;
+  NodePtr root_;
+  std::size_t size_ = 0;
+public:
+  class Builder;
+  /*! \brief Clock of the creation times of versions. */
+  using Clock = std::chrono::system_clock;
+
+  /*! \brief Iterator over the elements in the order of the trie.
+   *
+   * The order is the same for equal versions, it is not related to the
+   * order of keys. The iterator reads only its version and takes no locks.
+   */
+  class Iterator {
+    friend class HashMap<K, V, Hash, KeyEqual, Allocator>;
+    struct Frame {
+      const Node* node;
+      std::size_t entry;
+      std::size_t child;
+    };
+    std::vector<Frame> path_;
+    Iterator() = default;
+    explicit Iterator(const Node* root) { if (root) { path_.push_back(Frame{root, 0, 0}); Settle(); } }
+    void Settle();
+    const Entry& Current() const { return path_.back().node->entries[path_.back().entry]; }
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::pair<const K&, const V&>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = value_type;
+    Iterator& operator++() { ++path_.back().entry; Settle(); return *this; }
+    value_type operator*() const { return value_type(Key(), Value()); }
+    const K& Key() const { return Current().key; }
+    const V& Value() const { return Current().value; }
+    bool operator==(const Iterator& rhs) const;
+    bool operator!=(const Iterator& rhs) const { return !(*this == rhs); }
+  };
+
+  /*! \brief Default constructor. Create empty HashMap. */
+  HashMap();
+
+  /*! \brief Create empty HashMap with the hash, the equality and the
+   * allocator.
+   *
+   * \param hash Hash function of keys.
+   * \param equal Equality of keys.
+   * \param alloc Allocator to use for all versions of the HashMap.
+   */
+  explicit HashMap(const Hash& hash, const KeyEqual& equal = KeyEqual(),
+                   const Allocator& alloc = Allocator());
+
+  /*! \brief Allocator of the HashMap.
+   *
+   * \return Copy of the allocator used by all versions of the HashMap.
+   */
+  Allocator GetAllocator() const { return Allocator(state_->versions.GetAllocator()); }
+
+  /*! \brief Count of elements.
+   *
+   * \return HashMap size.
+   */
+  std::size_t Size() const { return size_; }
+
+  /*! \brief HashMap empty?
+   *
+   * \return true if the HashMap is empty, otherwise false.
+   */
+  bool IsEmpty() const { return Size() == 0; }
+
+  /*! \brief Looks up the value of the key.
+   *
+   * \param key The key to find.
+   * \return Pointer to the value, nullptr if the key is not in the HashMap.
+   */
+  const V* Find(const K& key) const { return Find(root_.get(), key); }
+
+  /*! \brief Access the value of the key for reading.
+   *
+   * \param key The key of the element.
+   * \return Value of the element.
+   * \exception std::out_of_range If the key is not in the HashMap.
+   */
+  const V& At(const K& key) const;
+
+  /*! \brief Key in the HashMap?
+   *
+   * \param key The key to find.
+   * \return true if the HashMap has the key, otherwise false.
+   */
+  bool Contains(const K& key) const { return Find(key) != nullptr; }
+
+  /*! \brief Adds an element or replaces the value of an existing key.
+   *
+   * \param key The key of the element.
+   * \param value The value of the element.
+   * \return New version of the HashMap with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the HashMap.
+   */
+  HashMap<K, V, Hash, KeyEqual, Allocator> Insert(K key, V value) const;
+
+  /*! \brief Adds an element with a value constructed in place or replaces
+   * the value of an existing key.
+   *
+   * \param key The key of the element.
+   * \param args Arguments of the constructor of the value.
+   * \return New version of the HashMap with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the HashMap.
+   */
+  template <typename... Args>
+  HashMap<K, V, Hash, KeyEqual, Allocator> Emplace(K key, Args&&... args) const;
+
+  /*! \brief Removes the element with the key.
+   *
+   * \param key The key of the element.
+   * \return New version of the HashMap with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the HashMap.
+   * \exception std::out_of_range If the key is not in the HashMap.
+   */
+  HashMap<K, V, Hash, KeyEqual, Allocator> Remove(const K& key) const;
+
+  /*! \brief Start a mutable builder of the next version.
+   *
+   * \return Builder holding the elements of this version.
+   */
+  Builder Transient() const { return Builder(*this); }
+
+  /*! \brief STL-based begin().
+   *
+   * \return Iterator pointing to the first element.
+   */
+  Iterator begin() const { return Iterator(root_.get()); }
+
+  /*! \brief STL-based end().
+   *
+   * \return Iterator pointing past the last element.
+   */
+  Iterator end() const { return Iterator(); }
+
+  /*! \brief Returns the previous version of the HashMap.
+   *
+   * Returns the same version of the HashMap if the version is minimal.
+   * \return Previous version of the HashMap.
+   */
+  HashMap<K, V, Hash, KeyEqual, Allocator> Undo() const override
+    { return HashMap<K, V, Hash, KeyEqual, Allocator>(*this, version_ > 0 ? version_ - 1 : version_); }
+
+  /*! \brief Returns the next version of the HashMap.
+   *
+   * Returns the same version of the HashMap if the version is maximum.
+   * \return Next version of the HashMap.
+   */
+  HashMap<K, V, Hash, KeyEqual, Allocator> Redo() const override
+    { return HashMap<K, V, Hash, KeyEqual, Allocator>(*this, version_ < MaxVersion() ? version_ + 1 : version_); }
+
+  /*! \brief Returns the version of the HashMap with the given number.
+   *
+   * Complexity: O(1).
+   * \param version Number of the version.
+   * \return The version of the HashMap.
+   * \exception std::out_of_range If version is not less than VersionCount().
+   */
+  HashMap<K, V, Hash, KeyEqual, Allocator> AtVersion(std::size_t version) const override;
+
+  /*! \brief Returns the latest version of the HashMap.
+   *
+   * \return The latest version of the HashMap.
+   */
+  HashMap<K, V, Hash, KeyEqual, Allocator> Latest() const override
+    { return HashMap<K, V, Hash, KeyEqual, Allocator>(*this, MaxVersion()); }
+
+  /*! \brief Count of versions of the HashMap.
+   *
+   * \return Count of versions.
+   */
+  std::size_t VersionCount() const override { return MaxVersion() + 1; }
+
+  /*! \brief Number of this version.
+   *
+   * \return Number of the version.
+   */
+  std::size_t GetVersion() const override { return version_; }
+
+  /*! \brief Time the version was made.
+   *
+   * Times of versions never decrease even if the clock is set back.
+   * \return Creation time of this version.
+   */
+  Clock::time_point GetTime() const { return state_->times.Get(version_); }
+
+  /*! \brief Returns the version of the HashMap as of the given time.
+   *
+   * Complexity: O(log v) for v versions.
+   * \param time Point in time.
+   * \return The latest version made at or before the time.
+   * \exception std::out_of_range If no version was made by the time.
+   */
+  HashMap<K, V, Hash, KeyEqual, Allocator> AsOf(Clock::time_point time) const;
+
+private:
+  HashMap(const HashMap<K, V, Hash, KeyEqual, Allocator>& other, std::size_t version);
+  std::size_t MaxVersion() const { return state_->versions.Size() - 1; }
+  void CheckVersion() const;
+  HashMap<K, V, Hash, KeyEqual, Allocator> Commit(NodePtr root, std::size_t size) const;
+  static std::uint32_t Bit(std::size_t hash, unsigned shift)
+    { return std::uint32_t(1) << ((hash >> shift) & ((1u << kBits) - 1)); }
+  static std::size_t Index(std::uint32_t bitmap, std::uint32_t bit)
+    { return PopCount(bitmap & (bit - 1)); }
+  const V* Find(const Node* node, const K& key) const;
+  NodePtr Editable(const NodePtr& node, std::uint64_t owner) const;
+  template <typename... Args>
+  NodePtr Insert(const NodePtr& node, unsigned shift, std::size_t hash, K& key,
+                 std::uint64_t owner, bool& added, Args&&... args) const;
+  NodePtr Merge(unsigned shift, Entry first, Entry second, std::uint64_t owner) const;
+  NodePtr Remove(const NodePtr& node, unsigned shift, std::size_t hash, const K& key,
+                 std::uint64_t owner, bool& removed) const;
+};
+
+/*! \brief Mutable builder of a version of the HashMap.
+ *
+ * Returned by HashMap::Transient(). Modifications change the nodes made by
+ * the builder in place, take no locks and make no versions; Persistent()
+ * publishes the result as one new version. A builder must be used by one
+ * thread at a time. It can be moved but not copied, since a copy would edit
+ * the nodes owned by the original in place.
+ */
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+class HashMap<K, V, Hash, KeyEqual, Allocator>::Builder {
+  friend class HashMap<K, V, Hash, KeyEqual, Allocator>;
+  HashMap<K, V, Hash, KeyEqual, Allocator> map_;
+  NodePtr root_;
+  std::size_t size_;
+  std::uint64_t owner_;
+  explicit Builder(const HashMap<K, V, Hash, KeyEqual, Allocator>& map)
+    : map_(map), root_(map.root_), size_(map.size_), owner_(NextOwner()) { }
+  std::uint64_t NextOwner() const;
+public:
+  Builder(const Builder&) = delete;
+  Builder(Builder&&) = default;
+  Builder& operator=(const Builder&) = delete;
+  Builder& operator=(Builder&&) = default;
+
+  /*! \brief Count of elements.
+   *
+   * \return Count of elements in the builder.
+   */
+  std::size_t Size() const { return size_; }
+
+  /*! \brief Builder empty?
+   *
+   * \return true if the builder has no elements, otherwise false.
+   */
+  bool IsEmpty() const { return Size() == 0; }
+
+  /*! \brief Looks up the value of the key.
+   *
+   * \param key The key to find.
+   * \return Pointer to the value, nullptr if the key is not in the builder.
+   */
+  const V* Find(const K& key) const { return map_.Find(root_.get(), key); }
+
+  /*! \brief Adds an element or replaces the value of an existing key.
+   *
+   * \param key The key of the element.
+   * \param value The value of the element.
+   * \return Reference to this builder.
+   */
+  Builder& Insert(K key, V value) { return Emplace(std::move(key), std::move(value)); }
+
+  /*! \brief Adds an element with a value constructed in place or replaces
+   * the value of an existing key.
+   *
+   * \param key The key of the element.
+   * \param args Arguments of the constructor of the value.
+   * \return Reference to this builder.
+   */
+  template <typename... Args>
+  Builder& Emplace(K key, Args&&... args);
+
+  /*! \brief Removes the element with the key.
+   *
+   * \param key The key of the element.
+   * \return Reference to this builder.
+   * \exception std::out_of_range If the key is not in the builder.
+   */
+  Builder& Remove(const K& key);
+
+  /*! \brief Publishes the elements as a new version of the HashMap.
+   *
+   * The builder stays usable and continues from the published version, its
+   * later modifications do not change the published version.
+   * \return New version of the HashMap.
+   * \exception IncorrectVersionException If the HashMap was modified after
+   *            the builder was made.
+   */
+  HashMap<K, V, Hash, KeyEqual, Allocator> Persistent();
+};
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>::HashMap()
+  : HashMap(Hash())
+{
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>::HashMap(
+  const Hash& hash, const KeyEqual& equal, const Allocator& alloc)
+  : state_(std::allocate_shared<State>(alloc, hash, equal, alloc))
+{
+  state_->times.Add(Clock::now());
+  state_->versions.EmplaceBack(Version{nullptr, 0});
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>::HashMap(
+  const HashMap<K, V, Hash, KeyEqual, Allocator>& other, std::size_t version)
+  : state_(other.state_)
+  , version_(version)
+  , root_(version == other.version_ ? other.root_ : state_->versions[version].root)
+  , size_(state_->versions[version].size)
+{
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+const V& HashMap<K, V, Hash, KeyEqual, Allocator>::At(const K& key) const
+{
+  const V* value = Find(key);
+  if (!value) {
+    throw std::out_of_range("At");
+  }
+  return *value;
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>::Insert(K key, V value) const
+{
+  return Emplace(std::move(key), std::move(value));
+}
+
+/* Persistent modifications use owner 0, which no Builder has, so every node
+ * on the path is copied. */
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+template <typename... Args>
+HashMap<K, V, Hash, KeyEqual, Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>::Emplace(K key, Args&&... args) const
+{
+  const std::size_t hash = state_->hash(key);
+  std::lock_guard<std::mutex> l(state_->mutex);
+  CheckVersion();
+  bool added = false;
+  NodePtr root = Insert(root_, 0, hash, key, 0, added, std::forward<Args>(args)...);
+  return Commit(std::move(root), size_ + added);
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>::Remove(const K& key) const
+{
+  const std::size_t hash = state_->hash(key);
+  std::lock_guard<std::mutex> l(state_->mutex);
+  CheckVersion();
+  bool removed = false;
+  NodePtr root = Remove(root_, 0, hash, key, 0, removed);
+  if (!removed) {
+    throw std::out_of_range("Remove");
+  }
+  return Commit(std::move(root), size_ - 1);
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>::AtVersion(std::size_t version) const
+{
+  if (version > MaxVersion()) {
+    throw std::out_of_range("AtVersion");
+  }
+  return HashMap<K, V, Hash, KeyEqual, Allocator>(*this, version);
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>::AsOf(Clock::time_point time) const
+{
+  const std::size_t next = state_->times.Find(time, 0, MaxVersion());
+  if (next == 0) {
+    throw std::out_of_range("AsOf");
+  }
+  return HashMap<K, V, Hash, KeyEqual, Allocator>(*this, next - 1);
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+void HashMap<K, V, Hash, KeyEqual, Allocator>::CheckVersion() const
+{
+  if (version_ != MaxVersion()) {
+    throw IncorrectVersionException();
+  }
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>::Commit(NodePtr root, std::size_t size) const
+{
+  if (root && root->entries.empty() && root->children.empty()) {
+    root = nullptr;
+  }
+  const std::size_t version = MaxVersion() + 1;
+  state_->times.Add(Clock::now());
+  try {
+    state_->versions.EmplaceBack(Version{std::move(root), size});
+  } catch (...) {
+    state_->times.PopBack();
+    throw;
+  }
+  return HashMap<K, V, Hash, KeyEqual, Allocator>(*this, version);
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+const V* HashMap<K, V, Hash, KeyEqual, Allocator>::Find(const Node* node, const K& key) const
+{
+  const std::size_t hash = state_->hash(key);
+  for (unsigned shift = 0; node; shift += kBits) {
+    if (shift >= kHashBits) {
+      for (const Entry& entry : node->entries) {
+        if (state_->equal(entry.key, key)) {
+          return &entry.value;
+        }
+      }
+      return nullptr;
+    }
+    const std::uint32_t bit = Bit(hash, shift);
+    if (node->datamap & bit) {
+      const Entry& entry = node->entries[Index(node->datamap, bit)];
+      return entry.hash == hash && state_->equal(entry.key, key) ? &entry.value : nullptr;
+    }
+    if (!(node->nodemap & bit)) {
+      return nullptr;
+    }
+    node = node->children[Index(node->nodemap, bit)].get();
+  }
+  return nullptr;
+}
+
+/* Returns the node itself if the owner made it, otherwise a copy of the node
+ * made by the owner. */
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+typename HashMap<K, V, Hash, KeyEqual, Allocator>::NodePtr
+HashMap<K, V, Hash, KeyEqual, Allocator>::Editable(const NodePtr& node, std::uint64_t owner) const
+{
+  if (node && owner != 0 && node->owner == owner) {
+    return node;
+  }
+  NodePtr copy = std::allocate_shared<Node>(GetAllocator(), owner, GetAllocator());
+  if (node) {
+    copy->datamap = node->datamap;
+    copy->nodemap = node->nodemap;
+    copy->entries = node->entries;
+    copy->children = node->children;
+  }
+  return copy;
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+template <typename... Args>
+typename HashMap<K, V, Hash, KeyEqual, Allocator>::NodePtr
+HashMap<K, V, Hash, KeyEqual, Allocator>::Insert(
+  const NodePtr& node, unsigned shift, std::size_t hash, K& key,
+  std::uint64_t owner, bool& added, Args&&... args) const
+{
+  NodePtr result = Editable(node, owner);
+  if (shift >= kHashBits) {
+    for (Entry& entry : result->entries) {
+      if (state_->equal(entry.key, key)) {
+        entry.value = V(std::forward<Args>(args)...);
+        return result;
+      }
+    }
+    result->entries.push_back(Entry{hash, std::move(key), V(std::forward<Args>(args)...)});
+    added = true;
+    return result;
+  }
+  const std::uint32_t bit = Bit(hash, shift);
+  if (result->datamap & bit) {
+    const std::size_t idx = Index(result->datamap, bit);
+    Entry& entry = result->entries[idx];
+    if (entry.hash == hash && state_->equal(entry.key, key)) {
+      entry.value = V(std::forward<Args>(args)...);
+      return result;
+    }
+    NodePtr child = Merge(shift + kBits, std::move(entry),
+                          Entry{hash, std::move(key), V(std::forward<Args>(args)...)}, owner);
+    result->entries.erase(result->entries.begin() + idx);
+    result->datamap ^= bit;
+    result->children.insert(result->children.begin() + Index(result->nodemap, bit), std::move(child));
+    result->nodemap |= bit;
+    added = true;
+    return result;
+  }
+  if (result->nodemap & bit) {
+    NodePtr& child = result->children[Index(result->nodemap, bit)];
+    child = Insert(child, shift + kBits, hash, key, owner, added, std::forward<Args>(args)...);
+    return result;
+  }
+  result->entries.insert(result->entries.begin() + Index(result->datamap, bit),
+                         Entry{hash, std::move(key), V(std::forward<Args>(args)...)});
+  result->datamap |= bit;
+  added = true;
+  return result;
+}
+
+/* Builds the subtree of two entries whose hashes agree up to the shift. */
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+typename HashMap<K, V, Hash, KeyEqual, Allocator>::NodePtr
+HashMap<K, V, Hash, KeyEqual, Allocator>::Merge(
+  unsigned shift, Entry first, Entry second, std::uint64_t owner) const
+{
+  NodePtr node = std::allocate_shared<Node>(GetAllocator(), owner, GetAllocator());
+  if (shift >= kHashBits) {
+    node->entries.push_back(std::move(first));
+    node->entries.push_back(std::move(second));
+    return node;
+  }
+  const std::uint32_t first_bit = Bit(first.hash, shift);
+  const std::uint32_t second_bit = Bit(second.hash, shift);
+  if (first_bit == second_bit) {
+    node->children.push_back(Merge(shift + kBits, std::move(first), std::move(second), owner));
+    node->nodemap = first_bit;
+    return node;
+  }
+  if (second_bit < first_bit) {
+    std::swap(first, second);
+  }
+  node->entries.push_back(std::move(first));
+  node->entries.push_back(std::move(second));
+  node->datamap = first_bit | second_bit;
+  return node;
+}
+
+/* A child left with a single entry and no children is replaced by the
+ * entry, so the trie stays as shallow as its hashes require and removals
+ * undo insertions. */
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+typename HashMap<K, V, Hash, KeyEqual, Allocator>::NodePtr
+HashMap<K, V, Hash, KeyEqual, Allocator>::Remove(
+  const NodePtr& node, unsigned shift, std::size_t hash, const K& key,
+  std::uint64_t owner, bool& removed) const
+{
+  if (!node) {
+    return node;
+  }
+  if (shift >= kHashBits) {
+    for (std::size_t idx = 0; idx < node->entries.size(); ++idx) {
+      if (state_->equal(node->entries[idx].key, key)) {
+        NodePtr result = Editable(node, owner);
+        result->entries.erase(result->entries.begin() + idx);
+        removed = true;
+        return result;
+      }
+    }
+    return node;
+  }
+  const std::uint32_t bit = Bit(hash, shift);
+  if (node->datamap & bit) {
+    const std::size_t idx = Index(node->datamap, bit);
+    const Entry& entry = node->entries[idx];
+    if (entry.hash != hash || !state_->equal(entry.key, key)) {
+      return node;
+    }
+    NodePtr result = Editable(node, owner);
+    result->entries.erase(result->entries.begin() + idx);
+    result->datamap ^= bit;
+    removed = true;
+    return result;
+  }
+  if (!(node->nodemap & bit)) {
+    return node;
+  }
+  const std::size_t idx = Index(node->nodemap, bit);
+  NodePtr child = Remove(node->children[idx], shift + kBits, hash, key, owner, removed);
+  if (!removed) {
+    return node;
+  }
+  NodePtr result = Editable(node, owner);
+  if (child->children.empty() && child->entries.size() <= 1) {
+    result->children.erase(result->children.begin() + idx);
+    result->nodemap ^= bit;
+    if (!child->entries.empty()) {
+      result->entries.insert(result->entries.begin() + Index(result->datamap, bit),
+                             child->entries.front());
+      result->datamap |= bit;
+    }
+  } else {
+    result->children[idx] = std::move(child);
+  }
+  return result;
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+void HashMap<K, V, Hash, KeyEqual, Allocator>::Iterator::Settle()
+{
+  while (!path_.empty()) {
+    Frame& frame = path_.back();
+    if (frame.entry < frame.node->entries.size()) {
+      return;
+    }
+    if (frame.child < frame.node->children.size()) {
+      const Node* child = frame.node->children[frame.child++].get();
+      path_.push_back(Frame{child, 0, 0});
+      continue;
+    }
+    path_.pop_back();
+  }
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+bool HashMap<K, V, Hash, KeyEqual, Allocator>::Iterator::operator==(const Iterator& rhs) const
+{
+  if (path_.empty() || rhs.path_.empty()) {
+    return path_.empty() && rhs.path_.empty();
+  }
+  return path_.back().node == rhs.path_.back().node && path_.back().entry == rhs.path_.back().entry;
+}
+
+/* Owners are numbered under the lock, a number is never reused, so nodes of
+ * published versions never match the owner of a live builder. */
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+std::uint64_t HashMap<K, V, Hash, KeyEqual, Allocator>::Builder::NextOwner() const
+{
+  std::lock_guard<std::mutex> l(map_.state_->mutex);
+  return ++map_.state_->owners;
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+template <typename... Args>
+typename HashMap<K, V, Hash, KeyEqual, Allocator>::Builder&
+HashMap<K, V, Hash, KeyEqual, Allocator>::Builder::Emplace(K key, Args&&... args)
+{
+  const std::size_t hash = map_.state_->hash(key);
+  bool added = false;
+  root_ = map_.Insert(root_, 0, hash, key, owner_, added, std::forward<Args>(args)...);
+  size_ += added;
+  return *this;
+}
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+typename HashMap<K, V, Hash, KeyEqual, Allocator>::Builder&
+HashMap<K, V, Hash, KeyEqual, Allocator>::Builder::Remove(const K& key)
+{
+  bool removed = false;
+  NodePtr root = map_.Remove(root_, 0, map_.state_->hash(key), key, owner_, removed);
+  if (!removed) {
+    throw std::out_of_range("Remove");
+  }
+  root_ = std::move(root);
+  --size_;
+  return *this;
+}
+
+/* The builder takes a new owner number, so the published nodes are copied
+ * before any later change. */
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>
+HashMap<K, V, Hash, KeyEqual, Allocator>::Builder::Persistent()
+{
+  std::lock_guard<std::mutex> l(map_.state_->mutex);
+  map_.CheckVersion();
+  map_ = map_.Commit(root_, size_);
+  root_ = map_.root_;
+  owner_ = ++map_.state_->owners;
+  return map_;
+}
+
+} // namespace pdc
@@ -1,264 +1,1267 @@
 #pragma once
 
 #include "persistent_structure.hpp"
+#include "sliding_vector.hpp"
+#include "serialization.hpp"
+#include "timeline.hpp"
 #include "exception.hpp"
 
-#include <list>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+#include <array>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
 #include <memory>
-#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <mutex>
 #include <atomic>
 
 namespace pdc {
 
-/*! \brief Partially persistent double-linked list. */
-template <typename T>
-class List : public Persisent<List<T>> {
+using namespace internal;
+
+/*! \brief Partially persistent sequence stored as a tree of chunks.
+ *
+ * Each version of the List is an order-statistics AVL tree ordered by position,
+ * a modification copies only the path to the changed position and shares
+ * the rest with the previous version. Nodes of the tree hold contiguous
+ * chunks of up to 32 elements, so a scan visits a new node once per chunk.
+ * Reading any version takes no locks, only modifications of the latest
+ * version are serialized.
+ *
+ * Complexity: Size() takes O(1), At(), Insert() and Remove() take O(log n).
+ *
+ * Values which are not trivially copyable, including move-only ones, are kept
+ * in shared immutable boxes, so copying a chunk never copies them. So are
+ * values without a default constructor, since chunks are arrays of slots.
+ *
+ * \tparam Allocator Allocator used for the nodes and the shared state of all
+ *                   versions, may be a std::pmr::polymorphic_allocator.
+ */
+template <typename T, typename Allocator = std::allocator<T>>
+class List : public Persisent<List<T, Allocator>> {
+public:
+  /*! \brief Modification made by a version of the List. */
+  struct Edit {
+    /*! \brief Kind of the modification. */
+    enum class Kind { Insert, Remove };
+    std::size_t version; /*!< Version made by the modification. */
+    Kind kind;           /*!< Values were inserted or removed. */
+    std::size_t idx;     /*!< Position of the first inserted or removed value. */
+    std::size_t count;   /*!< Count of inserted or removed values. */
+  };
+
+private:
+  template <typename U>
+  using Rebind = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+  static constexpr std::size_t kChunk = 32;
+  static constexpr bool kBoxed = !std::is_trivially_copy_constructible<T>::value ||
+                                 !std::is_default_constructible<T>::value;
+  using Slot = std::conditional_t<kBoxed, std::shared_ptr<const T>, T>;
+  struct Chunk {
+    std::size_t count = 0;
+    std::array<Slot, kChunk> values;
+  };
+  using ChunkPtr = std::shared_ptr<const Chunk>;
+  struct Node;
+  using NodePtr = std::shared_ptr<const Node>;
   struct Node {
-    T value;
-    std::size_t version;
-    bool is_deleted = false;
-    std::unique_ptr<std::mutex> mutex;
-    Node(std::size_t ver, T val) 
-      : value(val), version(ver), mutex(std::make_unique<std::mutex>()) { }
+    ChunkPtr chunk;
+    std::size_t size;
+    int height;
+    NodePtr left;
+    NodePtr right;
+  };
+  struct Compaction {
+    std::atomic<std::size_t> min_version{0};
+    std::size_t next = 0;
+  };
+  /* Every version keeps its tree and the modification which made it, the
+   * modifications form the change log of the List. Compaction releases the
+   * versions below the oldest kept one. */
+  struct Version {
+    NodePtr root;
+    Edit edit;
+  };
+  using Versions = SlidingVector<Version, Rebind<Version>>;
+  using Times = Timeline<Rebind<std::int64_t>>;
+  /* State shared by all versions of the List, kept in a single block so a
+   * version object costs one reference count besides its root. */
+  struct State {
+    explicit State(const Allocator& alloc) : versions(alloc), times(alloc) { }
+    Versions versions;
+    Times times;
+    std::mutex mutex;
+    Compaction compaction;
   };
-  mutable std::shared_ptr<std::list<Node>> list_;
+  mutable std::shared_ptr<State> state_;
   std::size_t version_ = 0;
-  mutable std::shared_ptr<std::atomic<std::size_t>> max_version_;
-  mutable std::shared_ptr<std::mutex> mutex_;
+  NodePtr root_;
 public:
-  /*! \brief Iterator for list bypass. */
+  /*! \brief Iterator for list bypass.
+   *
+   * Moving to a neighbour element takes O(1) amortized time, the iterator
+   * reads only immutable nodes of its version and takes no locks.
+   */
   class Iterator {
-    friend class List<T>;
-    const List<T>* master_;
-    using list_iterator = typename std::list<Node>::iterator;
-    list_iterator it_;
-    Iterator(const list_iterator& it, const List<T>* master) 
-      : master_(master), it_(SkipUnavailable(it, true)) { }
+    friend class List<T, Allocator>;
+    const Node* root_;
+    std::size_t idx_;
+    mutable std::vector<const Node*> path_;
+    mutable std::size_t offset_ = 0;
+    Iterator(const Node* root, std::size_t idx) : root_(root), idx_(idx) { }
   public:
-    Iterator operator++();
-    Iterator operator--();
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = const T&;
+    Iterator& operator++();
+    Iterator& operator--();
     const T& operator*() const;
-    bool operator==(const Iterator& rhs) { return it_ == rhs.it_; }
-    bool operator!=(const Iterator& rhs) { return it_ != rhs.it_; }
-  private:
-    list_iterator SkipUnavailable(const list_iterator& it, bool forward) const;
+    bool operator==(const Iterator& rhs) const
+      { return root_ == rhs.root_ && idx_ == rhs.idx_; }
+    bool operator!=(const Iterator& rhs) const { return !(*this == rhs); }
   };
   friend class Iterator;
-  
+  class ChangeFeed;
+  class Builder;
+  /*! \brief Clock of the creation times of versions. */
+  using Clock = std::chrono::system_clock;
+
   /*! \brief Default constructor. Create empty List. */
   List();
 
-  /*! \brief List empty? 
+  /*! \brief Create empty List with the allocator.
+   *
+   * \param alloc Allocator to use for all versions of the List.
+   */
+  explicit List(const Allocator& alloc);
+
+  /*! \brief Allocator of the List.
+   *
+   * \return Copy of the allocator used by all versions of the List.
+   */
+  Allocator GetAllocator() const { return Allocator(state_->versions.GetAllocator()); }
+
+  /*! \brief List empty?
    *
    * \return true if the List is empty, otherwise false.
    */
-  bool IsEmpty() const { std::lock_guard<std::mutex> l(*mutex_); return begin() == end(); }
+  bool IsEmpty() const { return Size() == 0; }
 
-  /*! \brief Size of List. 
+  /*! \brief Size of List.
    *
-   * Complexity: O(N).
-   * \return List size. 
+   * Complexity: O(1).
+   * \return List size.
    */
-  std::size_t Size() const;
+  std::size_t Size() const { return NodeSize(root_); }
+
+  /*! \brief Access the element by its position.
+   *
+   * Complexity: O(log n).
+   * \param idx The position of the element.
+   * \return Element to reading.
+   * \exception std::out_of_range If idx is not less than Size().
+   */
+  const T& At(std::size_t idx) const;
 
   /*! \brief Add a value at the end of the List.
    *
    * \param value Value to add.
    * \return New version of the List with changed state.
-   * \exception IncorrectVersionException 
+   * \exception IncorrectVersionException
    *            If the method is not called on the latest version of the list.
    */
-  List<T> PushBack(T value) const;
+  List<T, Allocator> PushBack(T value) const;
 
   /*! \brief Add a value at the front of the List.
    *
    * \param value Value to add.
    * \return New version of the List with changed state.
-   * \exception IncorrectVersionException 
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the list.
+   */
+  List<T, Allocator> PushFront(T value) const;
+
+  /*! \brief Add a value constructed in place at the end of the List.
+   *
+   * \param args Arguments of the constructor of the value.
+   * \return New version of the List with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the list.
+   */
+  template <typename... Args>
+  List<T, Allocator> EmplaceBack(Args&&... args) const;
+
+  /*! \brief Add a value constructed in place at the front of the List.
+   *
+   * \param args Arguments of the constructor of the value.
+   * \return New version of the List with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the list.
+   */
+  template <typename... Args>
+  List<T, Allocator> EmplaceFront(Args&&... args) const;
+
+  /*! \brief Add values at the end of the List as one version.
+   *
+   * \param first The beginning of the range of values to add.
+   * \param last The end of the range of values to add.
+   * \return New version of the List with changed state.
+   * \exception IncorrectVersionException
    *            If the method is not called on the latest version of the list.
    */
-  List<T> PushFront(T value) const;
+  template <typename InputIt>
+  List<T, Allocator> Append(InputIt first, InputIt last) const;
 
-  /*! \brief Insert element at the specified location in the List. 
+  /*! \brief Start a mutable builder of the next version.
+   *
+   * \return Builder holding the elements of this version.
+   */
+  Builder Transient() const { return Builder(*this); }
+
+  /*! \brief Insert element at the specified location in the List.
    *
    * \param pos The position before which you want to insert a new value.
    * \param value Value to insert.
    * \return New version of the List with changed state.
-   * \exception IncorrectVersionException 
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the list.
+   */
+  List<T, Allocator> Insert(const Iterator& pos, T value) const;
+
+  /*! \brief Insert a value constructed in place at the specified location.
+   *
+   * \param pos The position before which you want to insert a new value.
+   * \param args Arguments of the constructor of the value.
+   * \return New version of the List with changed state.
+   * \exception IncorrectVersionException
    *            If the method is not called on the latest version of the list.
    */
-  List<T> Insert(const Iterator& pos, T value) const;
+  template <typename... Args>
+  List<T, Allocator> Emplace(const Iterator& pos, Args&&... args) const;
 
-  /*! \brief Remove element at the specified location in the List. 
+  /*! \brief Remove element at the specified location in the List.
    *
    * \param pos Iterator indicating the element to be removed.
    * \return New version of the List with changed state.
-   * \exception IncorrectVersionException 
+   * \exception IncorrectVersionException
    *            If the method is not called on the latest version of the list.
+   * \exception std::out_of_range If pos is the end of the List.
    */
-  List<T> Remove(const Iterator& pos) const;
-  
-  /*! \brief STL-based begin(). 
+  List<T, Allocator> Remove(const Iterator& pos) const;
+
+  /*! \brief Releases versions older than this version.
+   *
+   * Elements which are reachable only from released versions are freed unless
+   * some List object still refers to such a version. The modifications and
+   * times of released versions are freed too, so the memory taken by the
+   * history follows the kept versions. Undo() does not go below this version
+   * and released versions must not be looked up while the call runs.
+   * Compaction is incremental: a call releases at most limit versions under
+   * the lock and the next call continues from where it stopped.
+   * \param limit Maximum count of versions to release.
+   * \return true if all older versions are released, otherwise false.
+   */
+  bool Compact(std::size_t limit = SIZE_MAX) const;
+
+  /*! \brief Modifications made after this version up to the given version.
+   *
+   * Applying the modifications in their order to this version gives the
+   * given version, so the feed replicates the List. Iteration takes O(1) per
+   * version and reads only the change log.
+   * \param to A newer version of the same List, for an older one the feed is
+   *           empty.
+   * \return Range of Edit objects.
+   * \exception std::invalid_argument If to is not a version of this List.
+   * \exception std::out_of_range If this version is released by Compact().
+   */
+  ChangeFeed Feed(const List<T, Allocator>& to) const;
+
+  /*! \brief Writes all versions of the List to the stream.
+   *
+   * Versions released by Compact() are not written. Nodes shared by versions
+   * are written once and shared again after loading. Modifications wait only
+   * while the roots of the versions are collected.
+   * \param out Stream to write to.
+   * \param compression Compression of the written data.
+   * \exception std::runtime_error If writing to the stream fails.
+   * \exception std::invalid_argument If the compression is not supported.
+   */
+  void Save(std::ostream& out, Compression compression = Compression::None) const;
+
+  /*! \brief Writes only this version of the List to the stream.
+   *
+   * The snapshot holds just the elements, it is loaded as an Array or a List
+   * with a single version.
+   * \param out Stream to write to.
+   * \param compression Compression of the written data.
+   * \exception std::runtime_error If writing to the stream fails.
+   * \exception std::invalid_argument If the compression is not supported.
+   */
+  void SaveSnapshot(std::ostream& out, Compression compression = Compression::None) const;
+
+  /*! \brief Reads a List written by Save() or a snapshot.
+   *
+   * \param in Stream to read from.
+   * \param alloc Allocator to use for all versions of the loaded List.
+   * \return The latest version of the loaded List.
+   * \exception std::runtime_error If the stream does not contain a List of
+   *            T or a snapshot of T.
+   */
+  static List<T, Allocator> Load(std::istream& in, const Allocator& alloc = Allocator());
+
+  /*! \brief STL-based begin().
    *
    * Returns the iterator pointing to the begin of the List.
    * \return Iterator pointing to the begin of the List.
    */
-  Iterator begin() const { return Iterator(list_->begin(), this); }
+  Iterator begin() const { return Iterator(root_.get(), 0); }
 
-  /*! \brief STL-based end(). 
+  /*! \brief STL-based end().
    *
    * Returns the iterator pointing to the end of the List.
    * \return Iterator pointing to the end of the List.
    */
-  Iterator end() const { return Iterator(list_->end(), this); }
+  Iterator end() const { return Iterator(root_.get(), Size()); }
 
   /*! \brief Returns the previous version of the List.
    *
-   * Returns the same version of the List if the version is minimal.
+   * Returns the same version of the List if the version is minimal or the
+   * previous version is released by Compact().
    * \return Previous version of the List.
    */
-  List<T> Undo() const override
-    { return List<T>(*this, version_ > 0 ? version_ - 1 : version_); }
+  List<T, Allocator> Undo() const override
+    { return List<T, Allocator>(*this, version_ > MinVersion() ? version_ - 1 : version_); }
 
   /*! \brief Returns the next version of the List.
    *
-   * Returns the same version of the List if the version is maximum.
+   * Returns the same version of the List if the version is maximum, the
+   * oldest kept version if this version is released by Compact().
    * \return Next version of the List.
    */
-  List<T> Redo() const override
-    { return List<T>(*this, version_ < *max_version_ ? version_ + 1 : version_); }
+  List<T, Allocator> Redo() const override;
+
+  /*! \brief Returns the version of the List with the given number.
+   *
+   * Complexity: O(1).
+   * \param version Number of the version.
+   * \return The version of the List.
+   * \exception std::out_of_range If version is not less than VersionCount()
+   *            or is released by Compact().
+   */
+  List<T, Allocator> AtVersion(std::size_t version) const override;
+
+  /*! \brief Returns the latest version of the List.
+   *
+   * \return The latest version of the List.
+   */
+  List<T, Allocator> Latest() const override
+    { return List<T, Allocator>(*this, MaxVersion()); }
+
+  /*! \brief Count of versions of the List.
+   *
+   * \return Count of versions, released ones included.
+   */
+  std::size_t VersionCount() const override { return MaxVersion() + 1; }
+
+  /*! \brief Number of this version.
+   *
+   * \return Number of the version.
+   */
+  std::size_t GetVersion() const override { return version_; }
+
+  /*! \brief Time the version was made.
+   *
+   * Times of versions never decrease even if the clock is set back.
+   * \return Creation time of this version.
+   * \exception std::out_of_range If this version is released by Compact().
+   */
+  Clock::time_point GetTime() const;
+
+  /*! \brief Returns the version of the List as of the given time.
+   *
+   * Complexity: O(log v) for v versions. The search waits for modifications
+   * and Compact() calls running at the same time.
+   * \param time Point in time.
+   * \return The latest version made at or before the time.
+   * \exception std::out_of_range If no kept version was made by the time.
+   */
+  List<T, Allocator> AsOf(Clock::time_point time) const;
 
 private:
-  List(const List<T>& other, std::size_t version);
+  List(const List<T, Allocator>& other, std::size_t version);
+  List<T, Allocator> Commit(NodePtr root, typename Edit::Kind kind,
+                            std::size_t idx, std::size_t count) const;
   void CheckVersion() const;
+  std::size_t MaxVersion() const { return state_->versions.Size() - 1; }
+  std::size_t MinVersion() const
+    { return state_->compaction.min_version.load(std::memory_order_acquire); }
+  static std::size_t NodeSize(const NodePtr& node) { return node ? node->size : 0; }
+  static int Height(const NodePtr& node) { return node ? node->height : 0; }
+  static const T& Get(const Node* node, std::size_t idx);
+  static const T& Value(const Slot& slot)
+    { if constexpr (kBoxed) return *slot; else return slot; }
+  template <typename... Args>
+  Slot MakeSlot(Args&&... args) const;
+  template <typename InputIt>
+  ChunkPtr MakeChunk(InputIt first, InputIt last) const;
+  NodePtr MakeNode(NodePtr left, ChunkPtr chunk, NodePtr right) const;
+  NodePtr RotateLeft(const NodePtr& node) const;
+  NodePtr RotateRight(const NodePtr& node) const;
+  NodePtr Join(NodePtr left, ChunkPtr chunk, NodePtr right) const;
+  NodePtr JoinRight(const NodePtr& left, ChunkPtr chunk, const NodePtr& right) const;
+  NodePtr JoinLeft(const NodePtr& left, ChunkPtr chunk, const NodePtr& right) const;
+  NodePtr Join(NodePtr left, NodePtr right) const;
+  std::pair<ChunkPtr, NodePtr> SplitFirst(const NodePtr& node) const;
+  NodePtr Insert(const NodePtr& node, std::size_t idx, const Slot& value) const;
+  NodePtr Remove(const NodePtr& node, std::size_t idx) const;
+  NodePtr Build(const std::vector<Slot>& values, std::size_t from, std::size_t to) const;
+  static void WriteSlots(Writer& writer, const Slot* slots, std::size_t count);
+  void ReadSlots(Reader& reader, Slot* slots, std::size_t count) const;
+  static void Number(const Node* node, std::unordered_map<const Node*, std::size_t>& ids,
+                     std::vector<const Node*>& order);
+  static void WriteChunks(Writer& writer, const Node* node);
+};
+
+/*! \brief Modifications of the List between two versions.
+ *
+ * Returned by List::Feed(), stays valid while any version of the List
+ * exists.
+ */
+template <typename T, typename Allocator>
+class List<T, Allocator>::ChangeFeed {
+  friend class List<T, Allocator>;
+  std::shared_ptr<const Versions> versions_;
+  std::size_t from_;
+  std::size_t to_;
+  ChangeFeed(std::shared_ptr<const Versions> versions, std::size_t from, std::size_t to)
+    : versions_(std::move(versions)), from_(from), to_(std::max(from, to)) { }
+public:
+  /*! \brief Iterator over the modifications. */
+  class Iterator {
+    friend class ChangeFeed;
+    const Versions* versions_;
+    std::size_t version_;
+    Iterator(const Versions* versions, std::size_t version)
+      : versions_(versions), version_(version) { }
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Edit;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Edit*;
+    using reference = const Edit&;
+    Iterator& operator++() { ++version_; return *this; }
+    const Edit& operator*() const { return (*versions_)[version_].edit; }
+    const Edit* operator->() const { return &**this; }
+    bool operator==(const Iterator& rhs) const { return version_ == rhs.version_; }
+    bool operator!=(const Iterator& rhs) const { return !(*this == rhs); }
+  };
+
+  /*! \brief Count of modifications.
+   *
+   * \return Count of modifications in the feed.
+   */
+  std::size_t Size() const { return to_ - from_; }
+
+  /*! \brief Iterator pointing to the first modification. */
+  Iterator begin() const { return Iterator(versions_.get(), from_ + 1); }
+
+  /*! \brief Iterator pointing past the last modification. */
+  Iterator end() const { return Iterator(versions_.get(), to_ + 1); }
 };
 
-template <typename T>
-List<T>::List()
-  : list_(std::make_shared<std::list<Node>>())
-  , max_version_(std::make_shared<std::atomic<std::size_t>>(0))
-  , mutex_(std::make_shared<std::mutex>())
+/*! \brief Mutable builder of a version of the List.
+ *
+ * Returned by List::Transient(). Values are added in place to a private
+ * buffer at the end of the List, take no locks and make no versions;
+ * Persistent() publishes them as one new version with a single Insert edit.
+ * A builder must be used by one thread at a time.
+ */
+template <typename T, typename Allocator>
+class List<T, Allocator>::Builder {
+  friend class List<T, Allocator>;
+  List<T, Allocator> list_;
+  std::vector<Slot> tail_;
+  explicit Builder(const List<T, Allocator>& list) : list_(list) { }
+public:
+  /*! \brief Size of the list being built.
+   *
+   * \return Count of elements.
+   */
+  std::size_t Size() const { return list_.Size() + tail_.size(); }
+
+  /*! \brief List being built empty?
+   *
+   * \return true if the builder has no elements, otherwise false.
+   */
+  bool IsEmpty() const { return Size() == 0; }
+
+  /*! \brief Access the element by its position.
+   *
+   * Complexity: O(1) for added values, O(log n) for values of the List.
+   * \param idx The position of the element.
+   * \return Element to reading.
+   * \exception std::out_of_range If idx is not less than Size().
+   */
+  const T& At(std::size_t idx) const;
+
+  /*! \brief Add a value at the end.
+   *
+   * \param value Value to add.
+   * \return Reference to this builder.
+   */
+  Builder& PushBack(T value) { return EmplaceBack(std::move(value)); }
+
+  /*! \brief Add a value constructed in place at the end.
+   *
+   * \param args Arguments of the constructor of the value.
+   * \return Reference to this builder.
+   */
+  template <typename... Args>
+  Builder& EmplaceBack(Args&&... args)
+    { tail_.push_back(list_.MakeSlot(std::forward<Args>(args)...)); return *this; }
+
+  /*! \brief Publishes the elements as a new version of the List.
+   *
+   * The builder stays usable and continues from the published version.
+   * \return New version of the List.
+   * \exception IncorrectVersionException If the List was modified after
+   *            the Transient() call.
+   */
+  List<T, Allocator> Persistent();
+};
+
+template <typename T, typename Allocator>
+List<T, Allocator>::List()
+  : List(Allocator())
 {
 }
 
-template <typename T>
-List<T>::List(const List<T>& other, std::size_t version)
-  : list_(other.list_)
+template <typename T, typename Allocator>
+List<T, Allocator>::List(const Allocator& alloc)
+  : state_(std::allocate_shared<State>(alloc, alloc))
+{
+  state_->times.Add(Clock::now());
+  state_->versions.EmplaceBack(Version{nullptr, Edit{0, Edit::Kind::Insert, 0, 0}});
+}
+
+template <typename T, typename Allocator>
+List<T, Allocator>::List(const List<T, Allocator>& other, std::size_t version)
+  : state_(other.state_)
   , version_(version)
-  , max_version_(other.max_version_)
-  , mutex_(other.mutex_)
+  , root_(version == other.version_ ? other.root_ : state_->versions[version].root)
 {
 }
 
-template <typename T>
-std::size_t List<T>::Size() const
+template <typename T, typename Allocator>
+const T& List<T, Allocator>::At(std::size_t idx) const
 {
-  std::lock_guard<std::mutex> l(*mutex_);
-  std::size_t res = 0;
-  for ([[maybe_unused]] const auto& item : *this) {
-    ++res;
+  if (idx >= Size()) {
+    throw std::out_of_range("At");
   }
-  return res;
+  return Get(root_.get(), idx);
+}
+
+template <typename T, typename Allocator>
+List<T, Allocator> List<T, Allocator>::PushBack(T value) const
+{
+  return EmplaceBack(std::move(value));
 }
 
-template <typename T>
-List<T> List<T>::PushBack(T value) const
+template <typename T, typename Allocator>
+List<T, Allocator> List<T, Allocator>::PushFront(T value) const
 {
-  std::lock_guard<std::mutex> l(*mutex_);
+  return EmplaceFront(std::move(value));
+}
+
+template <typename T, typename Allocator>
+template <typename... Args>
+List<T, Allocator> List<T, Allocator>::EmplaceBack(Args&&... args) const
+{
+  const Slot slot = MakeSlot(std::forward<Args>(args)...);
+  std::lock_guard<std::mutex> l(state_->mutex);
   CheckVersion();
-  ++(*max_version_);
-  if (!list_->empty()) {
-    std::lock_guard<std::mutex> l2(*((--list_->end())->mutex));
-    list_->emplace_back(*max_version_, std::move(value));
-    return List<T>(*this, *max_version_);
-  }
-  list_->emplace_back(*max_version_, std::move(value));
-  return List<T>(*this, *max_version_);
+  return Commit(Insert(root_, Size(), slot), Edit::Kind::Insert, Size(), 1);
 }
 
-template <typename T>
-List<T> List<T>::PushFront(T value) const
+template <typename T, typename Allocator>
+template <typename... Args>
+List<T, Allocator> List<T, Allocator>::EmplaceFront(Args&&... args) const
 {
-  std::lock_guard<std::mutex> l(*mutex_);
+  const Slot slot = MakeSlot(std::forward<Args>(args)...);
+  std::lock_guard<std::mutex> l(state_->mutex);
   CheckVersion();
-  ++(*max_version_);
-  std::lock_guard<std::mutex> l2(*(list_->begin()->mutex));
-  list_->emplace_front(*max_version_, std::move(value));
-  return List<T>(*this, *max_version_);
+  return Commit(Insert(root_, 0, slot), Edit::Kind::Insert, 0, 1);
 }
 
-template <typename T>
-List<T> List<T>::Insert(const List<T>::Iterator& pos, T value) const
+template <typename T, typename Allocator>
+template <typename InputIt>
+List<T, Allocator> List<T, Allocator>::Append(InputIt first, InputIt last) const
 {
-  std::lock_guard<std::mutex> l(*mutex_);
+  std::vector<Slot> values;
+  for (; first != last; ++first) {
+    values.push_back(MakeSlot(*first));
+  }
+  NodePtr tail = Build(values, 0, (values.size() + kChunk - 1) / kChunk);
+  std::lock_guard<std::mutex> l(state_->mutex);
   CheckVersion();
-  ++(*max_version_);
-  std::lock_guard<std::mutex> l2(*(pos.it_->mutex));
-  list_->insert(pos.it_, List<T>::Node(*max_version_, std::move(value)));
-  return List<T>(*this, *max_version_);
+  return Commit(Join(root_, std::move(tail)), Edit::Kind::Insert, Size(), values.size());
+}
+
+template <typename T, typename Allocator>
+List<T, Allocator> List<T, Allocator>::Insert(const Iterator& pos, T value) const
+{
+  return Emplace(pos, std::move(value));
 }
 
-template <typename T>
-List<T> List<T>::Remove(const List<T>::Iterator& pos) const
+template <typename T, typename Allocator>
+template <typename... Args>
+List<T, Allocator> List<T, Allocator>::Emplace(const Iterator& pos, Args&&... args) const
 {
-  std::lock_guard<std::mutex> l(*mutex_);
+  const Slot slot = MakeSlot(std::forward<Args>(args)...);
+  std::lock_guard<std::mutex> l(state_->mutex);
   CheckVersion();
-  ++(*max_version_);
-  std::lock_guard<std::mutex> l2(*(pos.it_->mutex));
-  pos.it_->is_deleted = true;
-  return List<T>(*this, *max_version_);
+  const std::size_t idx = std::min(pos.idx_, Size());
+  return Commit(Insert(root_, idx, slot), Edit::Kind::Insert, idx, 1);
+}
+
+template <typename T, typename Allocator>
+List<T, Allocator> List<T, Allocator>::Remove(const Iterator& pos) const
+{
+  std::lock_guard<std::mutex> l(state_->mutex);
+  CheckVersion();
+  if (pos.idx_ >= Size()) {
+    throw std::out_of_range("Remove");
+  }
+  return Commit(Remove(root_, pos.idx_), Edit::Kind::Remove, pos.idx_, 1);
+}
+
+template <typename T, typename Allocator>
+bool List<T, Allocator>::Compact(std::size_t limit) const
+{
+  std::lock_guard<std::mutex> l(state_->mutex);
+  const std::size_t version = std::max(version_, MinVersion());
+  state_->compaction.min_version.store(version, std::memory_order_release);
+  std::size_t& next = state_->compaction.next;
+  next = version - next > limit ? next + limit : version;
+  state_->versions.Release(next);
+  state_->times.Release(next);
+  return next == version;
+}
+
+template <typename T, typename Allocator>
+typename List<T, Allocator>::ChangeFeed
+List<T, Allocator>::Feed(const List<T, Allocator>& to) const
+{
+  if (to.state_ != state_) {
+    throw std::invalid_argument("Feed");
+  }
+  if (version_ < MinVersion()) {
+    throw std::out_of_range("Feed");
+  }
+  return ChangeFeed(std::shared_ptr<const Versions>(state_, &state_->versions),
+                    version_, to.version_);
+}
+
+/* Nodes are numbered from one in post-order over all versions, so children
+ * are written before their parents and the loaded versions share the nodes
+ * and chunks exactly like the saved ones. A node refers to its children by
+ * numbers, zero is an empty subtree, and to a chunk by its number or zero
+ * followed by a new chunk. */
+template <typename T, typename Allocator>
+void List<T, Allocator>::Save(std::ostream& out, Compression compression) const
+{
+  Writer writer(out, Format::ListHistory, compression);
+  std::vector<NodePtr> roots;
+  std::vector<Edit> edits;
+  std::vector<std::int64_t> times;
+  std::size_t min_version;
+  {
+    std::lock_guard<std::mutex> l(state_->mutex);
+    min_version = MinVersion();
+    for (std::size_t version = min_version; version <= MaxVersion(); ++version) {
+      roots.push_back(state_->versions[version].root);
+      edits.push_back(state_->versions[version].edit);
+      times.push_back(state_->times.Ticks(version));
+    }
+  }
+  std::unordered_map<const Node*, std::size_t> ids;
+  std::vector<const Node*> order;
+  for (const NodePtr& root : roots) {
+    Number(root.get(), ids, order);
+  }
+  writer.WriteVarint(sizeof(T));
+  writer.WriteVarint(min_version);
+  writer.WriteVarint(roots.size());
+  writer.WriteVarint(order.size());
+  std::unordered_map<const Chunk*, std::size_t> chunks;
+  for (const Node* node : order) {
+    writer.WriteVarint(node->left ? ids[node->left.get()] : 0);
+    writer.WriteVarint(node->right ? ids[node->right.get()] : 0);
+    auto chunk = chunks.emplace(node->chunk.get(), chunks.size() + 1);
+    if (!chunk.second) {
+      writer.WriteVarint(chunk.first->second);
+      continue;
+    }
+    writer.WriteVarint(0);
+    writer.WriteVarint(node->chunk->count);
+    WriteSlots(writer, node->chunk->values.data(), node->chunk->count);
+  }
+  for (std::size_t i = 0; i < roots.size(); ++i) {
+    writer.WriteVarint(roots[i] ? ids[roots[i].get()] : 0);
+    if (i == 0) {
+      writer.Write(times[0]);
+    } else {
+      writer.WriteVarint(static_cast<std::uint64_t>(edits[i].kind));
+      writer.WriteVarint(edits[i].idx);
+      writer.WriteVarint(edits[i].count);
+      writer.WriteVarint(times[i] - times[i - 1]);
+    }
+  }
+  writer.Finish();
+}
+
+template <typename T, typename Allocator>
+void List<T, Allocator>::SaveSnapshot(std::ostream& out, Compression compression) const
+{
+  Writer writer(out, Format::Snapshot, compression);
+  writer.WriteVarint(sizeof(T));
+  writer.WriteVarint(Size());
+  WriteChunks(writer, root_.get());
+  writer.Finish();
+}
+
+template <typename T, typename Allocator>
+List<T, Allocator> List<T, Allocator>::Load(std::istream& in, const Allocator& alloc)
+{
+  Reader reader(in);
+  if ((reader.GetFormat() != Format::ListHistory && reader.GetFormat() != Format::Snapshot) ||
+      reader.ReadVarint() != sizeof(T)) {
+    throw std::runtime_error("Not a list of this type");
+  }
+  List<T, Allocator> list(alloc);
+  if (reader.GetFormat() == Format::Snapshot) {
+    const std::size_t size = reader.ReadVarint();
+    std::vector<Slot> values;
+    while (values.size() < size) {
+      const std::size_t read = values.size();
+      values.resize(read + std::min(kChunk, size - read));
+      list.ReadSlots(reader, values.data() + read, values.size() - read);
+    }
+    reader.Finish();
+    list.root_ = list.Build(values, 0, (values.size() + kChunk - 1) / kChunk);
+    list.state_->versions[0].root = list.root_;
+    return list;
+  }
+  const std::size_t min_version = reader.ReadVarint();
+  const std::size_t count = reader.ReadVarint();
+  if (count == 0 || count > SIZE_MAX - min_version) {
+    Corrupted();
+  }
+  std::vector<NodePtr> nodes(1);
+  std::vector<ChunkPtr> chunks(1);
+  const auto node = [&nodes](std::uint64_t id) {
+    if (id >= nodes.size()) {
+      Corrupted();
+    }
+    return nodes[id];
+  };
+  for (std::size_t i = reader.ReadVarint(); i > 0; --i) {
+    NodePtr left = node(reader.ReadVarint());
+    NodePtr right = node(reader.ReadVarint());
+    const std::uint64_t id = reader.ReadVarint();
+    if (id == 0) {
+      auto chunk = std::allocate_shared<Chunk>(list.state_->versions.GetAllocator());
+      chunk->count = reader.ReadVarint();
+      if (chunk->count == 0 || chunk->count > kChunk) {
+        Corrupted();
+      }
+      list.ReadSlots(reader, chunk->values.data(), chunk->count);
+      chunks.push_back(std::move(chunk));
+    } else if (id >= chunks.size()) {
+      Corrupted();
+    }
+    nodes.push_back(list.MakeNode(std::move(left), id ? chunks[id] : chunks.back(),
+                                  std::move(right)));
+  }
+  std::vector<Version> versions;
+  std::vector<std::int64_t> times;
+  for (std::size_t i = 0; i < count; ++i) {
+    Version loaded{node(reader.ReadVarint()), Edit{min_version + i, Edit::Kind::Insert, 0, 0}};
+    if (i == 0) {
+      times.emplace_back();
+      reader.Read(times.back());
+    } else {
+      const std::uint64_t kind = reader.ReadVarint();
+      if (kind > static_cast<std::uint64_t>(Edit::Kind::Remove)) {
+        Corrupted();
+      }
+      loaded.edit.kind = static_cast<typename Edit::Kind>(kind);
+      loaded.edit.idx = reader.ReadVarint();
+      loaded.edit.count = reader.ReadVarint();
+      times.push_back(times.back() + reader.ReadVarint());
+    }
+    versions.push_back(std::move(loaded));
+  }
+  reader.Finish();
+  list.state_->times.Rebase(min_version);
+  list.state_->versions.Rebase(min_version);
+  for (std::size_t i = 0; i < count; ++i) {
+    list.state_->times.Add(times[i]);
+    list.state_->versions.EmplaceBack(std::move(versions[i]));
+  }
+  list.version_ = list.MaxVersion();
+  list.root_ = list.state_->versions[list.version_].root;
+  list.state_->compaction.min_version.store(min_version, std::memory_order_relaxed);
+  list.state_->compaction.next = min_version;
+  return list;
+}
+
+/* Appending the version publishes it, so its time is added first and
+ * dropped if the version can not be appended. */
+template <typename T, typename Allocator>
+List<T, Allocator> List<T, Allocator>::Commit(
+  NodePtr root, typename Edit::Kind kind, std::size_t idx, std::size_t count) const
+{
+  const std::size_t version = MaxVersion() + 1;
+  state_->times.Add(Clock::now());
+  try {
+    state_->versions.EmplaceBack(Version{std::move(root), Edit{version, kind, idx, count}});
+  } catch (...) {
+    state_->times.PopBack();
+    throw;
+  }
+  return List<T, Allocator>(*this, version);
 }
 
-template <typename T>
-void List<T>::CheckVersion() const
+template <typename T, typename Allocator>
+List<T, Allocator> List<T, Allocator>::AtVersion(std::size_t version) const
 {
-  if (version_ != *max_version_) {
+  if (version > MaxVersion() || version < MinVersion()) {
+    throw std::out_of_range("AtVersion");
+  }
+  return List<T, Allocator>(*this, version);
+}
+
+template <typename T, typename Allocator>
+List<T, Allocator> List<T, Allocator>::Redo() const
+{
+  if (version_ == MaxVersion()) {
+    return *this;
+  }
+  return List<T, Allocator>(*this, std::max(version_ + 1, MinVersion()));
+}
+
+template <typename T, typename Allocator>
+typename List<T, Allocator>::Clock::time_point List<T, Allocator>::GetTime() const
+{
+  if (version_ < MinVersion()) {
+    throw std::out_of_range("GetTime");
+  }
+  return state_->times.Get(version_);
+}
+
+/* Compact() releases the times of the released versions, so the times are
+ * searched under the lock. */
+template <typename T, typename Allocator>
+List<T, Allocator> List<T, Allocator>::AsOf(Clock::time_point time) const
+{
+  std::lock_guard<std::mutex> l(state_->mutex);
+  const std::size_t min_version = MinVersion();
+  const std::size_t next = state_->times.Find(time, min_version, MaxVersion());
+  if (next == min_version) {
+    throw std::out_of_range("AsOf");
+  }
+  return List<T, Allocator>(*this, next - 1);
+}
+
+template <typename T, typename Allocator>
+void List<T, Allocator>::CheckVersion() const
+{
+  if (version_ != MaxVersion()) {
     throw IncorrectVersionException();
   }
 }
 
+template <typename T, typename Allocator>
+const T& List<T, Allocator>::Get(const Node* node, std::size_t idx)
+{
+  for (;;) {
+    const std::size_t left = NodeSize(node->left);
+    if (idx < left) {
+      node = node->left.get();
+      continue;
+    }
+    idx -= left;
+    if (idx < node->chunk->count) {
+      return Value(node->chunk->values[idx]);
+    }
+    idx -= node->chunk->count;
+    node = node->right.get();
+  }
+}
+
+template <typename T, typename Allocator>
+template <typename... Args>
+typename List<T, Allocator>::Slot List<T, Allocator>::MakeSlot(Args&&... args) const
+{
+  if constexpr (kBoxed) {
+    return std::allocate_shared<T>(state_->versions.GetAllocator(), std::forward<Args>(args)...);
+  } else {
+    return T(std::forward<Args>(args)...);
+  }
+}
+
+template <typename T, typename Allocator>
+template <typename InputIt>
+typename List<T, Allocator>::ChunkPtr
+List<T, Allocator>::MakeChunk(InputIt first, InputIt last) const
+{
+  auto chunk = std::allocate_shared<Chunk>(state_->versions.GetAllocator());
+  chunk->count = std::copy(first, last, chunk->values.begin()) - chunk->values.begin();
+  return chunk;
+}
+
+template <typename T, typename Allocator>
+typename List<T, Allocator>::NodePtr
+List<T, Allocator>::MakeNode(NodePtr left, ChunkPtr chunk, NodePtr right) const
+{
+  const std::size_t size = NodeSize(left) + chunk->count + NodeSize(right);
+  const int height = std::max(Height(left), Height(right)) + 1;
+  return std::allocate_shared<Node>(state_->versions.GetAllocator(),
+    Node{std::move(chunk), size, height, std::move(left), std::move(right)});
+}
+
+template <typename T, typename Allocator>
+typename List<T, Allocator>::NodePtr
+List<T, Allocator>::RotateLeft(const NodePtr& node) const
+{
+  const NodePtr& right = node->right;
+  return MakeNode(MakeNode(node->left, node->chunk, right->left),
+                  right->chunk, right->right);
+}
+
+template <typename T, typename Allocator>
+typename List<T, Allocator>::NodePtr
+List<T, Allocator>::RotateRight(const NodePtr& node) const
+{
+  const NodePtr& left = node->left;
+  return MakeNode(left->left, left->chunk,
+                  MakeNode(left->right, node->chunk, node->right));
+}
+
+/* Joins two AVL trees with a chunk between them: the lower tree is attached
+ * to the spine of the higher one at the same height and the path to it is
+ * rebalanced. Takes O(difference of heights), so it also restores the
+ * balance of a node whose subtree grew or shrank by one level. */
+template <typename T, typename Allocator>
+typename List<T, Allocator>::NodePtr
+List<T, Allocator>::Join(NodePtr left, ChunkPtr chunk, NodePtr right) const
+{
+  if (Height(left) > Height(right) + 1) {
+    return JoinRight(left, std::move(chunk), right);
+  }
+  if (Height(right) > Height(left) + 1) {
+    return JoinLeft(left, std::move(chunk), right);
+  }
+  return MakeNode(std::move(left), std::move(chunk), std::move(right));
+}
+
+template <typename T, typename Allocator>
+typename List<T, Allocator>::NodePtr List<T, Allocator>::JoinRight(
+  const NodePtr& left, ChunkPtr chunk, const NodePtr& right) const
+{
+  if (Height(left->right) <= Height(right) + 1) {
+    NodePtr node = MakeNode(left->right, std::move(chunk), right);
+    if (Height(node) <= Height(left->left) + 1) {
+      return MakeNode(left->left, left->chunk, std::move(node));
+    }
+    return RotateLeft(MakeNode(left->left, left->chunk, RotateRight(node)));
+  }
+  NodePtr node = JoinRight(left->right, std::move(chunk), right);
+  const bool balanced = Height(node) <= Height(left->left) + 1;
+  node = MakeNode(left->left, left->chunk, std::move(node));
+  return balanced ? node : RotateLeft(node);
+}
+
+template <typename T, typename Allocator>
+typename List<T, Allocator>::NodePtr List<T, Allocator>::JoinLeft(
+  const NodePtr& left, ChunkPtr chunk, const NodePtr& right) const
+{
+  if (Height(right->left) <= Height(left) + 1) {
+    NodePtr node = MakeNode(left, std::move(chunk), right->left);
+    if (Height(node) <= Height(right->right) + 1) {
+      return MakeNode(std::move(node), right->chunk, right->right);
+    }
+    return RotateRight(MakeNode(RotateLeft(node), right->chunk, right->right));
+  }
+  NodePtr node = JoinLeft(left, std::move(chunk), right->left);
+  const bool balanced = Height(node) <= Height(right->right) + 1;
+  node = MakeNode(std::move(node), right->chunk, right->right);
+  return balanced ? node : RotateRight(node);
+}
+
+template <typename T, typename Allocator>
+typename List<T, Allocator>::NodePtr
+List<T, Allocator>::Join(NodePtr left, NodePtr right) const
+{
+  if (!left) {
+    return right;
+  }
+  if (!right) {
+    return left;
+  }
+  auto parts = SplitFirst(right);
+  return Join(std::move(left), std::move(parts.first), std::move(parts.second));
+}
+
+/* Splits the tree into its first chunk and the rest. */
+template <typename T, typename Allocator>
+std::pair<typename List<T, Allocator>::ChunkPtr, typename List<T, Allocator>::NodePtr>
+List<T, Allocator>::SplitFirst(const NodePtr& node) const
+{
+  if (!node->left) {
+    return {node->chunk, node->right};
+  }
+  auto parts = SplitFirst(node->left);
+  return {std::move(parts.first), Join(std::move(parts.second), node->chunk, node->right)};
+}
+
+/* The value goes to the chunk which contains the position or ends at it. A
+ * chunk with free space is copied with the value, the tree keeps its shape.
+ * A full chunk is split in halves and the second half becomes a new node. */
+template <typename T, typename Allocator>
+typename List<T, Allocator>::NodePtr List<T, Allocator>::Insert(
+  const NodePtr& node, std::size_t idx, const Slot& value) const
+{
+  if (!node) {
+    return MakeNode(nullptr, MakeChunk(&value, &value + 1), nullptr);
+  }
+  const std::size_t left = NodeSize(node->left);
+  const std::size_t count = node->chunk->count;
+  if (idx < left) {
+    return Join(Insert(node->left, idx, value), node->chunk, node->right);
+  }
+  if (idx > left + count) {
+    return Join(node->left, node->chunk, Insert(node->right, idx - left - count, value));
+  }
+  const auto& values = node->chunk->values;
+  const std::size_t offset = idx - left;
+  std::array<Slot, kChunk + 1> merged;
+  std::copy(values.begin(), values.begin() + offset, merged.begin());
+  merged[offset] = value;
+  std::copy(values.begin() + offset, values.begin() + count, merged.begin() + offset + 1);
+  const auto begin = std::make_move_iterator(merged.begin());
+  if (count < kChunk) {
+    return MakeNode(node->left, MakeChunk(begin, begin + count + 1), node->right);
+  }
+  const std::size_t half = (count + 1) / 2;
+  NodePtr right = Join(nullptr, MakeChunk(begin + half, begin + kChunk + 1), node->right);
+  return Join(node->left, MakeChunk(begin, begin + half), std::move(right));
+}
+
+template <typename T, typename Allocator>
+typename List<T, Allocator>::NodePtr
+List<T, Allocator>::Remove(const NodePtr& node, std::size_t idx) const
+{
+  const std::size_t left = NodeSize(node->left);
+  const std::size_t count = node->chunk->count;
+  if (idx < left) {
+    return Join(Remove(node->left, idx), node->chunk, node->right);
+  }
+  if (idx >= left + count) {
+    return Join(node->left, node->chunk, Remove(node->right, idx - left - count));
+  }
+  if (count == 1) {
+    return Join(node->left, node->right);
+  }
+  const auto& values = node->chunk->values;
+  const std::size_t offset = idx - left;
+  auto chunk = std::allocate_shared<Chunk>(state_->versions.GetAllocator());
+  chunk->count = count - 1;
+  auto it = std::copy(values.begin(), values.begin() + offset, chunk->values.begin());
+  std::copy(values.begin() + offset + 1, values.begin() + count, it);
+  return MakeNode(node->left, std::move(chunk), node->right);
+}
+
+/* Builds a perfectly balanced tree of the chunks [from, to) of the values. */
+template <typename T, typename Allocator>
+typename List<T, Allocator>::NodePtr List<T, Allocator>::Build(
+  const std::vector<Slot>& values, std::size_t from, std::size_t to) const
+{
+  if (from == to) {
+    return nullptr;
+  }
+  const std::size_t mid = from + (to - from) / 2;
+  const auto first = values.begin() + mid * kChunk;
+  const auto last = values.begin() + std::min((mid + 1) * kChunk, values.size());
+  return MakeNode(Build(values, from, mid), MakeChunk(first, last), Build(values, mid + 1, to));
+}
+
+template <typename T, typename Allocator>
+void List<T, Allocator>::Number(const Node* node, std::unordered_map<const Node*, std::size_t>& ids,
+                                std::vector<const Node*>& order)
+{
+  if (!node || ids.count(node)) {
+    return;
+  }
+  Number(node->left.get(), ids, order);
+  Number(node->right.get(), ids, order);
+  order.push_back(node);
+  ids.emplace(node, order.size());
+}
+
+template <typename T, typename Allocator>
+void List<T, Allocator>::WriteChunks(Writer& writer, const Node* node)
+{
+  if (node) {
+    WriteChunks(writer, node->left.get());
+    WriteSlots(writer, node->chunk->values.data(), node->chunk->count);
+    WriteChunks(writer, node->right.get());
+  }
+}
+
+template <typename T, typename Allocator>
+void List<T, Allocator>::WriteSlots(Writer& writer, const Slot* slots, std::size_t count)
+{
+  if constexpr (kBoxed) {
+    for (std::size_t i = 0; i < count; ++i) {
+      writer.Write(*slots[i]);
+    }
+  } else {
+    writer.WriteValues(slots, count);
+  }
+}
+
+template <typename T, typename Allocator>
+void List<T, Allocator>::ReadSlots(Reader& reader, Slot* slots, std::size_t count) const
+{
+  if constexpr (kBoxed) {
+    for (std::size_t i = 0; i < count; ++i) {
+      T value;
+      reader.Read(value);
+      slots[i] = MakeSlot(std::move(value));
+    }
+  } else {
+    reader.ReadValues(slots, count);
+  }
+}
+
 /////////////////////////////////////////////
 
-template <typename T>
-typename List<T>::Iterator List<T>::Iterator::operator++()
+/* The path from the root to the node of the current element is built on the
+ * first access and then moved to the in-order neighbours when the iterator
+ * leaves the chunk of the node. */
+template <typename T, typename Allocator>
+typename List<T, Allocator>::Iterator&
+List<T, Allocator>::Iterator::operator++()
 {
-  it_ = SkipUnavailable(++it_, true);
+  ++idx_;
+  if (path_.empty() || ++offset_ < path_.back()->chunk->count) {
+    return *this;
+  }
+  offset_ = 0;
+  const Node* node = path_.back();
+  if (node->right) {
+    for (node = node->right.get(); node; node = node->left.get()) {
+      path_.push_back(node);
+    }
+    return *this;
+  }
+  path_.pop_back();
+  while (!path_.empty() && path_.back()->right.get() == node) {
+    node = path_.back();
+    path_.pop_back();
+  }
   return *this;
 }
 
-template <typename T>
-typename List<T>::Iterator List<T>::Iterator::operator--()
+template <typename T, typename Allocator>
+typename List<T, Allocator>::Iterator&
+List<T, Allocator>::Iterator::operator--()
 {
-  it_ = SkipUnavailable(--it_, false);
+  --idx_;
+  if (path_.empty()) {
+    return *this;
+  }
+  if (offset_ > 0) {
+    --offset_;
+    return *this;
+  }
+  const Node* node = path_.back();
+  if (node->left) {
+    for (node = node->left.get(); node; node = node->right.get()) {
+      path_.push_back(node);
+    }
+  } else {
+    path_.pop_back();
+    while (!path_.empty() && path_.back()->left.get() == node) {
+      node = path_.back();
+      path_.pop_back();
+    }
+  }
+  if (!path_.empty()) {
+    offset_ = path_.back()->chunk->count - 1;
+  }
   return *this;
 }
 
-template <typename T>
-const T& List<T>::Iterator::operator*() const
+template <typename T, typename Allocator>
+const T& List<T, Allocator>::Iterator::operator*() const
 {
-  return it_->value;
+  if (path_.empty()) {
+    std::size_t idx = idx_;
+    for (const Node* node = root_; ; ) {
+      path_.push_back(node);
+      const std::size_t left = NodeSize(node->left);
+      if (idx < left) {
+        node = node->left.get();
+        continue;
+      }
+      idx -= left;
+      if (idx < node->chunk->count) {
+        break;
+      }
+      idx -= node->chunk->count;
+      node = node->right.get();
+    }
+    offset_ = idx;
+  }
+  return Value(path_.back()->chunk->values[offset_]);
 }
 
-template <typename T>
-typename List<T>::Iterator::list_iterator
-List<T>::Iterator::SkipUnavailable(
-  const List<T>::Iterator::list_iterator& it, bool forward) const
+template <typename T, typename Allocator>
+const T& List<T, Allocator>::Builder::At(std::size_t idx) const
 {
-  auto out = it;
-  List<T>::Iterator::list_iterator end = forward ? master_->list_->end() 
-                                                 : master_->list_->begin();
-  while (out != end) {
-    std::lock_guard<std::mutex> l(*(out->mutex));
-    if (out->version == master_->version_) { // can't be deleted
-      break;
-    }
-    if (out->version < master_->version_ && !out->is_deleted) {
-      break;
-    }
-    forward ? ++out : --out;
+  const std::size_t size = list_.Size();
+  if (idx < size) {
+    return list_.At(idx);
   }
-  return out;
+  if (idx - size >= tail_.size()) {
+    throw std::out_of_range("At");
+  }
+  return Value(tail_[idx - size]);
+}
+
+/* The tree of the added values is built before the lock, as by Append(). */
+template <typename T, typename Allocator>
+List<T, Allocator> List<T, Allocator>::Builder::Persistent()
+{
+  NodePtr tail = list_.Build(tail_, 0, (tail_.size() + kChunk - 1) / kChunk);
+  std::lock_guard<std::mutex> l(list_.state_->mutex);
+  list_.CheckVersion();
+  const std::size_t size = list_.Size();
+  list_ = list_.Commit(list_.Join(list_.root_, std::move(tail)), Edit::Kind::Insert, size, tail_.size());
+  tail_.clear();
+  return list_;
 }
 
-} // namespace pdc
\ No newline at end of file
+} // namespace pdc
@@ -0,0 +1,661 @@
+#pragma once
+
+#include "persistent_structure.hpp"
+#include "fat_nodes.hpp"
+#include "segmented_vector.hpp"
+#include "timeline.hpp"
+#include "exception.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace pdc {
+
+using namespace internal;
+
+/*! \brief Partially persistent ordered map.
+ *
+ * The Map is a red-black tree whose nodes are fat nodes: the links and the
+ * value of a node keep their history, a modification adds entries to the
+ * histories of the nodes it changes instead of copying them. Rebalancing
+ * changes O(1) links amortized, so a modification adds O(1) amortized space.
+ * Colours and parent links are needed only to modify the latest version and
+ * are kept without history. Reading any version takes no locks, only
+ * modifications of the latest version are serialized.
+ *
+ * Complexity: Find() and At() visit O(log n) nodes, a node visible in an old
+ * version is found by binary search in its history. Insert() and Remove()
+ * take O(log n). Size() takes O(1).
+ *
+ * \tparam Compare Strict weak ordering of keys.
+ * \tparam Allocator Allocator used for the nodes and the shared state of all
+ *                   versions, may be a std::pmr::polymorphic_allocator.
+ */
+template <typename K, typename V, typename Compare = std::less<K>,
+          typename Allocator = std::allocator<std::pair<const K, V>>>
+class Map : public Persisent<Map<K, V, Compare, Allocator>> {
+  template <typename U>
+  using Rebind = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+  struct Node;
+  struct Links {
+    Node* left;
+    Node* right;
+  };
+  struct Node {
+    template <typename... Args>
+    Node(std::size_t version, const Allocator& alloc, K k, Args&&... args)
+      : key(std::move(k)), links(version, Links{nullptr, nullptr}, alloc)
+      , value(std::in_place, version, alloc, std::forward<Args>(args)...) { }
+    const K key;
+    FatNodes<Links, Rebind<Links>> links;
+    FatNodes<V, Rebind<V>> value;
+    /* State of the latest version, used only by the writer. */
+    Node* parent = nullptr;
+    bool red = true;
+  };
+  using Nodes = SegmentedVector<Node, Rebind<Node>>;
+  struct Version {
+    const Node* root;
+    std::size_t size;
+  };
+  using Versions = SegmentedVector<Version, Rebind<Version>>;
+  using Times = Timeline<Rebind<std::int64_t>>;
+  /* State shared by all versions of the Map. Nodes are never freed while the
+   * Map exists, root and size describe the version being modified. */
+  struct State {
+    State(const Compare& comp, const Allocator& alloc)
+      : compare(comp), nodes(alloc), versions(alloc), times(alloc) { }
+    Compare compare;
+    Nodes nodes;
+    Versions versions;
+    Times times;
+    std::mutex mutex;
+    Node* root = nullptr;
+    std::size_t size = 0;
+  };
+  mutable std::shared_ptr<State> state_;
+  std::size_t version_ = 0;
+  const Node* root_ = nullptr;
+  std::size_t size_ = 0;
+public:
+  /*! \brief Clock of the creation times of versions. */
+  using Clock = std::chrono::system_clock;
+
+  /*! \brief Iterator over the elements in the order of keys.
+   *
+   * Moving to the next element takes O(1) amortized node visits, the
+   * iterator reads only its version and takes no locks.
+   */
+  class Iterator {
+    friend class Map<K, V, Compare, Allocator>;
+    std::vector<const Node*> path_;
+    std::size_t version_;
+    explicit Iterator(std::size_t version) : version_(version) { }
+    void Descend(const Node* node);
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::pair<const K&, const V&>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = value_type;
+    Iterator& operator++();
+    value_type operator*() const { return value_type(Key(), Value()); }
+    const K& Key() const { return path_.back()->key; }
+    const V& Value() const { return path_.back()->value.Get(version_); }
+    bool operator==(const Iterator& rhs) const
+      { return path_.empty() ? rhs.path_.empty() : !rhs.path_.empty() && path_.back() == rhs.path_.back(); }
+    bool operator!=(const Iterator& rhs) const { return !(*this == rhs); }
+  };
+
+  /*! \brief Default constructor. Create empty Map. */
+  Map();
+
+  /*! \brief Create empty Map with the ordering and the allocator.
+   *
+   * \param comp Ordering of keys.
+   * \param alloc Allocator to use for all versions of the Map.
+   */
+  explicit Map(const Compare& comp, const Allocator& alloc = Allocator());
+
+  /*! \brief Allocator of the Map.
+   *
+   * \return Copy of the allocator used by all versions of the Map.
+   */
+  Allocator GetAllocator() const { return Allocator(state_->nodes.GetAllocator()); }
+
+  /*! \brief Count of elements.
+   *
+   * Complexity: O(1).
+   * \return Map size.
+   */
+  std::size_t Size() const { return size_; }
+
+  /*! \brief Map empty?
+   *
+   * \return true if the Map is empty, otherwise false.
+   */
+  bool IsEmpty() const { return Size() == 0; }
+
+  /*! \brief Looks up the value of the key.
+   *
+   * \param key The key to find.
+   * \return Pointer to the value, nullptr if the key is not in the Map.
+   */
+  const V* Find(const K& key) const;
+
+  /*! \brief Access the value of the key for reading.
+   *
+   * \param key The key of the element.
+   * \return Value of the element.
+   * \exception std::out_of_range If the key is not in the Map.
+   */
+  const V& At(const K& key) const;
+
+  /*! \brief Key in the Map?
+   *
+   * \param key The key to find.
+   * \return true if the Map has the key, otherwise false.
+   */
+  bool Contains(const K& key) const { return Find(key) != nullptr; }
+
+  /*! \brief Adds an element or replaces the value of an existing key.
+   *
+   * \param key The key of the element.
+   * \param value The value of the element.
+   * \return New version of the Map with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Map.
+   */
+  Map<K, V, Compare, Allocator> Insert(K key, V value) const;
+
+  /*! \brief Adds an element with a value constructed in place or replaces
+   * the value of an existing key.
+   *
+   * \param key The key of the element.
+   * \param args Arguments of the constructor of the value.
+   * \return New version of the Map with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Map.
+   */
+  template <typename... Args>
+  Map<K, V, Compare, Allocator> Emplace(K key, Args&&... args) const;
+
+  /*! \brief Removes the element with the key.
+   *
+   * \param key The key of the element.
+   * \return New version of the Map with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Map.
+   * \exception std::out_of_range If the key is not in the Map.
+   */
+  Map<K, V, Compare, Allocator> Remove(const K& key) const;
+
+  /*! \brief STL-based begin().
+   *
+   * \return Iterator pointing to the element with the smallest key.
+   */
+  Iterator begin() const;
+
+  /*! \brief STL-based end().
+   *
+   * \return Iterator pointing past the element with the largest key.
+   */
+  Iterator end() const { return Iterator(version_); }
+
+  /*! \brief First element whose key is not less than the key.
+   *
+   * Complexity: O(log n).
+   * \param key The key to compare with.
+   * \return Iterator pointing to the element or end().
+   */
+  Iterator LowerBound(const K& key) const;
+
+  /*! \brief Returns the previous version of the Map.
+   *
+   * Returns the same version of the Map if the version is minimal.
+   * \return Previous version of the Map.
+   */
+  Map<K, V, Compare, Allocator> Undo() const override
+    { return Map<K, V, Compare, Allocator>(*this, version_ > 0 ? version_ - 1 : version_); }
+
+  /*! \brief Returns the next version of the Map.
+   *
+   * Returns the same version of the Map if the version is maximum.
+   * \return Next version of the Map.
+   */
+  Map<K, V, Compare, Allocator> Redo() const override
+    { return Map<K, V, Compare, Allocator>(*this, version_ < MaxVersion() ? version_ + 1 : version_); }
+
+  /*! \brief Returns the version of the Map with the given number.
+   *
+   * Complexity: O(1).
+   * \param version Number of the version.
+   * \return The version of the Map.
+   * \exception std::out_of_range If version is not less than VersionCount().
+   */
+  Map<K, V, Compare, Allocator> AtVersion(std::size_t version) const override;
+
+  /*! \brief Returns the latest version of the Map.
+   *
+   * \return The latest version of the Map.
+   */
+  Map<K, V, Compare, Allocator> Latest() const override
+    { return Map<K, V, Compare, Allocator>(*this, MaxVersion()); }
+
+  /*! \brief Count of versions of the Map.
+   *
+   * \return Count of versions.
+   */
+  std::size_t VersionCount() const override { return MaxVersion() + 1; }
+
+  /*! \brief Number of this version.
+   *
+   * \return Number of the version.
+   */
+  std::size_t GetVersion() const override { return version_; }
+
+  /*! \brief Time the version was made.
+   *
+   * Times of versions never decrease even if the clock is set back.
+   * \return Creation time of this version.
+   */
+  Clock::time_point GetTime() const { return state_->times.Get(version_); }
+
+  /*! \brief Returns the version of the Map as of the given time.
+   *
+   * Complexity: O(log v) for v versions.
+   * \param time Point in time.
+   * \return The latest version made at or before the time.
+   * \exception std::out_of_range If no version was made by the time.
+   */
+  Map<K, V, Compare, Allocator> AsOf(Clock::time_point time) const;
+
+private:
+  Map(const Map<K, V, Compare, Allocator>& other, std::size_t version);
+  std::size_t MaxVersion() const { return state_->versions.Size() - 1; }
+  void CheckVersion() const;
+  Map<K, V, Compare, Allocator> Commit(std::size_t version) const;
+  bool Less(const K& lhs, const K& rhs) const { return state_->compare(lhs, rhs); }
+  static const Node* Child(const Node* node, bool right, std::size_t version)
+    { const Links& links = node->links.Get(version); return right ? links.right : links.left; }
+  static Node* Left(const Node* node, std::size_t version) { return node->links.Get(version).left; }
+  static Node* Right(const Node* node, std::size_t version) { return node->links.Get(version).right; }
+  static void SetLeft(Node* node, Node* child, std::size_t version);
+  static void SetRight(Node* node, Node* child, std::size_t version);
+  static bool IsRed(const Node* node) { return node && node->red; }
+  void Replace(Node* node, Node* child, std::size_t version) const;
+  void RotateLeft(Node* node, std::size_t version) const;
+  void RotateRight(Node* node, std::size_t version) const;
+  void InsertFixup(Node* node, std::size_t version) const;
+  void RemoveFixup(Node* node, Node* parent, std::size_t version) const;
+};
+
+template <typename K, typename V, typename Compare, typename Allocator>
+Map<K, V, Compare, Allocator>::Map()
+  : Map(Compare())
+{
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+Map<K, V, Compare, Allocator>::Map(const Compare& comp, const Allocator& alloc)
+  : state_(std::allocate_shared<State>(alloc, comp, alloc))
+{
+  state_->times.Add(Clock::now());
+  state_->versions.EmplaceBack(Version{nullptr, 0});
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+Map<K, V, Compare, Allocator>::Map(const Map<K, V, Compare, Allocator>& other, std::size_t version)
+  : state_(other.state_)
+  , version_(version)
+  , root_(state_->versions[version].root)
+  , size_(state_->versions[version].size)
+{
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+const V* Map<K, V, Compare, Allocator>::Find(const K& key) const
+{
+  const Node* node = root_;
+  while (node) {
+    if (Less(key, node->key)) {
+      node = Child(node, false, version_);
+    } else if (Less(node->key, key)) {
+      node = Child(node, true, version_);
+    } else {
+      return &node->value.Get(version_);
+    }
+  }
+  return nullptr;
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+const V& Map<K, V, Compare, Allocator>::At(const K& key) const
+{
+  const V* value = Find(key);
+  if (!value) {
+    throw std::out_of_range("At");
+  }
+  return *value;
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+Map<K, V, Compare, Allocator> Map<K, V, Compare, Allocator>::Insert(K key, V value) const
+{
+  return Emplace(std::move(key), std::move(value));
+}
+
+/* The new version is built in the histories of the nodes under the next
+ * version number, readers do not see it until it is committed. */
+template <typename K, typename V, typename Compare, typename Allocator>
+template <typename... Args>
+Map<K, V, Compare, Allocator> Map<K, V, Compare, Allocator>::Emplace(K key, Args&&... args) const
+{
+  std::lock_guard<std::mutex> l(state_->mutex);
+  CheckVersion();
+  const std::size_t version = version_ + 1;
+  Node* parent = nullptr;
+  Node* node = state_->root;
+  bool right = false;
+  while (node) {
+    if (Less(key, node->key)) {
+      right = false;
+    } else if (Less(node->key, key)) {
+      right = true;
+    } else {
+      node->value.Emplace(version, std::forward<Args>(args)...);
+      return Commit(version);
+    }
+    parent = node;
+    node = right ? Right(node, version) : Left(node, version);
+  }
+  node = &state_->nodes.EmplaceBack(version, GetAllocator(), std::move(key),
+                                    std::forward<Args>(args)...);
+  node->parent = parent;
+  if (!parent) {
+    state_->root = node;
+  } else if (right) {
+    SetRight(parent, node, version);
+  } else {
+    SetLeft(parent, node, version);
+  }
+  ++state_->size;
+  InsertFixup(node, version);
+  return Commit(version);
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+Map<K, V, Compare, Allocator> Map<K, V, Compare, Allocator>::Remove(const K& key) const
+{
+  std::lock_guard<std::mutex> l(state_->mutex);
+  CheckVersion();
+  const std::size_t version = version_ + 1;
+  Node* node = state_->root;
+  while (node && (Less(key, node->key) || Less(node->key, key))) {
+    node = Less(key, node->key) ? Left(node, version) : Right(node, version);
+  }
+  if (!node) {
+    throw std::out_of_range("Remove");
+  }
+  bool red = node->red;
+  Node* child;
+  Node* parent;
+  if (!Left(node, version)) {
+    child = Right(node, version);
+    parent = node->parent;
+    Replace(node, child, version);
+  } else if (!Right(node, version)) {
+    child = Left(node, version);
+    parent = node->parent;
+    Replace(node, child, version);
+  } else {
+    Node* next = Right(node, version);
+    while (Left(next, version)) {
+      next = Left(next, version);
+    }
+    red = next->red;
+    child = Right(next, version);
+    if (next->parent == node) {
+      parent = next;
+    } else {
+      parent = next->parent;
+      Replace(next, child, version);
+      SetRight(next, Right(node, version), version);
+      Right(next, version)->parent = next;
+    }
+    Replace(node, next, version);
+    SetLeft(next, Left(node, version), version);
+    Left(next, version)->parent = next;
+    next->red = node->red;
+  }
+  --state_->size;
+  if (!red) {
+    RemoveFixup(child, parent, version);
+  }
+  return Commit(version);
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+typename Map<K, V, Compare, Allocator>::Iterator Map<K, V, Compare, Allocator>::begin() const
+{
+  Iterator it(version_);
+  it.Descend(root_);
+  return it;
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+typename Map<K, V, Compare, Allocator>::Iterator
+Map<K, V, Compare, Allocator>::LowerBound(const K& key) const
+{
+  Iterator it(version_);
+  const Node* node = root_;
+  while (node) {
+    if (Less(node->key, key)) {
+      node = Child(node, true, version_);
+    } else {
+      it.path_.push_back(node);
+      node = Child(node, false, version_);
+    }
+  }
+  return it;
+}
+
+/* The path keeps the nodes whose left subtree holds the current element, so
+ * the top of the path is the current element. */
+template <typename K, typename V, typename Compare, typename Allocator>
+void Map<K, V, Compare, Allocator>::Iterator::Descend(const Node* node)
+{
+  while (node) {
+    path_.push_back(node);
+    node = Child(node, false, version_);
+  }
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+typename Map<K, V, Compare, Allocator>::Iterator&
+Map<K, V, Compare, Allocator>::Iterator::operator++()
+{
+  const Node* node = path_.back();
+  path_.pop_back();
+  Descend(Child(node, true, version_));
+  return *this;
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+Map<K, V, Compare, Allocator> Map<K, V, Compare, Allocator>::AtVersion(std::size_t version) const
+{
+  if (version > MaxVersion()) {
+    throw std::out_of_range("AtVersion");
+  }
+  return Map<K, V, Compare, Allocator>(*this, version);
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+Map<K, V, Compare, Allocator> Map<K, V, Compare, Allocator>::AsOf(Clock::time_point time) const
+{
+  const std::size_t next = state_->times.Find(time, 0, MaxVersion());
+  if (next == 0) {
+    throw std::out_of_range("AsOf");
+  }
+  return Map<K, V, Compare, Allocator>(*this, next - 1);
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+void Map<K, V, Compare, Allocator>::CheckVersion() const
+{
+  if (version_ != MaxVersion()) {
+    throw IncorrectVersionException();
+  }
+}
+
+/* The version is published by appending its root, after all histories of
+ * the version and its time are written. */
+template <typename K, typename V, typename Compare, typename Allocator>
+Map<K, V, Compare, Allocator> Map<K, V, Compare, Allocator>::Commit(std::size_t version) const
+{
+  state_->times.Add(Clock::now());
+  try {
+    state_->versions.EmplaceBack(Version{state_->root, state_->size});
+  } catch (...) {
+    state_->times.PopBack();
+    throw;
+  }
+  return Map<K, V, Compare, Allocator>(*this, version);
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+void Map<K, V, Compare, Allocator>::SetLeft(Node* node, Node* child, std::size_t version)
+{
+  node->links.Add(version, Links{child, Right(node, version)});
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+void Map<K, V, Compare, Allocator>::SetRight(Node* node, Node* child, std::size_t version)
+{
+  node->links.Add(version, Links{Left(node, version), child});
+}
+
+/* Puts the child in place of the node under the parent of the node. */
+template <typename K, typename V, typename Compare, typename Allocator>
+void Map<K, V, Compare, Allocator>::Replace(Node* node, Node* child, std::size_t version) const
+{
+  Node* parent = node->parent;
+  if (!parent) {
+    state_->root = child;
+  } else if (Left(parent, version) == node) {
+    SetLeft(parent, child, version);
+  } else {
+    SetRight(parent, child, version);
+  }
+  if (child) {
+    child->parent = parent;
+  }
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+void Map<K, V, Compare, Allocator>::RotateLeft(Node* node, std::size_t version) const
+{
+  Node* right = Right(node, version);
+  Node* inner = Left(right, version);
+  SetRight(node, inner, version);
+  if (inner) {
+    inner->parent = node;
+  }
+  Replace(node, right, version);
+  SetLeft(right, node, version);
+  node->parent = right;
+}
+
+template <typename K, typename V, typename Compare, typename Allocator>
+void Map<K, V, Compare, Allocator>::RotateRight(Node* node, std::size_t version) const
+{
+  Node* left = Left(node, version);
+  Node* inner = Right(left, version);
+  SetLeft(node, inner, version);
+  if (inner) {
+    inner->parent = node;
+  }
+  Replace(node, left, version);
+  SetRight(left, node, version);
+  node->parent = left;
+}
+
+/* Recolouring goes up the tree without touching the histories, at most two
+ * rotations change links. */
+template <typename K, typename V, typename Compare, typename Allocator>
+void Map<K, V, Compare, Allocator>::InsertFixup(Node* node, std::size_t version) const
+{
+  while (IsRed(node->parent)) {
+    Node* parent = node->parent;
+    Node* grandparent = parent->parent;
+    const bool left = parent == Left(grandparent, version);
+    Node* uncle = left ? Right(grandparent, version) : Left(grandparent, version);
+    if (IsRed(uncle)) {
+      parent->red = false;
+      uncle->red = false;
+      grandparent->red = true;
+      node = grandparent;
+      continue;
+    }
+    if (node == (left ? Right(parent, version) : Left(parent, version))) {
+      node = parent;
+      left ? RotateLeft(node, version) : RotateRight(node, version);
+      parent = node->parent;
+    }
+    parent->red = false;
+    grandparent->red = true;
+    left ? RotateRight(grandparent, version) : RotateLeft(grandparent, version);
+  }
+  state_->root->red = false;
+}
+
+/* The node, possibly null, takes the place of a removed black node, so its
+ * subtree lacks one black node; the parent is passed for a null node. At most
+ * three rotations change links. */
+template <typename K, typename V, typename Compare, typename Allocator>
+void Map<K, V, Compare, Allocator>::RemoveFixup(Node* node, Node* parent, std::size_t version) const
+{
+  while (node != state_->root && !IsRed(node)) {
+    const bool left = node == Left(parent, version);
+    Node* sibling = left ? Right(parent, version) : Left(parent, version);
+    if (IsRed(sibling)) {
+      sibling->red = false;
+      parent->red = true;
+      left ? RotateLeft(parent, version) : RotateRight(parent, version);
+      sibling = left ? Right(parent, version) : Left(parent, version);
+    }
+    Node* outer = left ? Right(sibling, version) : Left(sibling, version);
+    Node* inner = left ? Left(sibling, version) : Right(sibling, version);
+    if (!IsRed(outer) && !IsRed(inner)) {
+      sibling->red = true;
+      node = parent;
+      parent = node->parent;
+      continue;
+    }
+    if (!IsRed(outer)) {
+      inner->red = false;
+      sibling->red = true;
+      left ? RotateRight(sibling, version) : RotateLeft(sibling, version);
+      sibling = left ? Right(parent, version) : Left(parent, version);
+      outer = left ? Right(sibling, version) : Left(sibling, version);
+    }
+    sibling->red = parent->red;
+    parent->red = false;
+    outer->red = false;
+    left ? RotateLeft(parent, version) : RotateRight(parent, version);
+    node = state_->root;
+  }
+  if (node) {
+    node->red = false;
+  }
+}
+
+} // namespace pdc
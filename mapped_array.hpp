@@ -0,0 +1,408 @@
+#pragma once
+
+#include "persistent_structure.hpp"
+#include "mapped_file.hpp"
+#include "exception.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace pdc {
+
+using namespace internal;
+
+/*! \brief Durability of modifications of a MappedArray. */
+enum class Durability {
+  Process, /*!< Versions survive a crash of the process. */
+  System   /*!< Versions survive a crash of the system, every modification
+                is flushed to the disk before it is published. */
+};
+
+/*! \brief Partially persistent array stored in a file.
+ *
+ * The history is an append-only log of records (version, index, value) with
+ * an index of the latest record of every element, both files are mapped to
+ * memory. The records of an element are chained from the latest one with
+ * skip pointers, so the record visible in a version is found by a search
+ * over the history of the element. Opening an existing history maps a
+ * segment per doubling of the files and reads no records, elements of any
+ * version are read directly from the mapping without copying or locking,
+ * only modifications of the latest version are serialized. A history is
+ * opened by one MappedArray at a time.
+ *
+ * A modification is published only after its records are written, so a
+ * crash never leaves a partially written version.
+ *
+ * Complexity: reading an element takes O(log m) for m modifications of the
+ * element, Size() takes O(log n), modifications take O(1).
+ *
+ * \tparam T Trivially copyable type of elements.
+ */
+template <typename T>
+class MappedArray : public Persisent<MappedArray<T>> {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "MappedArray requires a trivially copyable type");
+  static constexpr std::uint64_t kNone = UINT64_MAX;
+  /* The skip pointer of a record leads to an older record of the element
+   * chosen by the depths as in a skew-binary random access list. */
+  struct Record {
+    std::uint64_t version;
+    std::uint64_t idx;
+    std::uint64_t prev;
+    std::uint64_t jump;
+    std::uint64_t depth;
+    T value;
+  };
+  struct Slot {
+    std::atomic<std::uint64_t> head;
+    std::uint64_t created;
+  };
+  struct LogHeader {
+    char magic[8];
+    std::uint64_t value_size;
+    std::atomic<std::uint64_t> committed;
+    std::atomic<std::uint64_t> indexed;
+  };
+  struct IndexHeader {
+    char magic[8];
+    std::atomic<std::uint64_t> count;
+  };
+  struct Storage {
+    Storage(const std::string& path, bool create, Durability durability)
+      : log(path, create, sizeof(Record)), index(path + ".idx", create, sizeof(Slot))
+      , sync(durability == Durability::System) { }
+    MappedFile log;
+    MappedFile index;
+    bool sync;
+    std::atomic<std::size_t> max_version{0};
+    std::mutex mutex;
+  };
+  std::shared_ptr<Storage> storage_;
+  std::size_t version_ = 0;
+public:
+  /*! \brief Opens an existing history.
+   *
+   * The latest version of the stored Array is opened.
+   * \param path Path of the history, the index is stored next to it.
+   * \param durability Durability of modifications.
+   * \exception std::system_error If the files can not be opened or are open
+   *            by another MappedArray.
+   * \exception std::runtime_error If the files do not contain a history of
+   *            an array of T.
+   */
+  explicit MappedArray(const std::string& path,
+                       Durability durability = Durability::Process);
+
+  /*! \brief Creates a new history, replacing an existing one.
+   *
+   * \param path Path of the history, the index is stored next to it.
+   * \param count Count of elements.
+   * \param value The value to use for initialization.
+   * \param durability Durability of modifications.
+   * \exception std::system_error If the files can not be created or are open
+   *            by another MappedArray.
+   */
+  MappedArray(const std::string& path, std::size_t count, T value = T(),
+              Durability durability = Durability::Process);
+
+  /*! \brief Size of array.
+   *
+   * \return Array size.
+   */
+  std::size_t Size() const;
+
+  /*! \brief Array empty?
+   *
+   * \return true if the Array is empty, otherwise false.
+   */
+  bool IsEmpty() const { return Size() == 0; }
+
+  /*! \brief Updates the value of the Array element.
+   *
+   * \param idx The index of the element to be changed.
+   * \param value The new value of the element.
+   * \return New version of the Array with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Array.
+   */
+  MappedArray<T> Update(std::size_t idx, const T& value) const;
+
+  /*! \brief Add a value at the end of the Array.
+   *
+   * \param value Value to add.
+   * \return New version of the Array with changed state.
+   * \exception IncorrectVersionException
+   *            If the method is not called on the latest version of the Array.
+   */
+  MappedArray<T> PushBack(const T& value) const;
+
+  /*! \brief Access the item for reading.
+   *
+   * \param idx The index of the element.
+   * \return Element in the mapped file.
+   * \exception std::out_of_range If idx is not less than Size().
+   */
+  const T& operator[](std::size_t idx) const;
+
+  /*! \brief Returns the previous version of the Array.
+   *
+   * Returns the same version of the Array if the version is minimal.
+   * \return Previous version of the Array.
+   */
+  MappedArray<T> Undo() const override
+    { return MappedArray<T>(*this, version_ > 0 ? version_ - 1 : version_); }
+
+  /*! \brief Returns the next version of the Array.
+   *
+   * Returns the same version of the Array if the version is maximum.
+   * \return Next version of the Array.
+   */
+  MappedArray<T> Redo() const override
+    { return MappedArray<T>(*this, version_ < MaxVersion() ? version_ + 1 : version_); }
+
+  /*! \brief Returns the version of the Array with the given number.
+   *
+   * \param version Number of the version.
+   * \return The version of the Array.
+   * \exception std::out_of_range If version is not less than VersionCount().
+   */
+  MappedArray<T> AtVersion(std::size_t version) const override;
+
+  /*! \brief Returns the latest version of the Array.
+   *
+   * \return The latest version of the Array.
+   */
+  MappedArray<T> Latest() const override { return MappedArray<T>(*this, MaxVersion()); }
+
+  /*! \brief Count of versions of the Array.
+   *
+   * \return Count of versions.
+   */
+  std::size_t VersionCount() const override { return MaxVersion() + 1; }
+
+  /*! \brief Number of this version.
+   *
+   * \return Number of the version.
+   */
+  std::size_t GetVersion() const override { return version_; }
+
+private:
+  MappedArray(const MappedArray<T>& other, std::size_t version)
+    : storage_(other.storage_), version_(version) { }
+  std::size_t MaxVersion() const
+    { return storage_->max_version.load(std::memory_order_acquire); }
+  void CheckVersion() const
+    { if (version_ != MaxVersion()) throw IncorrectVersionException(); }
+  LogHeader& Log() const
+    { return *reinterpret_cast<LogHeader*>(storage_->log.Header()); }
+  IndexHeader& Index() const
+    { return *reinterpret_cast<IndexHeader*>(storage_->index.Header()); }
+  Record& RecordAt(std::uint64_t r) const
+    { return *reinterpret_cast<Record*>(storage_->log.At(r)); }
+  Slot& SlotAt(std::uint64_t idx) const
+    { return *reinterpret_cast<Slot*>(storage_->index.At(idx)); }
+  void Append(std::uint64_t r, std::size_t version, std::size_t idx, const T& value) const;
+  void Commit(std::uint64_t from, std::uint64_t to) const;
+  void Apply(std::uint64_t from, std::uint64_t to) const;
+  void SyncSlots(std::uint64_t from, std::uint64_t to) const;
+};
+
+template <typename T>
+MappedArray<T>::MappedArray(const std::string& path, Durability durability)
+  : storage_(std::make_shared<Storage>(path, false, durability))
+{
+  if (!storage_->log.Header() || !storage_->index.Header() ||
+      std::memcmp(Log().magic, "pdcarr02", 8) != 0 ||
+      std::memcmp(Index().magic, "pdcidx02", 8) != 0 ||
+      Log().value_size != sizeof(T)) {
+    throw std::runtime_error("Not an array history");
+  }
+  const std::uint64_t committed = Log().committed.load(std::memory_order_relaxed);
+  if (storage_->log.Capacity() < committed ||
+      storage_->index.Capacity() < Index().count.load(std::memory_order_relaxed)) {
+    throw std::runtime_error("Truncated array history");
+  }
+  Apply(Log().indexed.load(std::memory_order_relaxed), committed);
+  version_ = committed ? RecordAt(committed - 1).version : 0;
+  storage_->max_version.store(version_, std::memory_order_relaxed);
+}
+
+template <typename T>
+MappedArray<T>::MappedArray(
+  const std::string& path, std::size_t count, T value, Durability durability)
+  : storage_(std::make_shared<Storage>(path, true, durability))
+{
+  storage_->log.Reserve(count);
+  storage_->index.Reserve(count);
+  std::memcpy(Log().magic, "pdcarr02", 8);
+  Log().value_size = sizeof(T);
+  std::memcpy(Index().magic, "pdcidx02", 8);
+  for (std::size_t i = 0; i < count; ++i) {
+    Append(i, 0, i, value);
+  }
+  Commit(0, count);
+}
+
+/* Elements are appended in increasing order of versions, so the count of
+ * elements in the version is found by binary search over the versions the
+ * elements were created in. */
+template <typename T>
+std::size_t MappedArray<T>::Size() const
+{
+  std::size_t lo = 0;
+  std::size_t hi = Index().count.load(std::memory_order_acquire);
+  while (lo < hi) {
+    const std::size_t mid = lo + (hi - lo) / 2;
+    if (SlotAt(mid).created <= version_) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+template <typename T>
+MappedArray<T> MappedArray<T>::Update(std::size_t idx, const T& value) const
+{
+  std::lock_guard<std::mutex> lk(storage_->mutex);
+  CheckVersion();
+  if (idx >= Size()) {
+    throw std::out_of_range("Update");
+  }
+  const std::uint64_t r = Log().committed.load(std::memory_order_relaxed);
+  Append(r, version_ + 1, idx, value);
+  Commit(r, r + 1);
+  return MappedArray<T>(*this, version_ + 1);
+}
+
+template <typename T>
+MappedArray<T> MappedArray<T>::PushBack(const T& value) const
+{
+  std::lock_guard<std::mutex> lk(storage_->mutex);
+  CheckVersion();
+  const std::uint64_t r = Log().committed.load(std::memory_order_relaxed);
+  Append(r, version_ + 1, Index().count.load(std::memory_order_relaxed), value);
+  Commit(r, r + 1);
+  return MappedArray<T>(*this, version_ + 1);
+}
+
+template <typename T>
+MappedArray<T> MappedArray<T>::AtVersion(std::size_t version) const
+{
+  if (version > MaxVersion()) {
+    throw std::out_of_range("AtVersion");
+  }
+  return MappedArray<T>(*this, version);
+}
+
+/* Versions decrease along the chain of an element, so a skip pointer is
+ * followed while its record is still newer than the version, which takes
+ * O(log m) steps for m records. An element exists in the versions from the
+ * one it was created in. */
+template <typename T>
+const T& MappedArray<T>::operator[](std::size_t idx) const
+{
+  if (idx >= Index().count.load(std::memory_order_acquire) || SlotAt(idx).created > version_) {
+    throw std::out_of_range("MappedArray");
+  }
+  std::uint64_t r = SlotAt(idx).head.load(std::memory_order_acquire);
+  while (RecordAt(r).version > version_) {
+    const Record& record = RecordAt(r);
+    r = RecordAt(record.jump).version > version_ ? record.jump : record.prev;
+  }
+  return RecordAt(r).value;
+}
+
+/* Writes a record after the committed ones, it is invisible until the
+ * commit. */
+template <typename T>
+void MappedArray<T>::Append(
+  std::uint64_t r, std::size_t version, std::size_t idx, const T& value) const
+{
+  storage_->log.Reserve(r + 1);
+  Record& record = RecordAt(r);
+  record.version = version;
+  record.idx = idx;
+  record.prev = idx < Index().count.load(std::memory_order_relaxed)
+    ? SlotAt(idx).head.load(std::memory_order_relaxed) : kNone;
+  if (record.prev == kNone) {
+    record.jump = r;
+    record.depth = 0;
+  } else {
+    const Record& prev = RecordAt(record.prev);
+    const Record& jump = RecordAt(prev.jump);
+    record.jump = prev.depth - jump.depth == jump.depth - RecordAt(jump.jump).depth
+      ? jump.jump : record.prev;
+    record.depth = prev.depth + 1;
+  }
+  std::memcpy(&record.value, &value, sizeof(T));
+}
+
+/* The records become part of the history when the committed count covers
+ * them, then they are applied to the index. A crash between the two steps
+ * is repaired by applying the committed records again on opening. */
+template <typename T>
+void MappedArray<T>::Commit(std::uint64_t from, std::uint64_t to) const
+{
+  if (storage_->sync) {
+    storage_->log.Sync(from, to);
+  }
+  Log().committed.store(to, std::memory_order_release);
+  if (storage_->sync) {
+    storage_->log.SyncHeader();
+  }
+  Apply(from, to);
+  if (storage_->sync) {
+    SyncSlots(from, to);
+  }
+  Log().indexed.store(to, std::memory_order_release);
+  if (to > 0) {
+    storage_->max_version.store(RecordAt(to - 1).version, std::memory_order_release);
+  }
+}
+
+/* Applying a record twice gives the same index, so the records which may be
+ * partially applied are simply applied again. */
+template <typename T>
+void MappedArray<T>::Apply(std::uint64_t from, std::uint64_t to) const
+{
+  for (std::uint64_t r = from; r < to; ++r) {
+    const Record& record = RecordAt(r);
+    const std::uint64_t count = Index().count.load(std::memory_order_relaxed);
+    if (record.idx >= count) {
+      storage_->index.Reserve(record.idx + 1);
+      SlotAt(record.idx).created = record.version;
+    }
+    SlotAt(record.idx).head.store(r, std::memory_order_release);
+    if (record.idx >= count) {
+      Index().count.store(record.idx + 1, std::memory_order_release);
+    }
+  }
+}
+
+/* Flushes the index header and the slots the records were applied to, so a
+ * modification flushes O(1) pages. The records of consecutive elements are
+ * flushed as one range. */
+template <typename T>
+void MappedArray<T>::SyncSlots(std::uint64_t from, std::uint64_t to) const
+{
+  storage_->index.SyncHeader();
+  for (std::uint64_t r = from; r < to; ) {
+    const std::uint64_t first = RecordAt(r).idx;
+    std::uint64_t last = first + 1;
+    while (++r < to && RecordAt(r).idx == last) {
+      ++last;
+    }
+    storage_->index.Sync(first, last);
+  }
+}
+
+} // namespace pdc
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstddef>
+#include <cerrno>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace internal {
+
+/* File of elements of a fixed size mapped to memory.
+ *
+ * A header block is followed by segments of elements of doubling capacity.
+ * Every segment is a separate mapping made when the file grows over it, so
+ * the address space taken grows with the file, data never moves and readers
+ * may keep pointers into it while the file grows. Segments start at
+ * multiples of kBlock and never split an element, the layout depends only on
+ * the element size. Growing is serialized by the owner, readers access the
+ * mapped elements without locking. The owner holds an exclusive lock on the
+ * file, another open of the file fails even in the same process. */
+class MappedFile {
+  static constexpr std::size_t kBlock = std::size_t(1) << 16;
+  static constexpr std::size_t kSegments = 48;
+  int fd_ = -1;
+  std::size_t element_size_;
+  std::size_t first_bits_ = 0;
+  std::size_t size_ = 0;
+  std::size_t mapped_ = 0;
+  char* header_ = nullptr;
+  std::atomic<char*> segments_[kSegments] = {};
+public:
+  MappedFile(const std::string& path, bool create, std::size_t element_size);
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+  char* Header() const { return header_; }
+  char* At(std::size_t idx) const;
+  std::size_t Capacity() const { return Capacity(mapped_) - Capacity(0); }
+  void Reserve(std::size_t count);
+  void SyncHeader() const;
+  void Sync(std::size_t first, std::size_t last) const;
+private:
+  std::size_t Segment(std::size_t idx) const;
+  std::size_t Capacity(std::size_t segment) const
+    { return std::size_t(1) << (segment + first_bits_); }
+  std::size_t Bytes(std::size_t segment) const
+    { return (Capacity(segment) * element_size_ + kBlock - 1) / kBlock * kBlock; }
+  std::size_t Offset(std::size_t segment) const;
+  void Map(std::size_t segment);
+  void Close();
+};
+
+/* The first segment takes about one block. A created file is truncated only
+ * after it is locked. */
+inline MappedFile::MappedFile(const std::string& path, bool create, std::size_t element_size)
+  : element_size_(element_size)
+{
+  while ((std::size_t(2) << first_bits_) * element_size_ <= kBlock) {
+    ++first_bits_;
+  }
+  fd_ = ::open(path.c_str(), create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+  if (fd_ < 0) {
+    throw std::system_error(errno, std::generic_category(), path);
+  }
+  try {
+    if (::flock(fd_, LOCK_EX | LOCK_NB) != 0) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    size_ = st.st_size;
+    if (create) {
+      if (::ftruncate(fd_, 0) != 0 || ::ftruncate(fd_, kBlock) != 0) {
+        throw std::system_error(errno, std::generic_category(), path);
+      }
+      size_ = kBlock;
+    }
+    if (size_ < kBlock) {
+      return;
+    }
+    void* header = ::mmap(nullptr, kBlock, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (header == MAP_FAILED) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    header_ = static_cast<char*>(header);
+    while (mapped_ < kSegments && Offset(mapped_) + Bytes(mapped_) <= size_) {
+      Map(mapped_);
+    }
+  } catch (...) {
+    Close();
+    throw;
+  }
+}
+
+inline MappedFile::~MappedFile()
+{
+  Close();
+}
+
+inline char* MappedFile::At(std::size_t idx) const
+{
+  const std::size_t segment = Segment(idx);
+  const std::size_t offset = idx + Capacity(0) - Capacity(segment);
+  return segments_[segment].load(std::memory_order_acquire) + offset * element_size_;
+}
+
+/* Segments double, so appending takes amortized O(1) calls. */
+inline void MappedFile::Reserve(std::size_t count)
+{
+  while (Capacity() < count) {
+    if (mapped_ == kSegments) {
+      throw std::length_error("MappedFile");
+    }
+    const std::size_t end = Offset(mapped_) + Bytes(mapped_);
+    if (end > size_) {
+      if (::ftruncate(fd_, end) != 0) {
+        throw std::system_error(errno, std::generic_category(), "ftruncate");
+      }
+      size_ = end;
+    }
+    Map(mapped_);
+  }
+}
+
+inline void MappedFile::SyncHeader() const
+{
+  if (::msync(header_, kBlock, MS_SYNC) != 0) {
+    throw std::system_error(errno, std::generic_category(), "msync");
+  }
+}
+
+/* Flushes the pages of the elements [first, last) segment by segment. */
+inline void MappedFile::Sync(std::size_t first, std::size_t last) const
+{
+  const std::size_t page = ::sysconf(_SC_PAGESIZE);
+  while (first < last) {
+    const std::size_t segment = Segment(first);
+    const std::size_t end = std::min(last, 2 * Capacity(segment) - Capacity(0));
+    char* const data = segments_[segment].load(std::memory_order_relaxed);
+    std::size_t from = (first + Capacity(0) - Capacity(segment)) * element_size_;
+    const std::size_t to = (end + Capacity(0) - Capacity(segment)) * element_size_;
+    from -= from % page;
+    if (::msync(data + from, to - from, MS_SYNC) != 0) {
+      throw std::system_error(errno, std::generic_category(), "msync");
+    }
+    first = end;
+  }
+}
+
+inline std::size_t MappedFile::Segment(std::size_t idx) const
+{
+  const std::size_t n = idx + Capacity(0);
+  const std::size_t msb = 63 - __builtin_clzll(n);
+  return msb - first_bits_;
+}
+
+inline std::size_t MappedFile::Offset(std::size_t segment) const
+{
+  std::size_t offset = kBlock;
+  for (std::size_t s = 0; s < segment; ++s) {
+    offset += Bytes(s);
+  }
+  return offset;
+}
+
+inline void MappedFile::Map(std::size_t segment)
+{
+  void* data = ::mmap(nullptr, Bytes(segment), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_NORESERVE, fd_, Offset(segment));
+  if (data == MAP_FAILED) {
+    throw std::system_error(errno, std::generic_category(), "mmap");
+  }
+  segments_[segment].store(static_cast<char*>(data), std::memory_order_release);
+  ++mapped_;
+}
+
+inline void MappedFile::Close()
+{
+  for (std::size_t segment = 0; segment < mapped_; ++segment) {
+    ::munmap(segments_[segment].load(std::memory_order_relaxed), Bytes(segment));
+  }
+  if (header_) {
+    ::munmap(header_, kBlock);
+  }
+  ::close(fd_);
+}
+
+}
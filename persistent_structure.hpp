@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 namespace pdc {
 
 /*! \brief Interface for persistent data structure.
@@ -21,6 +23,33 @@ public:
    * \return Next version of the structure.
    */
   virtual Derived Redo() const = 0;
+
+  /*! \brief Returns the version of the structure with the given number.
+   *
+   * \param version Number of the version, less than VersionCount().
+   * \return The version of the structure.
+   * \exception std::out_of_range If the version does not exist or is released.
+   */
+  virtual Derived AtVersion(std::size_t version) const = 0;
+
+  /*! \brief Returns the latest version of the structure.
+   *
+   * \return The version with the largest number.
+   */
+  virtual Derived Latest() const = 0;
+
+  /*! \brief Count of versions of the structure.
+   *
+   * Versions are numbered from 0 in the order they are made.
+   * \return Count of versions, released ones included.
+   */
+  virtual std::size_t VersionCount() const = 0;
+
+  /*! \brief Number of this version.
+   *
+   * \return Number of the version, AtVersion() returns it back.
+   */
+  virtual std::size_t GetVersion() const = 0;
 };
 
 } // namespace pdc
\ No newline at end of file
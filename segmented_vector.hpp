@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+
+namespace internal {
+
+/* Append-only vector with stable addresses of elements.
+ *
+ * Elements are stored in segments of geometrically growing capacity, so growing
+ * never moves constructed elements. One writer appends at a time, readers may
+ * access published elements without locking. */
+template <typename T, typename Allocator = std::allocator<T>>
+class SegmentedVector {
+  using Traits = std::allocator_traits<Allocator>;
+  static constexpr std::size_t kFirstSegmentBits = 4;
+  static constexpr std::size_t kSegments = 64 - kFirstSegmentBits;
+  std::atomic<T*> segments_[kSegments] = {};
+  std::atomic<std::size_t> size_{0};
+  Allocator alloc_;
+public:
+  explicit SegmentedVector(const Allocator& alloc = Allocator()) : alloc_(alloc) { }
+  SegmentedVector(const SegmentedVector&) = delete;
+  SegmentedVector& operator=(const SegmentedVector&) = delete;
+  ~SegmentedVector();
+  Allocator GetAllocator() const { return alloc_; }
+  std::size_t Size() const { return size_.load(std::memory_order_acquire); }
+  const T& operator[](std::size_t idx) const { return *Locate(idx); }
+  T& operator[](std::size_t idx) { return *Locate(idx); }
+  void Reserve(std::size_t count);
+  template <typename... Args>
+  T& EmplaceBack(Args&&... args);
+  void PopBack();
+  template <typename Visitor>
+  void ForEach(std::size_t first, std::size_t last, Visitor&& visit) const;
+private:
+  static std::size_t Segment(std::size_t idx);
+  static std::size_t Offset(std::size_t idx, std::size_t segment)
+    { return idx + (std::size_t(1) << kFirstSegmentBits) - Capacity(segment); }
+  static std::size_t Capacity(std::size_t segment)
+    { return std::size_t(1) << (segment + kFirstSegmentBits); }
+  T* Locate(std::size_t idx) const;
+  T* Allocate(std::size_t segment);
+};
+
+template <typename T, typename Allocator>
+SegmentedVector<T, Allocator>::~SegmentedVector()
+{
+  const std::size_t size = size_.load(std::memory_order_relaxed);
+  for (std::size_t idx = 0; idx < size; ++idx) {
+    Locate(idx)->~T();
+  }
+  for (std::size_t segment = 0; segment < kSegments; ++segment) {
+    T* data = segments_[segment].load(std::memory_order_relaxed);
+    if (data) {
+      Traits::deallocate(alloc_, data, Capacity(segment));
+    }
+  }
+}
+
+template <typename T, typename Allocator>
+void SegmentedVector<T, Allocator>::Reserve(std::size_t count)
+{
+  if (count == 0) {
+    return;
+  }
+  for (std::size_t segment = 0; segment <= Segment(count - 1); ++segment) {
+    if (!segments_[segment].load(std::memory_order_relaxed)) {
+      Allocate(segment);
+    }
+  }
+}
+
+template <typename T, typename Allocator>
+template <typename... Args>
+T& SegmentedVector<T, Allocator>::EmplaceBack(Args&&... args)
+{
+  const std::size_t idx = size_.load(std::memory_order_relaxed);
+  const std::size_t segment = Segment(idx);
+  T* data = segments_[segment].load(std::memory_order_relaxed);
+  if (!data) {
+    data = Allocate(segment);
+  }
+  T* item = new (data + Offset(idx, segment)) T(std::forward<Args>(args)...);
+  size_.store(idx + 1, std::memory_order_release);
+  return *item;
+}
+
+/* Destroys the last element, which must not be visible to readers yet, so
+ * a failed modification can drop the elements it appended. */
+template <typename T, typename Allocator>
+void SegmentedVector<T, Allocator>::PopBack()
+{
+  const std::size_t idx = size_.load(std::memory_order_relaxed) - 1;
+  Locate(idx)->~T();
+  size_.store(idx, std::memory_order_release);
+}
+
+/* Visits the published elements [first, last) in order, a segment at a time,
+ * so the segment of every element is not located anew. */
+template <typename T, typename Allocator>
+template <typename Visitor>
+void SegmentedVector<T, Allocator>::ForEach(std::size_t first, std::size_t last, Visitor&& visit) const
+{
+  while (first < last) {
+    const std::size_t segment = Segment(first);
+    const T* data = segments_[segment].load(std::memory_order_acquire);
+    const std::size_t end = std::min(last, 2 * Capacity(segment) - (std::size_t(1) << kFirstSegmentBits));
+    for (const T* item = data + Offset(first, segment); first < end; ++first) {
+      visit(*item++);
+    }
+  }
+}
+
+template <typename T, typename Allocator>
+std::size_t SegmentedVector<T, Allocator>::Segment(std::size_t idx)
+{
+  const std::size_t n = idx + (std::size_t(1) << kFirstSegmentBits);
+  const std::size_t msb = 63 - __builtin_clzll(n);
+  return msb - kFirstSegmentBits;
+}
+
+template <typename T, typename Allocator>
+T* SegmentedVector<T, Allocator>::Locate(std::size_t idx) const
+{
+  const std::size_t segment = Segment(idx);
+  return segments_[segment].load(std::memory_order_acquire) + Offset(idx, segment);
+}
+
+template <typename T, typename Allocator>
+T* SegmentedVector<T, Allocator>::Allocate(std::size_t segment)
+{
+  T* data = Traits::allocate(alloc_, Capacity(segment));
+  segments_[segment].store(data, std::memory_order_release);
+  return data;
+}
+
+}
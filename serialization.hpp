@@ -0,0 +1,440 @@
+#pragma once
+
+#include "fat_nodes.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef PDC_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace pdc {
+
+/*! \brief Compression of serialized containers. */
+enum class Compression {
+  None, /*!< Data is written as is. */
+  Zlib  /*!< Every block is compressed by zlib, requires PDC_WITH_ZLIB to be
+             defined and the program to be linked with zlib. */
+};
+
+} // namespace pdc
+
+
+namespace internal {
+
+/* Kinds of serialized data. A snapshot is a flat sequence of values, it is
+ * loaded by any container. */
+enum class Format : char {
+  Snapshot = 's',
+  ArrayHistory = 'a',
+  ListHistory = 'l'
+};
+
+/* Stream of serialized data.
+ *
+ * The stream starts with "pdc", the format, the format revision and the
+ * compression, then the data follows in blocks: the size of the data, the
+ * stored size and the stored bytes. A block whose stored size equals the size
+ * of the data is not compressed, an empty block ends the stream. Integers are
+ * written as varints, values of trivially copyable types as their bytes, so
+ * large arrays of values are copied to the stream at once. */
+class Writer {
+  static constexpr std::size_t kBlock = std::size_t(1) << 18;
+  static constexpr std::size_t kMaxVarint = 10;
+  std::ostream& out_;
+  pdc::Compression compression_;
+  std::vector<char> buffer_;
+  std::vector<char> packed_;
+  std::size_t used_ = 0;
+public:
+  Writer(std::ostream& out, Format format, pdc::Compression compression);
+  void WriteVarint(std::uint64_t value);
+  void WriteBytes(const void* data, std::size_t size);
+  template <typename T>
+  void Write(const T& value);
+  void Write(const std::string& value);
+  template <typename T>
+  void WriteValues(const T* values, std::size_t count);
+  void Finish();
+private:
+  void Flush();
+  void Put(const char* data, std::size_t size);
+  void PutVarint(std::uint64_t value);
+};
+
+class Reader {
+  static constexpr std::size_t kBlock = std::size_t(1) << 18;
+  static constexpr std::size_t kMaxVarint = 10;
+  std::istream& in_;
+  Format format_;
+  std::vector<char> buffer_;
+  std::vector<char> packed_;
+  std::size_t used_ = 0;
+  std::size_t size_ = 0;
+public:
+  explicit Reader(std::istream& in);
+  Format GetFormat() const { return format_; }
+  std::uint64_t ReadVarint();
+  void ReadBytes(void* data, std::size_t size);
+  template <typename T>
+  void Read(T& value);
+  void Read(std::string& value);
+  template <typename T>
+  void ReadValues(T* values, std::size_t count);
+  void Finish();
+private:
+  bool Fill();
+  void Get(char* data, std::size_t size);
+  std::uint64_t GetVarint();
+};
+
+[[noreturn]] inline void Corrupted()
+{
+  throw std::runtime_error("Corrupted data");
+}
+
+inline Writer::Writer(std::ostream& out, Format format, pdc::Compression compression)
+  : out_(out), compression_(compression), buffer_(kBlock)
+{
+#ifndef PDC_WITH_ZLIB
+  if (compression != pdc::Compression::None) {
+    throw std::invalid_argument("Compression is not supported");
+  }
+#endif
+  const char header[] = {'p', 'd', 'c', static_cast<char>(format), 1,
+                         static_cast<char>(compression)};
+  Put(header, sizeof(header));
+}
+
+inline void Writer::WriteVarint(std::uint64_t value)
+{
+  if (buffer_.size() - used_ < kMaxVarint) {
+    Flush();
+  }
+  char* out = buffer_.data() + used_;
+  while (value >= 0x80) {
+    *out++ = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<char>(value);
+  used_ = out - buffer_.data();
+}
+
+inline void Writer::WriteBytes(const void* data, std::size_t size)
+{
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    if (used_ == buffer_.size()) {
+      Flush();
+    }
+    const std::size_t count = std::min(size, buffer_.size() - used_);
+    std::memcpy(buffer_.data() + used_, bytes, count);
+    used_ += count;
+    bytes += count;
+    size -= count;
+  }
+}
+
+template <typename T>
+void Writer::Write(const T& value)
+{
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Serialization requires a trivially copyable type or std::string");
+  WriteBytes(&value, sizeof(T));
+}
+
+inline void Writer::Write(const std::string& value)
+{
+  WriteVarint(value.size());
+  WriteBytes(value.data(), value.size());
+}
+
+template <typename T>
+void Writer::WriteValues(const T* values, std::size_t count)
+{
+  if constexpr (std::is_trivially_copyable<T>::value) {
+    WriteBytes(values, count * sizeof(T));
+  } else {
+    for (std::size_t i = 0; i < count; ++i) {
+      Write(values[i]);
+    }
+  }
+}
+
+inline void Writer::Finish()
+{
+  Flush();
+  PutVarint(0);
+  out_.flush();
+  if (!out_) {
+    throw std::runtime_error("Write failed");
+  }
+}
+
+/* A block which does not shrink is stored uncompressed, so incompressible
+ * data costs only the block header. */
+inline void Writer::Flush()
+{
+  if (used_ == 0) {
+    return;
+  }
+  const char* stored = buffer_.data();
+  std::size_t stored_size = used_;
+#ifdef PDC_WITH_ZLIB
+  if (compression_ == pdc::Compression::Zlib) {
+    uLongf size = compressBound(used_);
+    packed_.resize(size);
+    if (compress2(reinterpret_cast<Bytef*>(packed_.data()), &size,
+                  reinterpret_cast<const Bytef*>(buffer_.data()), used_,
+                  Z_BEST_SPEED) != Z_OK) {
+      throw std::runtime_error("Compression failed");
+    }
+    if (size < used_) {
+      stored = packed_.data();
+      stored_size = size;
+    }
+  }
+#endif
+  PutVarint(used_);
+  PutVarint(stored_size);
+  Put(stored, stored_size);
+  used_ = 0;
+}
+
+inline void Writer::Put(const char* data, std::size_t size)
+{
+  if (!out_.write(data, size)) {
+    throw std::runtime_error("Write failed");
+  }
+}
+
+inline void Writer::PutVarint(std::uint64_t value)
+{
+  char bytes[kMaxVarint];
+  std::size_t size = 0;
+  while (value >= 0x80) {
+    bytes[size++] = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  bytes[size++] = static_cast<char>(value);
+  Put(bytes, size);
+}
+
+inline Reader::Reader(std::istream& in)
+  : in_(in), buffer_(kBlock)
+{
+  char header[6];
+  Get(header, sizeof(header));
+  if (std::memcmp(header, "pdc", 3) != 0 || header[4] != 1) {
+    throw std::runtime_error("Not a serialized container");
+  }
+  format_ = static_cast<Format>(header[3]);
+}
+
+/* Varints which are whole in the block are decoded in place. */
+inline std::uint64_t Reader::ReadVarint()
+{
+  if (size_ - used_ < kMaxVarint) {
+    std::uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      unsigned char byte;
+      ReadBytes(&byte, 1);
+      value |= std::uint64_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+    Corrupted();
+  }
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(buffer_.data()) + used_;
+  std::uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    const unsigned char byte = *in++;
+    value |= std::uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      used_ = in - reinterpret_cast<const unsigned char*>(buffer_.data());
+      return value;
+    }
+  }
+  Corrupted();
+}
+
+inline void Reader::ReadBytes(void* data, std::size_t size)
+{
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    if (used_ == size_ && !Fill()) {
+      Corrupted();
+    }
+    const std::size_t count = std::min(size, size_ - used_);
+    std::memcpy(bytes, buffer_.data() + used_, count);
+    used_ += count;
+    bytes += count;
+    size -= count;
+  }
+}
+
+template <typename T>
+void Reader::Read(T& value)
+{
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Serialization requires a trivially copyable type or std::string");
+  ReadBytes(&value, sizeof(T));
+}
+
+/* The length is not trusted, the string grows by blocks as they are read. */
+inline void Reader::Read(std::string& value)
+{
+  const std::uint64_t size = ReadVarint();
+  value.clear();
+  while (value.size() < size) {
+    const std::size_t read = value.size();
+    value.resize(read + std::min<std::uint64_t>(size - read, kBlock));
+    ReadBytes(&value[read], value.size() - read);
+  }
+}
+
+template <typename T>
+void Reader::ReadValues(T* values, std::size_t count)
+{
+  if constexpr (std::is_trivially_copyable<T>::value) {
+    ReadBytes(values, count * sizeof(T));
+  } else {
+    for (std::size_t i = 0; i < count; ++i) {
+      Read(values[i]);
+    }
+  }
+}
+
+/* All data must be read and followed by the end of the stream. */
+inline void Reader::Finish()
+{
+  if (used_ != size_ || Fill()) {
+    Corrupted();
+  }
+}
+
+/* Reads the next block, returns false at the end of the stream. */
+inline bool Reader::Fill()
+{
+  const std::uint64_t size = GetVarint();
+  if (size == 0) {
+    return false;
+  }
+  const std::uint64_t stored_size = GetVarint();
+  if (size > kBlock || stored_size > size) {
+    Corrupted();
+  }
+  if (stored_size == size) {
+    Get(buffer_.data(), size);
+  } else {
+#ifdef PDC_WITH_ZLIB
+    packed_.resize(stored_size);
+    Get(packed_.data(), stored_size);
+    uLongf unpacked = size;
+    if (uncompress(reinterpret_cast<Bytef*>(buffer_.data()), &unpacked,
+                   reinterpret_cast<const Bytef*>(packed_.data()), stored_size) != Z_OK ||
+        unpacked != size) {
+      Corrupted();
+    }
+#else
+    throw std::runtime_error("Compression is not supported");
+#endif
+  }
+  used_ = 0;
+  size_ = size;
+  return true;
+}
+
+inline void Reader::Get(char* data, std::size_t size)
+{
+  if (!in_.read(data, size)) {
+    Corrupted();
+  }
+}
+
+inline std::uint64_t Reader::GetVarint()
+{
+  std::uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    char byte;
+    Get(&byte, 1);
+    value |= std::uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  Corrupted();
+}
+
+/* Writes the nodes of the history from the one visible in the version. Every
+ * node is a varint of the version delta, the deleted flag and the flag of a
+ * following node, then the value unless the node is deleted. */
+template <typename T, typename Allocator>
+void WriteHistory(Writer& out, const FatNodes<T, Allocator>& nodes, std::size_t from)
+{
+  std::size_t last = 0;
+  std::size_t version = 0;
+  const T* value = nullptr;
+  bool pending = false;
+  const auto write = [&](bool more) {
+    out.WriteVarint(std::uint64_t(version - last) << 2 | (value ? 0 : 2) | more);
+    if (value) {
+      out.Write(*value);
+    }
+    last = version;
+  };
+  nodes.ForEach(from, [&](std::size_t node_version, const T* node_value) {
+    if (pending) {
+      write(true);
+    }
+    version = node_version;
+    value = node_value;
+    pending = true;
+  });
+  write(false);
+}
+
+/* Reads a history written by WriteHistory(), create(version, value) builds
+ * the item of the first node and returns it, later nodes are added to it.
+ * The versions of the nodes must increase and must not exceed max_version. */
+template <typename T, typename Allocator, typename Create>
+void ReadHistory(Reader& in, std::size_t max_version, Create create)
+{
+  FatNodes<T, Allocator>* nodes = nullptr;
+  std::size_t version = 0;
+  for (bool more = true; more; ) {
+    const std::uint64_t word = in.ReadVarint();
+    if ((nodes && (word >> 2) == 0) || (word >> 2) > max_version - version) {
+      Corrupted();
+    }
+    version += word >> 2;
+    more = word & 1;
+    if (word & 2) {
+      if (!nodes) {
+        nodes = &create(version, T());
+      }
+      nodes->Remove(version);
+      continue;
+    }
+    T value;
+    in.Read(value);
+    if (!nodes) {
+      nodes = &create(version, std::move(value));
+    } else {
+      nodes->Add(version, std::move(value));
+    }
+  }
+}
+
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PDC_X86_KERNELS 1
+#endif
+
+#if defined(__GNUC__)
+#define PDC_INLINE inline __attribute__((always_inline))
+#else
+#define PDC_INLINE inline
+#endif
+
+namespace internal {
+
+/* Reduction kernels over contiguous values.
+ *
+ * The kernels are written once with GCC vector extensions and compiled for
+ * several instruction sets: on x86 a kernel has AVX2 and AVX-512 variants
+ * selected at run time by the features of the CPU, the baseline variant uses
+ * 16-byte vectors (SSE2 on x86-64, NEON on ARM). Other compilers get scalar
+ * loops. Floating point sums are added in lanes, so the rounding depends on
+ * the selected variant. */
+enum class Isa { Scalar, Avx2, Avx512 };
+
+/* Most capable instruction set of the CPU, detected once. */
+inline Isa CpuIsa()
+{
+#ifdef PDC_X86_KERNELS
+  static const Isa isa = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512dq")) {
+      return Isa::Avx512;
+    }
+    return __builtin_cpu_supports("avx2") ? Isa::Avx2 : Isa::Scalar;
+  }();
+  return isa;
+#else
+  return Isa::Scalar;
+#endif
+}
+
+/* Types which vector extensions accept as lanes. */
+template <typename T>
+constexpr bool kVectorizable = std::is_arithmetic<T>::value && !std::is_same<T, bool>::value
+                               && !std::is_same<T, long double>::value;
+
+#if defined(__GNUC__)
+
+template <typename T, std::size_t kBytes>
+struct Lanes {
+  typedef T Vector __attribute__((vector_size(kBytes)));
+  static constexpr std::size_t kCount = kBytes / sizeof(T);
+  static PDC_INLINE void Load(Vector& v, const T* data) { std::memcpy(&v, data, sizeof(v)); }
+};
+
+/* Four accumulators hide the latency of floating point additions. */
+template <typename T, std::size_t kBytes>
+PDC_INLINE T SumLanes(const T* data, std::size_t count)
+{
+  using L = Lanes<T, kBytes>;
+  typename L::Vector acc[4] = {};
+  std::size_t i = 0;
+  typename L::Vector v;
+  for (; i + 4 * L::kCount <= count; i += 4 * L::kCount) {
+    for (std::size_t k = 0; k < 4; ++k) {
+      L::Load(v, data + i + k * L::kCount);
+      acc[k] += v;
+    }
+  }
+  for (; i + L::kCount <= count; i += L::kCount) {
+    L::Load(v, data + i);
+    acc[0] += v;
+  }
+  acc[0] += acc[1] + acc[2] + acc[3];
+  T sum = T();
+  for (std::size_t k = 0; k < L::kCount; ++k) {
+    sum += acc[0][k];
+  }
+  for (; i < count; ++i) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+/* Expects min and max set to a value of the range. */
+template <typename T, std::size_t kBytes>
+PDC_INLINE void MinMaxLanes(const T* data, std::size_t count, T& min, T& max)
+{
+  using L = Lanes<T, kBytes>;
+  typename L::Vector lo = typename L::Vector{} + min;
+  typename L::Vector hi = typename L::Vector{} + max;
+  std::size_t i = 0;
+  typename L::Vector v;
+  for (; i + L::kCount <= count; i += L::kCount) {
+    L::Load(v, data + i);
+    lo = v < lo ? v : lo;
+    hi = v > hi ? v : hi;
+  }
+  for (std::size_t k = 0; k < L::kCount; ++k) {
+    min = lo[k] < min ? lo[k] : min;
+    max = hi[k] > max ? hi[k] : max;
+  }
+  for (; i < count; ++i) {
+    min = data[i] < min ? data[i] : min;
+    max = data[i] > max ? data[i] : max;
+  }
+}
+
+#endif
+
+/* Left to the auto-vectorizer, which sees the predicate after inlining. */
+template <typename T, typename Predicate>
+PDC_INLINE std::size_t CountIfLoop(const T* data, std::size_t count, Predicate& pred)
+{
+  std::size_t result = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    result += pred(data[i]) ? 1 : 0;
+  }
+  return result;
+}
+
+#ifdef PDC_X86_KERNELS
+
+template <typename T>
+__attribute__((target("avx2"))) T SumAvx2(const T* data, std::size_t count)
+  { return SumLanes<T, 32>(data, count); }
+
+template <typename T>
+__attribute__((target("avx512f,avx512bw,avx512dq"))) T SumAvx512(const T* data, std::size_t count)
+  { return SumLanes<T, 64>(data, count); }
+
+template <typename T>
+__attribute__((target("avx2"))) void MinMaxAvx2(const T* data, std::size_t count, T& min, T& max)
+  { MinMaxLanes<T, 32>(data, count, min, max); }
+
+template <typename T>
+__attribute__((target("avx512f,avx512bw,avx512dq")))
+void MinMaxAvx512(const T* data, std::size_t count, T& min, T& max)
+  { MinMaxLanes<T, 64>(data, count, min, max); }
+
+template <typename T, typename Predicate>
+__attribute__((target("avx2"))) std::size_t CountIfAvx2(const T* data, std::size_t count, Predicate& pred)
+  { return CountIfLoop(data, count, pred); }
+
+template <typename T, typename Predicate>
+__attribute__((target("avx512f,avx512bw,avx512dq")))
+std::size_t CountIfAvx512(const T* data, std::size_t count, Predicate& pred)
+  { return CountIfLoop(data, count, pred); }
+
+#endif
+
+/* The instruction set must be supported by the CPU, see CpuIsa(). */
+template <typename T>
+T Sum(const T* data, std::size_t count, Isa isa = CpuIsa())
+{
+#ifdef PDC_X86_KERNELS
+  if constexpr (kVectorizable<T>) {
+    if (isa == Isa::Avx512) {
+      return SumAvx512(data, count);
+    }
+    if (isa == Isa::Avx2) {
+      return SumAvx2(data, count);
+    }
+  }
+#endif
+  (void)isa;
+#if defined(__GNUC__)
+  if constexpr (kVectorizable<T>) {
+    return SumLanes<T, 16>(data, count);
+  }
+#endif
+  T sum = T();
+  for (std::size_t i = 0; i < count; ++i) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+/* Extends [min, max] by the values. */
+template <typename T>
+void MinMax(const T* data, std::size_t count, T& min, T& max, Isa isa = CpuIsa())
+{
+#ifdef PDC_X86_KERNELS
+  if constexpr (kVectorizable<T>) {
+    if (isa == Isa::Avx512) {
+      return MinMaxAvx512(data, count, min, max);
+    }
+    if (isa == Isa::Avx2) {
+      return MinMaxAvx2(data, count, min, max);
+    }
+  }
+#endif
+  (void)isa;
+#if defined(__GNUC__)
+  if constexpr (kVectorizable<T>) {
+    return MinMaxLanes<T, 16>(data, count, min, max);
+  }
+#endif
+  for (std::size_t i = 0; i < count; ++i) {
+    min = data[i] < min ? data[i] : min;
+    max = data[i] > max ? data[i] : max;
+  }
+}
+
+template <typename T, typename Predicate>
+std::size_t CountIf(const T* data, std::size_t count, Predicate& pred, Isa isa = CpuIsa())
+{
+#ifdef PDC_X86_KERNELS
+  if (isa == Isa::Avx512) {
+    return CountIfAvx512(data, count, pred);
+  }
+  if (isa == Isa::Avx2) {
+    return CountIfAvx2(data, count, pred);
+  }
+#endif
+  (void)isa;
+  return CountIfLoop(data, count, pred);
+}
+
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+
+
+namespace internal {
+
+/* Append-only vector which releases its oldest elements.
+ *
+ * Elements are stored in blocks of a fixed size found through a ring of block
+ * pointers, so Release() frees the blocks below an index and the memory taken
+ * follows the count of kept elements, not of all elements ever appended.
+ * Indices of elements never change and growing never moves them. One writer
+ * appends and releases at a time, readers may access published elements
+ * which are not released without locking.
+ *
+ * A full ring is replaced by one of twice the size. Readers may still pass
+ * the old ring, so it is kept until the vector is destroyed; rings double, so
+ * the old ones take less than the latest one. */
+template <typename T, typename Allocator = std::allocator<T>>
+class SlidingVector {
+  template <typename U>
+  using Rebind = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+  using Traits = std::allocator_traits<Allocator>;
+  using Slot = std::atomic<T*>;
+  static constexpr std::size_t kBlockBits = 6;
+  static constexpr std::size_t kBlock = std::size_t(1) << kBlockBits;
+  static constexpr std::size_t kFirstRing = 4;
+  struct Ring {
+    std::size_t mask;
+    Slot* blocks;
+    Ring* retired;
+  };
+  std::atomic<Ring*> ring_{nullptr};
+  std::atomic<std::size_t> size_{0};
+  std::size_t first_ = 0;
+  std::size_t blocks_end_ = 0;
+  Allocator alloc_;
+public:
+  explicit SlidingVector(const Allocator& alloc = Allocator()) : alloc_(alloc) { }
+  SlidingVector(const SlidingVector&) = delete;
+  SlidingVector& operator=(const SlidingVector&) = delete;
+  ~SlidingVector();
+  Allocator GetAllocator() const { return alloc_; }
+  std::size_t Size() const { return size_.load(std::memory_order_acquire); }
+  std::size_t First() const { return first_; }
+  const T& operator[](std::size_t idx) const { return *Locate(idx); }
+  T& operator[](std::size_t idx) { return *Locate(idx); }
+  template <typename... Args>
+  T& EmplaceBack(Args&&... args);
+  void PopBack();
+  void Release(std::size_t first);
+  void Rebase(std::size_t first);
+private:
+  T* Locate(std::size_t idx) const { return Block(idx >> kBlockBits) + (idx & (kBlock - 1)); }
+  T* Block(std::size_t block) const;
+  T* AddBlock();
+  void FreeBlocks(std::size_t from, std::size_t to);
+};
+
+template <typename T, typename Allocator>
+SlidingVector<T, Allocator>::~SlidingVector()
+{
+  Release(size_.load(std::memory_order_relaxed));
+  FreeBlocks(first_ >> kBlockBits, blocks_end_);
+  Ring* ring = ring_.load(std::memory_order_relaxed);
+  while (ring) {
+    Ring* retired = ring->retired;
+    Rebind<Slot> slots(alloc_);
+    std::allocator_traits<Rebind<Slot>>::deallocate(slots, ring->blocks, ring->mask + 1);
+    Rebind<Ring> rings(alloc_);
+    std::allocator_traits<Rebind<Ring>>::deallocate(rings, ring, 1);
+    ring = retired;
+  }
+}
+
+template <typename T, typename Allocator>
+template <typename... Args>
+T& SlidingVector<T, Allocator>::EmplaceBack(Args&&... args)
+{
+  const std::size_t idx = size_.load(std::memory_order_relaxed);
+  T* data = (idx >> kBlockBits) < blocks_end_ ? Block(idx >> kBlockBits) : AddBlock();
+  T* item = new (data + (idx & (kBlock - 1))) T(std::forward<Args>(args)...);
+  size_.store(idx + 1, std::memory_order_release);
+  return *item;
+}
+
+/* Destroys the last element, which must not be visible to readers yet. Its
+ * block is kept for the next element. */
+template <typename T, typename Allocator>
+void SlidingVector<T, Allocator>::PopBack()
+{
+  const std::size_t idx = size_.load(std::memory_order_relaxed) - 1;
+  Locate(idx)->~T();
+  size_.store(idx, std::memory_order_release);
+}
+
+/* Destroys the elements below the index and frees the blocks holding only
+ * such elements. The released elements must not be read any more. */
+template <typename T, typename Allocator>
+void SlidingVector<T, Allocator>::Release(std::size_t first)
+{
+  if (first <= first_) {
+    return;
+  }
+  for (std::size_t idx = first_; idx < first; ++idx) {
+    Locate(idx)->~T();
+  }
+  FreeBlocks(first_ >> kBlockBits, first >> kBlockBits);
+  first_ = first;
+}
+
+/* Drops all elements, the next element gets the index. Used while a history
+ * is restored, before the vector is read. */
+template <typename T, typename Allocator>
+void SlidingVector<T, Allocator>::Rebase(std::size_t first)
+{
+  Release(size_.load(std::memory_order_relaxed));
+  FreeBlocks(first_ >> kBlockBits, blocks_end_);
+  first_ = first;
+  blocks_end_ = first >> kBlockBits;
+  size_.store(first, std::memory_order_release);
+}
+
+template <typename T, typename Allocator>
+T* SlidingVector<T, Allocator>::Block(std::size_t block) const
+{
+  const Ring* ring = ring_.load(std::memory_order_acquire);
+  return ring->blocks[block & ring->mask].load(std::memory_order_acquire);
+}
+
+/* The ring is replaced before it would wrap onto a kept block, the new ring
+ * is filled before it is published. */
+template <typename T, typename Allocator>
+T* SlidingVector<T, Allocator>::AddBlock()
+{
+  Ring* ring = ring_.load(std::memory_order_relaxed);
+  const std::size_t first_block = first_ >> kBlockBits;
+  if (!ring || blocks_end_ - first_block > ring->mask) {
+    const std::size_t capacity = ring ? 2 * (ring->mask + 1) : kFirstRing;
+    Rebind<Ring> rings(alloc_);
+    Rebind<Slot> slots(alloc_);
+    Ring* grown = std::allocator_traits<Rebind<Ring>>::allocate(rings, 1);
+    grown->mask = capacity - 1;
+    grown->retired = ring;
+    try {
+      grown->blocks = std::allocator_traits<Rebind<Slot>>::allocate(slots, capacity);
+    } catch (...) {
+      std::allocator_traits<Rebind<Ring>>::deallocate(rings, grown, 1);
+      throw;
+    }
+    for (std::size_t i = 0; i < capacity; ++i) {
+      new (grown->blocks + i) Slot(nullptr);
+    }
+    for (std::size_t block = first_block; block < blocks_end_; ++block) {
+      grown->blocks[block & grown->mask].store(
+        ring->blocks[block & ring->mask].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    ring_.store(grown, std::memory_order_release);
+    ring = grown;
+  }
+  T* data = Traits::allocate(alloc_, kBlock);
+  ring->blocks[blocks_end_ & ring->mask].store(data, std::memory_order_release);
+  ++blocks_end_;
+  return data;
+}
+
+template <typename T, typename Allocator>
+void SlidingVector<T, Allocator>::FreeBlocks(std::size_t from, std::size_t to)
+{
+  Ring* ring = ring_.load(std::memory_order_relaxed);
+  for (std::size_t block = from; block < to && block < blocks_end_; ++block) {
+    Traits::deallocate(alloc_, ring->blocks[block & ring->mask].load(std::memory_order_relaxed), kBlock);
+    ring->blocks[block & ring->mask].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+}
@@ -1,9 +1,32 @@
 #include <CppUTest/TestHarness.h>
 
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <map>
+#include <numeric>
+#include <unordered_map>
+#include <random>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
 
 #include "../array.hpp"
+#include "../deque.hpp"
+#include "../hash_map.hpp"
+#include "../mapped_array.hpp"
 #include "../list.hpp"
+#include "../map.hpp"
+#include "../vector.hpp"
+#include "../version_arena.hpp"
 
 
 TEST_GROUP(Array)
@@ -148,6 +171,1018 @@ TEST(Array, Redo)
   LONGS_EQUAL(1, array[1]);
 }
 
+TEST(Array, Batch)
+{
+  pdc::Array<int> array(2, 0);
+  const auto array2 = array.Batch()
+    .Update(0, 1)
+    .PushBack(2)
+    .Update(2, 3)
+    .Update(0, 4)
+    .Commit();
+  UNSIGNED_LONGS_EQUAL(3, array2.Size());
+  LONGS_EQUAL(4, array2[0]);
+  LONGS_EQUAL(0, array2[1]);
+  LONGS_EQUAL(3, array2[2]);
+
+  const auto array3 = array2.Undo();
+  UNSIGNED_LONGS_EQUAL(2, array3.Size());
+  LONGS_EQUAL(0, array3[0]);
+
+  CHECK_THROWS(std::out_of_range, array2.Batch().Update(3, 0));
+  CHECK_THROWS(pdc::IncorrectVersionException, array.Batch().PushBack(0).Commit());
+
+  auto changes = array2.Batch();
+  for (int i = 0; i < 1000; ++i) {
+    changes.PushBack(i);
+  }
+  const auto array4 = changes.Commit();
+  UNSIGNED_LONGS_EQUAL(1003, array4.Size());
+  LONGS_EQUAL(999, array4[1002]);
+  UNSIGNED_LONGS_EQUAL(3, array4.Undo().Size());
+}
+
+/* Value whose copies and moves throw while armed if it is negative, so a
+ * modification can fail after it changed some of the elements. A move
+ * empties its source, so values lost to a failed write read as zero. */
+struct Fragile {
+  static bool armed;
+  int value;
+  Fragile(int v = 0) : value(v) { }
+  Fragile(const Fragile& other) : value(other.value) { Check(); }
+  Fragile(Fragile&& other) : value(other.value) { Check(); other.value = 0; }
+  Fragile& operator=(const Fragile& other) { other.Check(); value = other.value; return *this; }
+  Fragile& operator=(Fragile&& other)
+    { other.Check(); value = other.value; other.value = 0; return *this; }
+  void Check() const { if (armed && value < 0) throw std::runtime_error("Move"); }
+};
+bool Fragile::armed = false;
+
+TEST(Array, FailedWrite)
+{
+  pdc::Array<Fragile> array(3);
+  auto changes = array.Batch().Update(1, 200).Update(2, -1).PushBack(5).PushBack(-2);
+  Fragile::armed = true;
+  CHECK_THROWS(std::runtime_error, changes.Commit());
+  CHECK_THROWS(std::runtime_error, array.Update(0, -3));
+  CHECK_THROWS(std::runtime_error, array.PushBack(-4));
+  Fragile::armed = false;
+  UNSIGNED_LONGS_EQUAL(1, array.VersionCount());
+  UNSIGNED_LONGS_EQUAL(3, array.Size());
+
+  const auto array2 = array.Update(2, 7);
+  LONGS_EQUAL(0, array2[0].value);
+  LONGS_EQUAL(0, array2[1].value);
+  LONGS_EQUAL(7, array2[2].value);
+  UNSIGNED_LONGS_EQUAL(1, array.Diff(array2).size());
+  UNSIGNED_LONGS_EQUAL(1, array.Feed(array2).Size());
+
+  const auto array3 = array2.Batch().Update(1, 1).PushBack(2).Commit();
+  UNSIGNED_LONGS_EQUAL(4, array3.Size());
+  LONGS_EQUAL(1, array3[1].value);
+  LONGS_EQUAL(2, array3[3].value);
+  UNSIGNED_LONGS_EQUAL(3, array2.Size());
+  UNSIGNED_LONGS_EQUAL(2, array2.Diff(array3).size());
+}
+
+TEST(Array, FailedWriteEmptiedChunk)
+{
+  pdc::Array<Fragile> array(2);
+  array = array.Update(0, 1).Update(0, 2);
+  // The batch starts a new chunk of the history of element 0, the failed
+  // value of element 1 rolls the version back and leaves the chunk empty.
+  auto changes = array.Batch().Update(0, 3).Update(1, -1);
+  Fragile::armed = true;
+  CHECK_THROWS(std::runtime_error, changes.Commit());
+  Fragile::armed = false;
+  array = array.Update(1, 5).Update(0, 4);
+
+  UNSIGNED_LONGS_EQUAL(5, array.VersionCount());
+  LONGS_EQUAL(2, array.AtVersion(3)[0].value);
+  LONGS_EQUAL(5, array.AtVersion(3)[1].value);
+  LONGS_EQUAL(4, array.AtVersion(4)[0].value);
+  LONGS_EQUAL(1, array.AtVersion(1)[0].value);
+  CHECK(std::vector<std::size_t>({0}) == array.AtVersion(3).Diff(array));
+
+  array.AtVersion(3).Compact();
+  LONGS_EQUAL(2, array.AtVersion(3)[0].value);
+  LONGS_EQUAL(4, array[0].value);
+}
+
+TEST(Array, FailedWriteEmptiedChunks)
+{
+  pdc::Array<Fragile> array(2);
+  array = array.Update(0, 1).Update(0, 2);
+  auto changes = array.Batch().Update(0, 3).Update(1, -1);
+  Fragile::armed = true;
+  CHECK_THROWS(std::runtime_error, changes.Commit());
+  Fragile::armed = false;
+  array = array.Update(1, 5);
+  // The second failed version starts another chunk of element 0, which is
+  // emptied on top of the first one.
+  auto changes2 = array.Batch().Update(0, 6).Update(1, -1);
+  Fragile::armed = true;
+  CHECK_THROWS(std::runtime_error, changes2.Commit());
+  Fragile::armed = false;
+
+  const auto merged = array.Undo().Batch().Update(0, 7).Merge();
+  UNSIGNED_LONGS_EQUAL(4, merged.GetVersion());
+  LONGS_EQUAL(7, merged[0].value);
+  LONGS_EQUAL(5, merged[1].value);
+  LONGS_EQUAL(2, merged.AtVersion(3)[0].value);
+  LONGS_EQUAL(2, merged.AtVersion(2)[0].value);
+  CHECK_THROWS(pdc::ConflictException, array.Undo().Batch().Update(0, 8).Merge());
+}
+
+/* Resource which counts the bytes in use and fails the allocation after
+ * the given count of successful ones. */
+struct TestResource : std::pmr::memory_resource {
+  std::size_t in_use = 0;
+  long fail_after = -1;
+  void* do_allocate(std::size_t bytes, std::size_t align) override
+  {
+    if (fail_after >= 0 && fail_after-- == 0) {
+      throw std::bad_alloc();
+    }
+    in_use += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, align);
+  }
+  void do_deallocate(void* p, std::size_t bytes, std::size_t align) override
+  {
+    in_use -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+  }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    { return this == &other; }
+};
+
+TEST(Array, FailedWriteSave)
+{
+  using PmrArray = pdc::Array<int, std::pmr::polymorphic_allocator<int>>;
+  TestResource resource;
+  PmrArray array(2, 0, &resource);
+  array = array.Update(0, 1).Update(0, 2);
+  // The batch starts a new chunk of the history of element 0, the chunk of
+  // element 1 fails and the rollback leaves the first one empty.
+  resource.fail_after = 1;
+  CHECK_THROWS(std::bad_alloc, array.Batch().Update(0, 3).Update(1, 4).Commit());
+  resource.fail_after = -1;
+
+  const auto check = [&resource](std::stringstream& stream, std::size_t versions) {
+    const auto loaded = PmrArray::Load(stream, &resource);
+    UNSIGNED_LONGS_EQUAL(versions, loaded.VersionCount());
+    LONGS_EQUAL(2, loaded.AtVersion(2)[0]);
+    LONGS_EQUAL(0, loaded.AtVersion(2)[1]);
+    LONGS_EQUAL(2, loaded.AtVersion(2).Sum());
+    return loaded;
+  };
+  std::stringstream stream;
+  array.Save(stream);
+  check(stream, 3);
+  array.Compact();
+  std::stringstream compacted;
+  array.Save(compacted);
+  check(compacted, 3);
+
+  const auto array2 = array.Update(0, 5);
+  std::stringstream updated;
+  array2.Save(updated);
+  const auto loaded = check(updated, 4);
+  LONGS_EQUAL(5, loaded[0]);
+  CHECK(std::vector<std::size_t>({0}) == loaded.Undo().Diff(loaded));
+}
+
+TEST(Array, Transient)
+{
+  pdc::Array<int> array(2, 0);
+  auto builder = array.Transient();
+  for (int i = 0; i < 1000; ++i) {
+    builder.PushBack(i);
+  }
+  builder.Update(0, 1).Update(0, 4).Update(500, -1);
+  UNSIGNED_LONGS_EQUAL(1002, builder.Size());
+  LONGS_EQUAL(4, builder[0]);
+  LONGS_EQUAL(0, builder[1]);
+  LONGS_EQUAL(-1, builder[500]);
+  LONGS_EQUAL(999, builder[1001]);
+  CHECK_THROWS(std::out_of_range, builder.Update(1002, 0));
+  UNSIGNED_LONGS_EQUAL(1, array.VersionCount());
+
+  const auto array2 = builder.Persistent();
+  UNSIGNED_LONGS_EQUAL(2, array2.VersionCount());
+  UNSIGNED_LONGS_EQUAL(1002, array2.Size());
+  LONGS_EQUAL(4, array2[0]);
+  LONGS_EQUAL(-1, array2[500]);
+  LONGS_EQUAL(999, array2[1001]);
+  UNSIGNED_LONGS_EQUAL(2, array2.Undo().Size());
+  LONGS_EQUAL(0, array2.Undo()[0]);
+  UNSIGNED_LONGS_EQUAL(1001, array.Diff(array2).size());
+
+  const auto array3 = builder.Update(1, 5).PushBack(7).Persistent();
+  LONGS_EQUAL(5, array3[1]);
+  LONGS_EQUAL(0, array2[1]);
+  UNSIGNED_LONGS_EQUAL(1003, array3.Size());
+
+  // Every builder commit makes one version with its own log entry and time.
+  const auto array4 = array3.Update(2, 9);
+  UNSIGNED_LONGS_EQUAL(4, array4.VersionCount());
+  CHECK(std::vector<std::size_t>({2}) == array3.Diff(array4));
+  CHECK(std::vector<std::size_t>({1, 1002}) == array2.Diff(array3));
+  std::vector<std::pair<std::size_t, std::size_t>> changes;
+  for (const auto& change : array2.Feed(array4)) {
+    changes.emplace_back(change.version, change.idx);
+  }
+  const std::vector<std::pair<std::size_t, std::size_t>> expected = {{2, 1}, {2, 1002}, {3, 2}};
+  CHECK(expected == changes);
+  UNSIGNED_LONGS_EQUAL(1001, array.Feed(array2).Size());
+  CHECK(array.GetTime() <= array2.GetTime());
+  CHECK(array2.GetTime() <= array3.GetTime());
+  CHECK(array3.GetTime() <= array4.GetTime());
+  UNSIGNED_LONGS_EQUAL(3, array4.AsOf(array4.GetTime()).GetVersion());
+
+  auto stale = array2.Transient();
+  CHECK_THROWS(pdc::IncorrectVersionException, stale.PushBack(0).Persistent());
+}
+
+TEST(Array, FailedTransient)
+{
+  const pdc::Array<Fragile> array(3);
+  auto builder = array.Transient();
+  builder.Update(0, 100).Update(1, 200).PushBack(5).PushBack(-2);
+  Fragile::armed = true;
+  CHECK_THROWS(std::runtime_error, builder.Persistent());
+  Fragile::armed = false;
+  UNSIGNED_LONGS_EQUAL(1, array.VersionCount());
+  LONGS_EQUAL(100, builder[0].value);
+  LONGS_EQUAL(-2, builder[4].value);
+
+  const auto built = builder.Persistent();
+  UNSIGNED_LONGS_EQUAL(5, built.Size());
+  LONGS_EQUAL(100, built[0].value);
+  LONGS_EQUAL(200, built[1].value);
+  LONGS_EQUAL(5, built[3].value);
+  LONGS_EQUAL(-2, built[4].value);
+  CHECK(std::vector<std::size_t>({0, 1, 3, 4}) == array.Diff(built));
+
+  const auto array2 = built.Transient().Update(2, 7).Persistent();
+  UNSIGNED_LONGS_EQUAL(5, array2.Size());
+  LONGS_EQUAL(100, array2[0].value);
+  LONGS_EQUAL(7, array2[2].value);
+  std::vector<std::size_t> diff = built.Diff(array2);
+  CHECK(std::vector<std::size_t>({2}) == diff);
+}
+
+TEST(Array, Merge)
+{
+  const pdc::Array<int> base(4, 0);
+  auto first = base.Batch().Update(0, 1).PushBack(10).Update(4, 11);
+  auto second = base.Batch().Update(1, 2).PushBack(20);
+  auto third = base.Batch().Update(0, 3);
+
+  const auto array = first.Merge();
+  const auto merged = second.Merge();
+  CHECK_THROWS(pdc::ConflictException, third.Merge());
+  CHECK_THROWS(pdc::IncorrectVersionException, base.Batch().Update(2, 1).Commit());
+
+  UNSIGNED_LONGS_EQUAL(6, merged.Size());
+  LONGS_EQUAL(1, merged[0]);
+  LONGS_EQUAL(2, merged[1]);
+  LONGS_EQUAL(11, merged[4]);
+  LONGS_EQUAL(20, merged[5]);
+  UNSIGNED_LONGS_EQUAL(5, array.Size());
+  LONGS_EQUAL(0, array[1]);
+  UNSIGNED_LONGS_EQUAL(6, merged.Redo().Size());
+
+  merged.Compact();
+  CHECK_THROWS(pdc::ConflictException, array.Batch().Update(3, 1).Merge());
+}
+
+TEST(Array, MergeReused)
+{
+  const pdc::Array<int> base(2, 0);
+  auto changes = base.Batch();
+  const auto array = changes.PushBack(7).Commit();
+  const auto array2 = array.PushBack(9);
+  const auto array3 = changes.Update(2, 8).Merge();
+
+  UNSIGNED_LONGS_EQUAL(3, array3.GetVersion());
+  UNSIGNED_LONGS_EQUAL(4, array3.Size());
+  LONGS_EQUAL(0, array3[0]);
+  LONGS_EQUAL(8, array3[2]);
+  LONGS_EQUAL(9, array3[3]);
+  CHECK(std::vector<std::size_t>({2}) == array2.Diff(array3));
+  UNSIGNED_LONGS_EQUAL(1, array2.Feed(array3).Size());
+
+  const auto array4 = changes.Update(3, 10).Commit();
+  UNSIGNED_LONGS_EQUAL(4, array4.Size());
+  LONGS_EQUAL(8, array4[2]);
+  LONGS_EQUAL(10, array4[3]);
+  CHECK(std::vector<std::size_t>({3}) == array3.Diff(array4));
+}
+
+TEST(Array, FailedMerge)
+{
+  const pdc::Array<Fragile> base(3);
+  auto changes = base.Batch().Update(1, -1).PushBack(-2);
+  const auto array = base.PushBack(9);
+  Fragile::armed = true;
+  CHECK_THROWS(std::runtime_error, changes.Merge());
+  Fragile::armed = false;
+  UNSIGNED_LONGS_EQUAL(2, base.VersionCount());
+
+  const auto array2 = array.Update(0, 4).PushBack(8);
+  const auto merged = changes.Merge();
+  UNSIGNED_LONGS_EQUAL(6, merged.Size());
+  LONGS_EQUAL(4, merged[0].value);
+  LONGS_EQUAL(-1, merged[1].value);
+  LONGS_EQUAL(9, merged[3].value);
+  LONGS_EQUAL(8, merged[4].value);
+  LONGS_EQUAL(-2, merged[5].value);
+  UNSIGNED_LONGS_EQUAL(5, array2.Size());
+}
+
+TEST(Array, FailedWriteMoveOnly)
+{
+  using PmrArray = pdc::Array<std::unique_ptr<int>, std::pmr::polymorphic_allocator<std::unique_ptr<int>>>;
+  TestResource resource;
+  const PmrArray array(2, &resource);
+  auto changes = array.Batch();
+  changes.Update(0, std::make_unique<int>(1)).Update(1, std::make_unique<int>(2));
+  changes.PushBack(std::make_unique<int>(3));
+  // Every allocation of the write fails once, the moved values are taken
+  // back from the dropped nodes for the next attempt.
+  PmrArray array2(&resource);
+  long failures = 0;
+  for (;; ++failures) {
+    resource.fail_after = failures;
+    try {
+      array2 = changes.Commit();
+      break;
+    } catch (const std::bad_alloc&) {
+      UNSIGNED_LONGS_EQUAL(1, array.VersionCount());
+    }
+  }
+  resource.fail_after = -1;
+  CHECK(failures > 0);
+  UNSIGNED_LONGS_EQUAL(3, array2.Size());
+  LONGS_EQUAL(1, *array2[0]);
+  LONGS_EQUAL(2, *array2[1]);
+  LONGS_EQUAL(3, *array2[2]);
+
+  // The history chunk of element 0 is full, so the builder allocates one.
+  auto builder = array2.Update(0, std::make_unique<int>(6)).Transient();
+  builder.Update(0, std::make_unique<int>(7)).Update(1, std::make_unique<int>(4));
+  builder.PushBack(std::make_unique<int>(5));
+  PmrArray array3(&resource);
+  for (failures = 0;; ++failures) {
+    resource.fail_after = failures;
+    try {
+      array3 = builder.Persistent();
+      break;
+    } catch (const std::bad_alloc&) {
+      UNSIGNED_LONGS_EQUAL(3, array.VersionCount());
+      LONGS_EQUAL(7, *builder[0]);
+      LONGS_EQUAL(5, *builder[3]);
+    }
+  }
+  resource.fail_after = -1;
+  CHECK(failures > 0);
+  UNSIGNED_LONGS_EQUAL(4, array3.Size());
+  LONGS_EQUAL(7, *array3[0]);
+  LONGS_EQUAL(4, *array3[1]);
+  LONGS_EQUAL(5, *array3[3]);
+}
+
+TEST(Array, MergeThreaded)
+{
+  const int kThreads = 4;
+  const int kUpdates = 500;
+  const pdc::Array<int> base(kThreads, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&base, t] {
+      auto array = base;
+      for (int i = 1; i <= kUpdates; ++i) {
+        array = array.Batch().Update(t, i).PushBack(t).Merge();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto latest = base;
+  for (int i = 0; i < kThreads * kUpdates; ++i) {
+    latest = latest.Redo();
+  }
+  UNSIGNED_LONGS_EQUAL(kThreads * (kUpdates + 1), latest.Size());
+  for (int t = 0; t < kThreads; ++t) {
+    LONGS_EQUAL(kUpdates, latest[t]);
+  }
+}
+
+TEST(Array, Feed)
+{
+  const pdc::Array<int> base(4, 0);
+  const auto array = base.Update(1, 1).Update(3, 2).PushBack(3);
+  const auto latest = array.Batch().Update(1, 4).Update(1, 5).PushBack(6).Update(0, 7).Commit();
+
+  std::vector<std::pair<std::size_t, std::size_t>> changes;
+  for (const auto& change : base.Feed(latest)) {
+    changes.emplace_back(change.version, change.idx);
+  }
+  const std::vector<std::pair<std::size_t, std::size_t>> expected =
+    {{1, 1}, {2, 3}, {3, 4}, {4, 1}, {4, 5}, {4, 0}};
+  CHECK(expected == changes);
+  UNSIGNED_LONGS_EQUAL(6, base.Feed(latest).Size());
+  UNSIGNED_LONGS_EQUAL(3, array.Feed(latest).Size());
+  UNSIGNED_LONGS_EQUAL(0, latest.Feed(base).Size());
+  CHECK(latest.Feed(base).begin() == latest.Feed(base).end());
+
+  CHECK(std::vector<std::size_t>({0, 1, 3, 4, 5}) == base.Diff(latest));
+  CHECK(base.Diff(latest) == latest.Diff(base));
+  CHECK(std::vector<std::size_t>({0, 1, 5}) == array.Diff(latest));
+  CHECK(latest.Diff(latest).empty());
+  CHECK_THROWS(std::invalid_argument, base.Feed(pdc::Array<int>(4, 0)));
+
+  std::stringstream stream;
+  latest.Save(stream);
+  const auto loaded = pdc::Array<int>::Load(stream);
+  CHECK(std::vector<std::size_t>({0, 1, 3, 4, 5}) == loaded.Undo().Undo().Undo().Undo().Diff(loaded));
+  UNSIGNED_LONGS_EQUAL(3, loaded.Undo().Feed(loaded).Size());
+  std::vector<std::pair<std::size_t, std::size_t>> reloaded;
+  for (const auto& change : loaded.Undo().Undo().Undo().Undo().Feed(loaded)) {
+    reloaded.emplace_back(change.version, change.idx);
+  }
+  UNSIGNED_LONGS_EQUAL(expected.size(), reloaded.size());
+  for (const auto& change : expected) {
+    CHECK(std::find(reloaded.begin(), reloaded.end(), change) != reloaded.end());
+  }
+}
+
+TEST(Array, AtVersion)
+{
+  pdc::Array<int> array(1, 0);
+  for (int i = 1; i <= 100; ++i) {
+    array = array.Update(0, i);
+  }
+  UNSIGNED_LONGS_EQUAL(101, array.VersionCount());
+  UNSIGNED_LONGS_EQUAL(100, array.GetVersion());
+  const auto old = array.AtVersion(40);
+  UNSIGNED_LONGS_EQUAL(40, old.GetVersion());
+  LONGS_EQUAL(40, old[0]);
+  LONGS_EQUAL(100, old.Latest()[0]);
+  CHECK_THROWS(pdc::IncorrectVersionException, old.Update(0, 0));
+  old.Latest().Update(0, 0);
+  LONGS_EQUAL(0, old.Latest()[0]);
+  CHECK_THROWS(std::out_of_range, array.AtVersion(102));
+
+  array.AtVersion(50).Compact();
+  CHECK_THROWS(std::out_of_range, array.AtVersion(49));
+  LONGS_EQUAL(50, array.AtVersion(50)[0]);
+}
+
+TEST(Array, Borrow)
+{
+  pdc::Array<int> array(3, 1);
+  const auto view = array.Borrow();
+  array = array.Update(1, 2).PushBack(3);
+  UNSIGNED_LONGS_EQUAL(3, view.Size());
+  LONGS_EQUAL(1, view[1]);
+  const auto latest = view.AtVersion(array.GetVersion());
+  UNSIGNED_LONGS_EQUAL(4, latest.Size());
+  LONGS_EQUAL(2, latest[1]);
+  LONGS_EQUAL(3, latest[3]);
+  CHECK_THROWS(std::out_of_range, view.AtVersion(3));
+  array.Compact();
+  CHECK_THROWS(std::out_of_range, latest.AtVersion(0));
+}
+
+TEST(Array, AsOf)
+{
+  pdc::Array<int> array(1, 0);
+  const auto created = array.GetTime();
+  CHECK_THROWS(std::out_of_range, array.AsOf(created - std::chrono::seconds(1)));
+  for (int i = 1; i <= 10; ++i) {
+    array = array.Update(0, i);
+  }
+  for (std::size_t v = 0; v < array.VersionCount(); ++v) {
+    const auto version = array.AtVersion(v);
+    CHECK(v == 0 || array.AtVersion(v - 1).GetTime() <= version.GetTime());
+    CHECK(version.AsOf(version.GetTime()).GetVersion() >= v);
+    LONGS_EQUAL(array.AsOf(version.GetTime())[0], array.AsOf(version.GetTime()).GetVersion());
+  }
+  UNSIGNED_LONGS_EQUAL(10, array.AsOf(pdc::Array<int>::Clock::now()).GetVersion());
+
+  std::stringstream stream;
+  array.Save(stream);
+  const auto loaded = pdc::Array<int>::Load(stream);
+  for (std::size_t v = 0; v < array.VersionCount(); ++v) {
+    CHECK(array.AtVersion(v).GetTime() == loaded.AtVersion(v).GetTime());
+  }
+}
+
+TEST(Array, Range)
+{
+  std::mt19937 random(19);
+  pdc::Array<double> array(3000, 0.5);
+  std::vector<double> expected(3000, 0.5);
+  const auto first = array;
+  for (int i = 0; i < 2000; ++i) {
+    const std::size_t idx = random() % expected.size();
+    expected[idx] = static_cast<int>(random() % 2001) - 1000;
+    array = array.Update(idx, expected[idx]);
+  }
+  DOUBLES_EQUAL(std::accumulate(expected.begin(), expected.end(), 0.0), array.Sum(), 1e-6);
+  DOUBLES_EQUAL(1500.0, first.Sum(), 1e-9);
+  DOUBLES_EQUAL(std::accumulate(expected.begin() + 17, expected.begin() + 2017, 0.0),
+                array.Sum(17, 2000), 1e-6);
+  const auto minmax = std::minmax_element(expected.begin() + 3, expected.end());
+  CHECK(std::make_pair(*minmax.first, *minmax.second) == array.MinMax(3));
+  CHECK(std::make_pair(0.5, 0.5) == first.MinMax());
+  CHECK_THROWS(std::out_of_range, array.MinMax(3000));
+  CHECK_THROWS(std::out_of_range, array.Sum(3001));
+
+  const auto positive = [](double value) { return value > 0; };
+  UNSIGNED_LONGS_EQUAL(std::count_if(expected.begin(), expected.end(), positive), array.CountIf(positive));
+  UNSIGNED_LONGS_EQUAL(3000, first.CountIf(positive));
+
+  std::vector<double> copy(10);
+  UNSIGNED_LONGS_EQUAL(10, array.CopyTo(copy.data(), 2990, 100));
+  CHECK(std::equal(copy.begin(), copy.end(), expected.begin() + 2990));
+  UNSIGNED_LONGS_EQUAL(0, array.CopyTo(copy.data(), 3000));
+
+  pdc::Array<std::string> strings(3, "a");
+  UNSIGNED_LONGS_EQUAL(2, strings.Update(1, "b").CountIf([](const std::string& s) { return s == "a"; }));
+}
+
+TEST(Array, RangeKernels)
+{
+  std::mt19937 random(23);
+  std::vector<std::int8_t> bytes(1000);
+  std::vector<std::int64_t> longs(1000);
+  std::vector<float> floats(1000);
+  for (std::size_t i = 0; i < bytes.size(); ++i) {
+    bytes[i] = static_cast<std::int8_t>(random());
+    longs[i] = static_cast<std::int64_t>(random()) - (std::int64_t(1) << 31);
+    floats[i] = static_cast<int>(random() % 201) - 100;
+  }
+  const auto cpu = internal::CpuIsa();
+  for (const auto isa : {internal::Isa::Scalar, internal::Isa::Avx2, internal::Isa::Avx512}) {
+    if (isa > cpu) {
+      continue;
+    }
+    for (std::size_t count : {0, 1, 7, 63, 129, 1000}) {
+      LONGS_EQUAL(std::accumulate(longs.begin(), longs.begin() + count, std::int64_t(0)),
+                  internal::Sum(longs.data(), count, isa));
+      DOUBLES_EQUAL(std::accumulate(floats.begin(), floats.begin() + count, 0.0f),
+                    internal::Sum(floats.data(), count, isa), 1e-3);
+      std::int8_t min = 0;
+      std::int8_t max = 0;
+      internal::MinMax(bytes.data(), count, min, max, isa);
+      const auto minmax = std::minmax_element(bytes.begin(), bytes.begin() + count);
+      LONGS_EQUAL(count ? std::min<std::int8_t>(0, *minmax.first) : 0, min);
+      LONGS_EQUAL(count ? std::max<std::int8_t>(0, *minmax.second) : 0, max);
+      auto odd = [](std::int64_t value) { return value % 2 != 0; };
+      UNSIGNED_LONGS_EQUAL(std::count_if(longs.begin(), longs.begin() + count, odd),
+                           internal::CountIf(longs.data(), count, odd, isa));
+    }
+  }
+}
+
+TEST(Array, Compact)
+{
+  pdc::Array<int> array(10, 0);
+  for (int i = 0; i < 1000; ++i) {
+    array = array.Update(i % 10, i);
+  }
+  const auto snapshot = array;
+  array = array.PushBack(1000);
+
+  CHECK_FALSE(snapshot.Compact(4));
+  CHECK_FALSE(snapshot.Compact(4));
+  CHECK(snapshot.Compact(4));
+  for (int i = 0; i < 10; ++i) {
+    LONGS_EQUAL(990 + i, snapshot[i]);
+    LONGS_EQUAL(990 + i, array[i]);
+  }
+  UNSIGNED_LONGS_EQUAL(10, snapshot.Size());
+  UNSIGNED_LONGS_EQUAL(11, array.Size());
+  LONGS_EQUAL(1000, array[10]);
+
+  const auto undone = snapshot.Undo();
+  LONGS_EQUAL(999, undone[9]);
+  UNSIGNED_LONGS_EQUAL(10, array.Undo().Undo().Size());
+
+  array = array.Update(0, -1);
+  CHECK(array.Compact());
+  LONGS_EQUAL(-1, array[0]);
+  LONGS_EQUAL(1000, array[10]);
+  LONGS_EQUAL(-1, array.Undo()[0]);
+}
+
+TEST(Array, CompactLog)
+{
+  using PmrArray = pdc::Array<int, std::pmr::polymorphic_allocator<int>>;
+  TestResource resource;
+  PmrArray array(1, 0, &resource);
+  const auto update = [&array](int count) {
+    for (int i = 1; i <= count; ++i) {
+      array = array.Update(0, i);
+      if (i % 1000 == 0) {
+        array.Compact();
+      }
+    }
+  };
+  // Updates 32767 to 65534 of the element fill one chunk of its history, so
+  // between them only the change log could take more memory.
+  update(40000);
+  const std::size_t in_use = resource.in_use;
+  update(20000);
+  CHECK(resource.in_use <= in_use + 1024);
+
+  const auto released = array.Update(0, -1);
+  const auto kept = released.Update(0, -2);
+  array = kept;
+  update(100);
+  kept.Compact();
+  UNSIGNED_LONGS_EQUAL(100, kept.Feed(array).Size());
+  CHECK(std::vector<std::size_t>({0}) == array.Diff(kept));
+  CHECK(kept.GetTime() <= array.GetTime());
+  CHECK(array.AsOf(kept.GetTime()).GetVersion() >= kept.GetVersion());
+  CHECK_THROWS(std::out_of_range, released.Feed(array));
+  CHECK_THROWS(std::out_of_range, released.Diff(array));
+  CHECK_THROWS(std::out_of_range, array.AsOf(kept.GetTime() - std::chrono::hours(1)));
+
+  std::stringstream stream;
+  array.Save(stream);
+  const auto loaded = PmrArray::Load(stream, &resource);
+  const auto loaded_kept = loaded.AtVersion(kept.GetVersion());
+  UNSIGNED_LONGS_EQUAL(100, loaded_kept.Feed(loaded).Size());
+  CHECK(kept.GetTime() == loaded_kept.GetTime());
+  CHECK(array.GetTime() == loaded.GetTime());
+  LONGS_EQUAL(-2, loaded_kept[0]);
+}
+
+TEST(Array, Allocator)
+{
+  pdc::VersionArena arena;
+  std::pmr::polymorphic_allocator<int> alloc(&arena);
+  pdc::Array<int, std::pmr::polymorphic_allocator<int>> array(10, 0, alloc);
+  for (int i = 0; i < 1000; ++i) {
+    array = array.Update(i % 10, i);
+    array = array.PushBack(i);
+  }
+  CHECK(array.GetAllocator() == alloc);
+  CHECK(arena.Reserved() > 0);
+  UNSIGNED_LONGS_EQUAL(1010, array.Size());
+  LONGS_EQUAL(999, array[9]);
+  LONGS_EQUAL(999, array[1009]);
+  LONGS_EQUAL(989, array.Undo().Undo()[9]);
+
+  array = array.Batch().Update(0, -1).PushBack(-2).Commit();
+  LONGS_EQUAL(-1, array[0]);
+  LONGS_EQUAL(-2, array[1010]);
+}
+
+TEST(Array, MoveOnly)
+{
+  pdc::Array<std::unique_ptr<int>> array;
+  array = array.EmplaceBack(new int(1)).PushBack(std::make_unique<int>(2));
+  array = array.Emplace(0, new int(3));
+  array = array.Batch().Update(1, std::make_unique<int>(4)).PushBack(nullptr).Commit();
+
+  UNSIGNED_LONGS_EQUAL(3, array.Size());
+  LONGS_EQUAL(3, *array[0]);
+  LONGS_EQUAL(4, *array[1]);
+  CHECK(array[2] == nullptr);
+  LONGS_EQUAL(1, *array.Undo().Undo()[0]);
+  LONGS_EQUAL(2, *array.Undo()[1]);
+
+  pdc::Array<std::string> strings(1);
+  strings = strings.Emplace(0, 3, 'a').EmplaceBack("bc", 1);
+  CHECK(strings[0] == "aaa");
+  CHECK(strings[1] == "b");
+  CHECK(strings.Undo().Undo()[0].empty());
+}
+
+/* Varint of the serialized formats. */
+std::string Varint(std::uint64_t value)
+{
+  std::string bytes;
+  for (; value >= 0x80; value >>= 7) {
+    bytes += static_cast<char>(value | 0x80);
+  }
+  return bytes + static_cast<char>(value);
+}
+
+/* Bytes of the value as they are serialized. */
+template <typename T>
+std::string Bytes(const T& value)
+{
+  return std::string(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/* Uncompressed stream of the format holding the data in one block. */
+std::string Serialized(char format, const std::string& data)
+{
+  return std::string("pdc") + format + '\x01' + '\x00' +
+         Varint(data.size()) + Varint(data.size()) + data + Varint(0);
+}
+
+TEST(Array, Save)
+{
+  std::vector<pdc::Array<int>> versions(1, pdc::Array<int>(10, 0));
+  for (int i = 0; i < 100; ++i) {
+    const auto& array = versions.back();
+    versions.push_back(i % 7 ? array.Update(i % array.Size(), i) : array.PushBack(-i));
+  }
+  versions[50].Compact();
+  std::stringstream stream;
+  versions.back().Save(stream);
+
+  auto loaded = pdc::Array<int>::Load(stream);
+  for (std::size_t v = versions.size() - 1; ; --v, loaded = loaded.Undo()) {
+    UNSIGNED_LONGS_EQUAL(versions[v].Size(), loaded.Size());
+    for (std::size_t i = 0; i < loaded.Size(); ++i) {
+      LONGS_EQUAL(versions[v][i], loaded[i]);
+    }
+    if (v == 50) {
+      break;
+    }
+  }
+  UNSIGNED_LONGS_EQUAL(versions[50].Size(), loaded.Undo().Size());
+  LONGS_EQUAL(versions[50][6], loaded.Undo()[6]);
+  stream.clear();
+  stream.seekg(0);
+  loaded = pdc::Array<int>::Load(stream).Update(0, 7);
+  LONGS_EQUAL(7, loaded[0]);
+  LONGS_EQUAL(versions.back()[0], loaded.Undo()[0]);
+
+  std::stringstream strings;
+  pdc::Array<std::string>(2, "a").Update(1, "bc").Save(strings);
+  const auto text = pdc::Array<std::string>::Load(strings);
+  CHECK(text[0] == "a");
+  CHECK(text[1] == "bc");
+  CHECK(text.Undo()[1] == "a");
+  // A snapshot of one string of 2^40 characters holding only three.
+  std::stringstream snapshot;
+  text.SaveSnapshot(snapshot);
+  std::string block("\x0b\x0b_\x01\x80\x80\x80\x80\x80\x20" "abc", 13);
+  block[2] = static_cast<char>(sizeof(std::string));
+  std::stringstream huge(snapshot.str().substr(0, 6) + block);
+  CHECK_THROWS(std::runtime_error, pdc::Array<std::string>::Load(huge));
+
+  std::stringstream broken(stream.str().substr(0, stream.str().size() / 2));
+  CHECK_THROWS(std::runtime_error, pdc::Array<int>::Load(broken));
+  stream.clear();
+  stream.seekg(0);
+  CHECK_THROWS(std::runtime_error, pdc::Array<double>::Load(stream));
+}
+
+TEST(Array, LoadCorrupted)
+{
+  // A history of one element of size 1: the versions, the history of sizes,
+  // the count of elements and their histories, then the times.
+  const auto history = [](std::uint64_t min_version, std::uint64_t max_version,
+                          std::size_t size, const std::string& nodes, const std::string& deltas) {
+    std::stringstream stream(Serialized('a', Varint(sizeof(int)) + Varint(min_version) +
+      Varint(max_version) + Varint(0) + Bytes(size) + Varint(1) + nodes +
+      Bytes(std::int64_t(1)) + deltas));
+    return pdc::Array<int>::Load(stream);
+  };
+  const std::string node = Varint(0) + Bytes(5);
+  const auto array = history(0, 2, 1, Varint(1) + Bytes(5) + Varint(2 << 2) + Bytes(6),
+                             Varint(1) + Varint(1));
+  UNSIGNED_LONGS_EQUAL(3, array.VersionCount());
+  LONGS_EQUAL(6, array[0]);
+  LONGS_EQUAL(5, array.Undo()[0]);
+  CHECK(std::vector<std::size_t>({0}) == array.Undo().Undo().Diff(array));
+
+  CHECK_THROWS(std::runtime_error, history(3, 1, 1, node, ""));
+  CHECK_THROWS(std::runtime_error, history(0, SIZE_MAX, 1, node, ""));
+  CHECK_THROWS(std::runtime_error, history(0, 1, 2, node, Varint(1)));
+  CHECK_THROWS(std::runtime_error, history(0, 1, 1, Varint(1) + Bytes(5) + Varint(5 << 2) + Bytes(6),
+                                           Varint(1)));
+  CHECK_THROWS(std::runtime_error, history(0, 1, 1, Varint(1) + Bytes(5) + Varint(0) + Bytes(6),
+                                           Varint(1)));
+  CHECK_THROWS(std::runtime_error, history(0, 1, 1, Varint(std::uint64_t(1) << 62) + Bytes(5),
+                                           Varint(1)));
+  // The times of 2^40 versions are not there, nothing is allocated for them.
+  CHECK_THROWS(std::runtime_error, history(0, std::uint64_t(1) << 40, 1, node, Varint(1)));
+  // A history compacted at a late version takes only the kept versions.
+  const auto late = history(std::uint64_t(1) << 40, std::uint64_t(1) << 40, 1, node, "");
+  UNSIGNED_LONGS_EQUAL((std::uint64_t(1) << 40) + 1, late.VersionCount());
+  LONGS_EQUAL(5, late[0]);
+  CHECK(late.Undo().Diff(late).empty());
+}
+
+TEST(Array, SaveSnapshot)
+{
+  pdc::Array<int> array(3, 1);
+  array = array.Update(1, 2).PushBack(3);
+  std::stringstream stream;
+  array.Undo().SaveSnapshot(stream);
+
+  const auto loaded = pdc::Array<int>::Load(stream);
+  UNSIGNED_LONGS_EQUAL(3, loaded.Size());
+  LONGS_EQUAL(2, loaded[1]);
+  LONGS_EQUAL(2, loaded.Undo()[1]);
+  stream.clear();
+  stream.seekg(0);
+  const auto list = pdc::List<int>::Load(stream);
+  UNSIGNED_LONGS_EQUAL(3, list.Size());
+  LONGS_EQUAL(2, list.At(1));
+}
+
+#ifdef PDC_WITH_ZLIB
+TEST(Array, SaveCompressed)
+{
+  pdc::Array<std::int64_t> array(100000, 0);
+  array = array.Update(5, 5);
+  std::stringstream stream;
+  array.Save(stream, pdc::Compression::Zlib);
+  CHECK(stream.str().size() < 100000);
+
+  const auto loaded = pdc::Array<std::int64_t>::Load(stream);
+  UNSIGNED_LONGS_EQUAL(100000, loaded.Size());
+  LONGS_EQUAL(5, loaded[5]);
+  LONGS_EQUAL(0, loaded.Undo()[5]);
+}
+#endif
+
+TEST(Array, Threaded)
+{
+  pdc::Array<int> array(100, 0);
+  const auto snapshot = array.Update(0, 1);
+  array = snapshot;
+
+  bool readers_ok = true;
+  std::thread reader([snapshot, &readers_ok]() {
+    for (int i = 0; i < 1000; i++) {
+      if (snapshot[0] != 1 || snapshot[99] != 0 || snapshot.Size() != 100) {
+        readers_ok = false;
+      }
+    }
+  });
+
+  for (int i = 0; i < 1000; i++) {
+    array = array.Update(i % 100, i);
+    array = array.PushBack(i);
+  }
+  reader.join();
+
+  CHECK(readers_ok);
+  UNSIGNED_LONGS_EQUAL(1100, array.Size());
+  LONGS_EQUAL(1, snapshot[0]);
+}
+
+TEST(Array, AsOfCompact)
+{
+  pdc::Array<int> array;
+  std::atomic<bool> done{false};
+  std::vector<std::size_t> found;
+
+  std::thread reader([array, &done, &found]() {
+    while (!done.load()) {
+      try {
+        found.push_back(array.AsOf(pdc::Array<int>::Clock::now()).GetVersion());
+      } catch (const std::out_of_range&) {
+        // Versions made by the time were released meanwhile.
+      }
+    }
+  });
+
+  for (int i = 0; i < 10000; i++) {
+    array = array.PushBack(i);
+    if (i % 10 == 0) {
+      array.Compact();
+    }
+  }
+  done = true;
+  reader.join();
+
+  CHECK(std::is_sorted(found.begin(), found.end()));
+  CHECK(found.empty() || found.back() <= array.GetVersion());
+}
+
+TEST_GROUP(MappedArray)
+{
+  const std::string path = "mapped_array_test.pdc";
+
+  void teardown() override
+  {
+    std::remove(path.c_str());
+    std::remove((path + ".idx").c_str());
+  }
+};
+
+TEST(MappedArray, UpdatePushBack)
+{
+  pdc::MappedArray<std::int64_t> array(path, 2, 7);
+  UNSIGNED_LONGS_EQUAL(2, array.Size());
+  LONGS_EQUAL(7, array[1]);
+
+  const auto array2 = array.Update(0, 1);
+  const auto array3 = array2.PushBack(2);
+  UNSIGNED_LONGS_EQUAL(3, array3.Size());
+  LONGS_EQUAL(1, array3[0]);
+  LONGS_EQUAL(2, array3[2]);
+  LONGS_EQUAL(7, array[0]);
+  UNSIGNED_LONGS_EQUAL(2, array2.Size());
+
+  CHECK_THROWS(pdc::IncorrectVersionException, array2.PushBack(0));
+  CHECK_THROWS(std::out_of_range, array3.Update(3, 0));
+  CHECK_THROWS(std::out_of_range, array3[3]);
+  CHECK_THROWS(std::out_of_range, array2[2]);
+  UNSIGNED_LONGS_EQUAL(2, array3.Undo().Size());
+  UNSIGNED_LONGS_EQUAL(3, array3.Undo().Redo().Size());
+}
+
+TEST(MappedArray, Reopen)
+{
+  {
+    pdc::MappedArray<std::int64_t> array(path, 0);
+    for (int i = 0; i < 1000; ++i) {
+      array = array.PushBack(i);
+      array = array.Update(i / 2, -i);
+    }
+  }
+  {
+    pdc::MappedArray<std::int64_t> array(path);
+    UNSIGNED_LONGS_EQUAL(1000, array.Size());
+    LONGS_EQUAL(-999, array[499]);
+    LONGS_EQUAL(999, array[999]);
+
+    auto old = array;
+    for (int i = 0; i < 1000; ++i) {
+      old = old.Undo();
+    }
+    UNSIGNED_LONGS_EQUAL(500, old.Size());
+    LONGS_EQUAL(-499, old[249]);
+    LONGS_EQUAL(499, old[499]);
+    UNSIGNED_LONGS_EQUAL(2001, array.VersionCount());
+    UNSIGNED_LONGS_EQUAL(old.GetVersion(), array.AtVersion(1000).GetVersion());
+    LONGS_EQUAL(499, array.AtVersion(1000)[499]);
+    CHECK_THROWS(std::out_of_range, array.AtVersion(2001));
+
+    array = array.PushBack(1000);
+    CHECK_THROWS(std::system_error, pdc::MappedArray<std::int64_t>{path});
+    CHECK_THROWS(std::system_error, pdc::MappedArray<std::int64_t>(path, 1));
+  }
+  LONGS_EQUAL(1000, pdc::MappedArray<std::int64_t>(path)[1000]);
+  CHECK_THROWS(std::runtime_error, pdc::MappedArray<std::int32_t>{path});
+}
+
+TEST(MappedArray, History)
+{
+  const int kUpdates = 10000;
+  pdc::MappedArray<std::int64_t> array(path, 3, 0);
+  std::vector<std::size_t> versions(1, 0);
+  for (int i = 1; i <= kUpdates; ++i) {
+    array = array.Update(1, i);
+    versions.push_back(array.GetVersion());
+    if (i % 7 == 0) {
+      array = array.Update(0, -i);
+    }
+  }
+  for (int i = 0; i <= kUpdates; ++i) {
+    const auto old = array.AtVersion(versions[i]);
+    LONGS_EQUAL(i, old[1]);
+    LONGS_EQUAL(i > 0 ? -((i - 1) / 7 * 7) : 0, old[0]);
+    LONGS_EQUAL(0, old[2]);
+  }
+}
+
+TEST(MappedArray, Grow)
+{
+  {
+    pdc::MappedArray<std::int32_t> array(path, 10, -1);
+    for (int i = 0; i < 100000; ++i) {
+      array = array.PushBack(i);
+    }
+    array = array.Update(0, 5);
+  }
+  const pdc::MappedArray<std::int32_t> array(path);
+  UNSIGNED_LONGS_EQUAL(100010, array.Size());
+  LONGS_EQUAL(5, array[0]);
+  LONGS_EQUAL(-1, array[9]);
+  LONGS_EQUAL(99999, array[100009]);
+  UNSIGNED_LONGS_EQUAL(50010, array.AtVersion(50000).Size());
+  LONGS_EQUAL(-1, array.Undo()[0]);
+}
+
+TEST(MappedArray, Sync)
+{
+  {
+    pdc::MappedArray<double> array(path, 10, 0.5, pdc::Durability::System);
+    array = array.Update(3, 1.5).PushBack(2.5);
+  }
+  pdc::MappedArray<double> reopened(path, pdc::Durability::System);
+  UNSIGNED_LONGS_EQUAL(11, reopened.Size());
+  DOUBLES_EQUAL(1.5, reopened[3], 0);
+  DOUBLES_EQUAL(0.5, reopened.Undo().Undo()[3], 0);
+}
+
 TEST_GROUP(List)
 {
 };
@@ -204,33 +1239,456 @@ TEST(List, PushFront)
   UNSIGNED_LONGS_EQUAL(2, list.Size());
 }
 
-TEST(List, Insert)
+TEST(List, Append)
+{
+  pdc::List<int> list;
+  const std::vector<int> values = {1, 2, 3};
+  list = list.Append(values.begin(), values.end());
+  UNSIGNED_LONGS_EQUAL(3, list.Size());
+  LONGS_EQUAL(1, *list.begin());
+  LONGS_EQUAL(3, *(++(++list.begin())));
+
+  list = list.Append(values.begin(), values.end());
+  UNSIGNED_LONGS_EQUAL(6, list.Size());
+
+  list = list.Undo();
+  UNSIGNED_LONGS_EQUAL(3, list.Size());
+  list = list.Undo();
+  CHECK(list.IsEmpty());
+}
+
+TEST(List, Transient)
+{
+  const std::vector<int> values = {1, 2, 3};
+  const auto list = pdc::List<int>().Append(values.begin(), values.end());
+  auto builder = list.Transient();
+  for (int i = 0; i < 1000; ++i) {
+    builder.PushBack(i);
+  }
+  UNSIGNED_LONGS_EQUAL(1003, builder.Size());
+  LONGS_EQUAL(2, builder.At(1));
+  LONGS_EQUAL(999, builder.At(1002));
+  CHECK_THROWS(std::out_of_range, builder.At(1003));
+
+  const auto list2 = builder.Persistent();
+  UNSIGNED_LONGS_EQUAL(3, list2.VersionCount());
+  UNSIGNED_LONGS_EQUAL(1003, list2.Size());
+  int expected = 0;
+  for (auto it = ++(++(++list2.begin())); it != list2.end(); ++it) {
+    LONGS_EQUAL(expected++, *it);
+  }
+  const auto edit = *list.Feed(list2).begin();
+  UNSIGNED_LONGS_EQUAL(3, edit.idx);
+  UNSIGNED_LONGS_EQUAL(1000, edit.count);
+
+  const auto list3 = builder.EmplaceBack(7).Persistent();
+  UNSIGNED_LONGS_EQUAL(1004, list3.Size());
+  LONGS_EQUAL(7, list3.At(1003));
+  CHECK_THROWS(pdc::IncorrectVersionException, list2.Transient().PushBack(0).Persistent());
+
+  pdc::List<std::string> strings;
+  auto string_builder = strings.Transient();
+  string_builder.PushBack("a").EmplaceBack(2, 'b');
+  STRCMP_EQUAL("bb", string_builder.Persistent().At(1).c_str());
+}
+
+TEST(List, Insert)
+{
+  pdc::List<int> list;
+  list = list.PushBack(0);
+  list = list.PushBack(1);
+  list = list.Insert(list.begin(), 2);
+  LONGS_EQUAL(2, *list.begin());
+  UNSIGNED_LONGS_EQUAL(3, list.Size());
+
+  list = list.Insert(++list.begin(), 3);
+  LONGS_EQUAL(3, *(++list.begin()));
+  UNSIGNED_LONGS_EQUAL(4, list.Size());
+}
+
+TEST(List, Remove)
+{
+  pdc::List<int> list;
+  list = list.PushBack(0);
+  list = list.PushBack(1);
+  list = list.Remove(list.begin());
+  LONGS_EQUAL(1, *list.begin());
+  UNSIGNED_LONGS_EQUAL(1, list.Size());
+
+  list = list.PushFront(5);
+  list = list.Remove(++list.begin());
+  LONGS_EQUAL(5, *list.begin());
+  UNSIGNED_LONGS_EQUAL(1, list.Size());
+}
+
+TEST(List, Compact)
+{
+  pdc::List<int> list;
+  for (int i = 0; i < 10; ++i) {
+    list = list.PushBack(i);
+  }
+  const auto full = list;
+  list = list.Remove(list.begin());
+  list = list.Remove(list.begin());
+  UNSIGNED_LONGS_EQUAL(10, full.Size());
+  UNSIGNED_LONGS_EQUAL(8, list.Size());
+
+  CHECK_FALSE(list.Compact(5));
+  CHECK_FALSE(list.Compact(5));
+  CHECK(list.Compact(5));
+  UNSIGNED_LONGS_EQUAL(8, list.Size());
+  LONGS_EQUAL(2, *list.begin());
+  UNSIGNED_LONGS_EQUAL(8, list.Undo().Size());
+
+  list = list.PushBack(10);
+  UNSIGNED_LONGS_EQUAL(9, list.Size());
+  UNSIGNED_LONGS_EQUAL(8, list.Undo().Size());
+
+  UNSIGNED_LONGS_EQUAL(10, full.Size());
+  LONGS_EQUAL(0, *full.begin());
+  CHECK_THROWS(std::out_of_range, full.GetTime());
+  CHECK_THROWS(std::out_of_range, full.Feed(list));
+  UNSIGNED_LONGS_EQUAL(list.Undo().GetVersion(), full.Redo().GetVersion());
+  UNSIGNED_LONGS_EQUAL(1, list.Undo().Feed(list).Size());
+}
+
+TEST(List, CompactLog)
+{
+  using PmrList = pdc::List<int, std::pmr::polymorphic_allocator<int>>;
+  TestResource resource;
+  std::vector<int> values(100);
+  PmrList list = PmrList(&resource).Append(values.begin(), values.end());
+  const auto update = [&list](int count) {
+    for (int i = 1; i <= count; ++i) {
+      list = list.PushBack(i).Remove(list.begin());
+      if (i % 1000 == 0) {
+        list.Compact();
+      }
+    }
+  };
+  update(10000);
+  const std::size_t in_use = resource.in_use;
+  update(10000);
+  CHECK(resource.in_use <= in_use + 1024);
+
+  const auto kept = list;
+  update(100);
+  CHECK(kept.Compact());
+  UNSIGNED_LONGS_EQUAL(200, kept.Feed(list).Size());
+  CHECK(kept.GetTime() <= list.GetTime());
+  CHECK(list.AsOf(kept.GetTime()).GetVersion() >= kept.GetVersion());
+  CHECK_THROWS(std::out_of_range, list.AtVersion(kept.GetVersion() - 1));
+
+  std::stringstream stream;
+  list.Save(stream);
+  const auto loaded = PmrList::Load(stream, &resource);
+  const auto loaded_kept = loaded.AtVersion(kept.GetVersion());
+  UNSIGNED_LONGS_EQUAL(200, loaded_kept.Feed(loaded).Size());
+  CHECK(kept.GetTime() == loaded_kept.GetTime());
+  CHECK(std::equal(kept.begin(), kept.end(), loaded_kept.begin()));
+  UNSIGNED_LONGS_EQUAL(list.VersionCount(), loaded.VersionCount());
+}
+
+TEST(List, At)
+{
+  pdc::List<int> list;
+  CHECK_THROWS(std::out_of_range, list.At(0));
+
+  std::vector<pdc::List<int>> versions = {list};
+  std::vector<std::vector<int>> expected = {{}};
+  std::mt19937 gen(7);
+  for (int i = 0; i < 1000; ++i) {
+    std::vector<int> values = expected.back();
+    const std::size_t pos = gen() % (values.size() + 1);
+    if (gen() % 3 == 0 && pos < values.size()) {
+      auto it = list.begin();
+      for (std::size_t j = 0; j < pos; ++j) {
+        ++it;
+      }
+      list = list.Remove(it);
+      values.erase(values.begin() + pos);
+    } else {
+      auto it = list.begin();
+      for (std::size_t j = 0; j < pos; ++j) {
+        ++it;
+      }
+      list = list.Insert(it, i);
+      values.insert(values.begin() + pos, i);
+    }
+    versions.push_back(list);
+    expected.push_back(values);
+  }
+
+  for (std::size_t v = 0; v < versions.size(); ++v) {
+    UNSIGNED_LONGS_EQUAL(expected[v].size(), versions[v].Size());
+    for (std::size_t i = 0; i < expected[v].size(); ++i) {
+      LONGS_EQUAL(expected[v][i], versions[v].At(i));
+    }
+    CHECK_THROWS(std::out_of_range, versions[v].At(expected[v].size()));
+    const std::vector<int> values(versions[v].begin(), versions[v].end());
+    CHECK(expected[v] == values);
+  }
+}
+
+TEST(List, Iterator)
+{
+  pdc::List<int> list;
+  CHECK(list.begin() == list.end());
+
+  for (int i = 0; i < 100; ++i) {
+    list = i % 2 ? list.PushBack(i) : list.PushFront(i);
+  }
+  const auto old = list;
+  list = list.Remove(list.begin());
+
+  std::vector<int> values;
+  for (const int value : old) {
+    values.push_back(value);
+  }
+  UNSIGNED_LONGS_EQUAL(100, values.size());
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    LONGS_EQUAL(old.At(i), values[i]);
+  }
+
+  auto it = list.end();
+  for (std::size_t i = list.Size(); i > 0; --i) {
+    --it;
+    LONGS_EQUAL(values[i], *it);
+  }
+  CHECK(it == list.begin());
+
+  it = list.begin();
+  ++it;
+  ++it;
+  LONGS_EQUAL(values[3], *it);
+  --it;
+  LONGS_EQUAL(values[2], *it);
+  ++it;
+  ++it;
+  LONGS_EQUAL(values[4], *it);
+}
+
+TEST(List, Allocator)
+{
+  pdc::VersionArena arena;
+  std::pmr::polymorphic_allocator<int> alloc(&arena);
+  pdc::List<int, std::pmr::polymorphic_allocator<int>> list(alloc);
+  for (int i = 0; i < 100; ++i) {
+    list = list.PushBack(i);
+  }
+  list = list.Remove(list.begin());
+  CHECK(list.GetAllocator() == alloc);
+  CHECK(arena.Reserved() > 0);
+  UNSIGNED_LONGS_EQUAL(99, list.Size());
+  LONGS_EQUAL(1, *list.begin());
+  UNSIGNED_LONGS_EQUAL(100, list.Undo().Size());
+}
+
+TEST(List, MoveOnly)
+{
+  pdc::List<std::unique_ptr<int>> list;
+  for (int i = 0; i < 100; ++i) {
+    list = i % 2 ? list.EmplaceBack(new int(i)) : list.PushFront(std::make_unique<int>(i));
+  }
+  list = list.Emplace(list.begin(), new int(-1)).Remove(++list.begin());
+  std::unique_ptr<int> values[] = {std::make_unique<int>(100), std::make_unique<int>(101)};
+  list = list.Append(std::make_move_iterator(values), std::make_move_iterator(values + 2));
+
+  UNSIGNED_LONGS_EQUAL(102, list.Size());
+  LONGS_EQUAL(-1, *list.At(0));
+  LONGS_EQUAL(96, *list.At(1));
+  LONGS_EQUAL(99, *list.At(99));
+  LONGS_EQUAL(101, *list.At(101));
+  LONGS_EQUAL(98, *list.Undo().Undo().At(1));
+  LONGS_EQUAL(98, **list.Undo().Undo().Undo().begin());
+
+  pdc::List<std::string> strings;
+  strings = strings.EmplaceBack(3, 'a').EmplaceFront("bc", 1);
+  CHECK(strings.At(0) == "b");
+  CHECK(strings.At(1) == "aaa");
+  std::stringstream stream;
+  strings.Save(stream);
+  CHECK(pdc::List<std::string>::Load(stream).Undo().At(0) == "aaa");
+}
+
+/* Trivially copyable value without a default constructor. */
+struct Point {
+  explicit Point(int v) : x(v) { }
+  int x;
+};
+
+TEST(List, NoDefaultConstructor)
+{
+  pdc::List<Point> list;
+  for (int i = 0; i < 100; ++i) {
+    list = i % 2 ? list.PushBack(Point(i)) : list.EmplaceFront(i);
+  }
+  list = list.Insert(std::next(list.begin(), 50), Point(-1));
+  list = list.Remove(list.begin());
+  const auto built = list.Transient().PushBack(Point(100)).Persistent();
+
+  UNSIGNED_LONGS_EQUAL(101, built.Size());
+  LONGS_EQUAL(96, built.At(0).x);
+  LONGS_EQUAL(-1, built.At(49).x);
+  LONGS_EQUAL(100, built.At(100).x);
+  LONGS_EQUAL(98, list.Undo().At(0).x);
+  LONGS_EQUAL(96, (*built.begin()).x);
+}
+
+TEST(List, Save)
+{
+  std::mt19937 random(7);
+  std::vector<pdc::List<int>> versions(1);
+  for (int i = 0; i < 300; ++i) {
+    const auto& list = versions.back();
+    auto it = list.begin();
+    for (std::size_t j = random() % (list.Size() + 1); j > 0; --j) {
+      ++it;
+    }
+    versions.push_back(i % 4 == 3 && list.Size() ? list.Remove(list.begin()) : list.Insert(it, i));
+  }
+  versions[100].Compact();
+  std::stringstream stream;
+  versions.back().Save(stream);
+
+  auto loaded = pdc::List<int>::Load(stream);
+  for (std::size_t v = versions.size() - 1; ; --v, loaded = loaded.Undo()) {
+    CHECK(std::vector<int>(versions[v].begin(), versions[v].end()) ==
+          std::vector<int>(loaded.begin(), loaded.end()));
+    if (v == 100) {
+      break;
+    }
+  }
+  UNSIGNED_LONGS_EQUAL(versions[100].Size(), loaded.Undo().Size());
+  CHECK_THROWS(pdc::IncorrectVersionException, loaded.PushBack(0));
+  loaded = loaded.Redo();
+  for (std::size_t v = 101; v < versions.size(); ++v) {
+    loaded = loaded.Redo();
+  }
+  loaded = loaded.PushBack(-1);
+  LONGS_EQUAL(-1, loaded.At(loaded.Size() - 1));
+}
+
+TEST(List, LoadCorrupted)
+{
+  // An empty list kept since the version: no nodes, the root of each version
+  // and its edit, then the times.
+  const auto history = [](std::uint64_t min_version, std::uint64_t count) {
+    std::string data = Varint(sizeof(int)) + Varint(min_version) + Varint(count) + Varint(0) +
+                       Varint(0) + Bytes(std::int64_t(1));
+    if (count > 1) {
+      data += Varint(0) + Varint(0) + Varint(0) + Varint(0) + Varint(1);
+    }
+    std::stringstream stream(Serialized('l', data));
+    return pdc::List<int>::Load(stream);
+  };
+  const auto late = history(std::uint64_t(1) << 40, 1);
+  UNSIGNED_LONGS_EQUAL((std::uint64_t(1) << 40) + 1, late.VersionCount());
+  UNSIGNED_LONGS_EQUAL(0, late.Size());
+  UNSIGNED_LONGS_EQUAL(1, late.PushBack(0).Size());
+  UNSIGNED_LONGS_EQUAL(2, history(0, 2).VersionCount());
+
+  CHECK_THROWS(std::runtime_error, history(0, 0));
+  CHECK_THROWS(std::runtime_error, history(SIZE_MAX, 2));
+  CHECK_THROWS(std::runtime_error, history(0, std::uint64_t(1) << 40));
+}
+
+TEST(List, SaveSnapshot)
 {
   pdc::List<int> list;
-  list = list.PushBack(0);
-  list = list.PushBack(1);
-  list = list.Insert(list.begin(), 2);
-  LONGS_EQUAL(2, *list.begin());
-  UNSIGNED_LONGS_EQUAL(3, list.Size());
+  std::vector<int> values(100);
+  for (int i = 0; i < 100; ++i) {
+    values[i] = i;
+  }
+  list = list.Append(values.begin(), values.end()).Remove(list.begin());
+  std::stringstream stream;
+  list.SaveSnapshot(stream);
 
-  list = list.Insert(++list.begin(), 3);
-  LONGS_EQUAL(3, *(++list.begin()));
-  UNSIGNED_LONGS_EQUAL(4, list.Size());
+  const auto loaded = pdc::List<int>::Load(stream);
+  CHECK(std::vector<int>(values.begin() + 1, values.end()) ==
+        std::vector<int>(loaded.begin(), loaded.end()));
+  stream.clear();
+  stream.seekg(0);
+  const auto array = pdc::Array<int>::Load(stream);
+  UNSIGNED_LONGS_EQUAL(99, array.Size());
+  LONGS_EQUAL(99, array[98]);
+
+  // A block of the size of int and a count of 2^63 - 1 elements.
+  const std::string block("\x0a\x0a\x04\xff\xff\xff\xff\xff\xff\xff\xff\x7f", 12);
+  std::stringstream huge(stream.str().substr(0, 6) + block);
+  CHECK_THROWS(std::runtime_error, pdc::List<int>::Load(huge));
 }
 
-TEST(List, Remove)
+TEST(List, Feed)
+{
+  using Kind = pdc::List<int>::Edit::Kind;
+  const pdc::List<int> base;
+  std::vector<int> values = {1, 2, 3};
+  const auto list = base.Append(values.begin(), values.end()).PushFront(0);
+  const auto latest = list.Insert(++list.begin(), 5).Remove(list.begin()).PushBack(4);
+
+  std::size_t version = 0;
+  for (const auto& edit : base.Feed(latest)) {
+    UNSIGNED_LONGS_EQUAL(++version, edit.version);
+  }
+  UNSIGNED_LONGS_EQUAL(5, version);
+
+  auto it = base.Feed(latest).begin();
+  CHECK(Kind::Insert == it->kind);
+  UNSIGNED_LONGS_EQUAL(0, it->idx);
+  UNSIGNED_LONGS_EQUAL(3, it->count);
+  ++it;
+  CHECK(Kind::Insert == it->kind);
+  UNSIGNED_LONGS_EQUAL(0, it->idx);
+  ++it;
+  UNSIGNED_LONGS_EQUAL(1, it->idx);
+  ++it;
+  CHECK(Kind::Remove == it->kind);
+  UNSIGNED_LONGS_EQUAL(0, it->idx);
+  UNSIGNED_LONGS_EQUAL(1, it->count);
+  ++it;
+  CHECK(Kind::Insert == it->kind);
+  UNSIGNED_LONGS_EQUAL(4, it->idx);
+  CHECK(++it == base.Feed(latest).end());
+  UNSIGNED_LONGS_EQUAL(3, list.Feed(latest).Size());
+  UNSIGNED_LONGS_EQUAL(0, latest.Feed(list).Size());
+  CHECK_THROWS(std::invalid_argument, base.Feed(pdc::List<int>()));
+
+  std::stringstream stream;
+  latest.Save(stream);
+  const auto loaded = pdc::List<int>::Load(stream);
+  std::vector<Kind> kinds;
+  for (const auto& edit : loaded.Undo().Undo().Feed(loaded)) {
+    kinds.push_back(edit.kind);
+  }
+  CHECK(std::vector<Kind>({Kind::Remove, Kind::Insert}) == kinds);
+}
+
+TEST(List, AtVersion)
 {
   pdc::List<int> list;
-  list = list.PushBack(0);
-  list = list.PushBack(1);
-  list = list.Remove(list.begin());
-  LONGS_EQUAL(1, *list.begin());
-  UNSIGNED_LONGS_EQUAL(1, list.Size());
+  for (int i = 0; i < 100; ++i) {
+    list = list.PushBack(i);
+  }
+  UNSIGNED_LONGS_EQUAL(101, list.VersionCount());
+  const auto old = list.AtVersion(30);
+  UNSIGNED_LONGS_EQUAL(30, old.Size());
+  UNSIGNED_LONGS_EQUAL(30, old.GetVersion());
+  UNSIGNED_LONGS_EQUAL(100, old.Latest().Size());
+  CHECK_THROWS(std::out_of_range, list.AtVersion(101));
+  CHECK_THROWS(std::out_of_range, list.AsOf(list.AtVersion(0).GetTime() - std::chrono::seconds(1)));
+  UNSIGNED_LONGS_EQUAL(100, old.AsOf(pdc::List<int>::Clock::now()).Size());
+  CHECK(old.AsOf(old.GetTime()).GetVersion() >= 30);
 
-  list = list.PushFront(5);
-  list = list.Remove(++list.begin());
-  LONGS_EQUAL(5, *list.begin());
-  UNSIGNED_LONGS_EQUAL(1, list.Size());
+  list.AtVersion(20).Compact();
+  CHECK_THROWS(std::out_of_range, list.AtVersion(19));
+  std::stringstream stream;
+  list.Save(stream);
+  const auto loaded = pdc::List<int>::Load(stream);
+  UNSIGNED_LONGS_EQUAL(101, loaded.VersionCount());
+  for (std::size_t v = 20; v < list.VersionCount(); ++v) {
+    CHECK(list.AtVersion(v).GetTime() == loaded.AtVersion(v).GetTime());
+  }
 }
 
 TEST(List, Undo)
@@ -296,3 +1754,757 @@ TEST(List, Threaded)
   CHECK(thread1_throw || thread2_throw);
 }
 
+TEST(List, AsOfCompact)
+{
+  pdc::List<int> list;
+  std::atomic<bool> done{false};
+  std::vector<std::size_t> found;
+
+  std::thread reader([list, &done, &found]() {
+    while (!done.load()) {
+      try {
+        found.push_back(list.AsOf(pdc::List<int>::Clock::now()).GetVersion());
+      } catch (const std::out_of_range&) {
+        // Versions made by the time were released meanwhile.
+      }
+    }
+  });
+
+  for (int i = 0; i < 10000; i++) {
+    list = list.PushBack(i);
+    if (i % 10 == 0) {
+      list.Compact();
+    }
+  }
+  done = true;
+  reader.join();
+
+  CHECK(std::is_sorted(found.begin(), found.end()));
+  CHECK(found.empty() || found.back() <= list.GetVersion());
+}
+
+
+TEST_GROUP(Map)
+{
+};
+
+TEST(Map, InsertFind)
+{
+  pdc::Map<int, std::string> map;
+  CHECK(map.IsEmpty());
+  const auto map1 = map.Insert(2, "two").Insert(1, "one").Insert(3, "three");
+  UNSIGNED_LONGS_EQUAL(3, map1.Size());
+  STRCMP_EQUAL("one", map1.At(1).c_str());
+  STRCMP_EQUAL("three", map1.At(3).c_str());
+  CHECK(map1.Find(4) == nullptr);
+  CHECK(!map1.Contains(0));
+  CHECK_THROWS(std::out_of_range, map1.At(4));
+
+  const auto map2 = map1.Insert(1, "uno");
+  UNSIGNED_LONGS_EQUAL(3, map2.Size());
+  STRCMP_EQUAL("uno", map2.At(1).c_str());
+  STRCMP_EQUAL("one", map1.At(1).c_str());
+  CHECK(map.Find(1) == nullptr);
+  CHECK_THROWS(pdc::IncorrectVersionException, map1.Insert(4, "four"));
+}
+
+TEST(Map, Remove)
+{
+  pdc::Map<int, int> map;
+  for (int i = 0; i < 10; ++i) {
+    map = map.Insert(i, i * i);
+  }
+  const auto removed = map.Remove(3).Remove(0).Remove(9);
+  UNSIGNED_LONGS_EQUAL(7, removed.Size());
+  CHECK(!removed.Contains(3));
+  CHECK(map.Contains(3));
+  LONGS_EQUAL(16, removed.At(4));
+  CHECK_THROWS(std::out_of_range, removed.Remove(3));
+  LONGS_EQUAL(9, removed.Insert(3, 9).At(3));
+}
+
+TEST(Map, Iterator)
+{
+  pdc::Map<int, int> map;
+  for (int i : {5, 1, 9, 3, 7}) {
+    map = map.Insert(i, -i);
+  }
+  std::vector<int> keys;
+  for (const auto& element : map) {
+    keys.push_back(element.first);
+    LONGS_EQUAL(-element.first, element.second);
+  }
+  CHECK(std::vector<int>({1, 3, 5, 7, 9}) == keys);
+  LONGS_EQUAL(5, map.LowerBound(4).Key());
+  LONGS_EQUAL(5, map.LowerBound(5).Key());
+  CHECK(map.LowerBound(10) == map.end());
+  std::vector<int> tail;
+  for (auto it = map.LowerBound(4); it != map.end(); ++it) {
+    tail.push_back(it.Key());
+  }
+  CHECK(std::vector<int>({5, 7, 9}) == tail);
+}
+
+TEST(Map, Versions)
+{
+  std::mt19937 random(11);
+  std::vector<std::map<int, int>> expected(1);
+  pdc::Map<int, int> map;
+  for (int i = 0; i < 3000; ++i) {
+    std::map<int, int> next = expected.back();
+    const int key = random() % 500;
+    if (random() % 3 == 0 && next.count(key)) {
+      next.erase(key);
+      map = map.Remove(key);
+    } else {
+      next[key] = i;
+      map = map.Insert(key, i);
+    }
+    expected.push_back(std::move(next));
+  }
+  UNSIGNED_LONGS_EQUAL(expected.size(), map.VersionCount());
+  for (std::size_t v = 0; v < expected.size(); v += 37) {
+    const auto version = map.AtVersion(v);
+    UNSIGNED_LONGS_EQUAL(expected[v].size(), version.Size());
+    auto it = expected[v].begin();
+    for (const auto& element : version) {
+      LONGS_EQUAL(it->first, element.first);
+      LONGS_EQUAL(it->second, element.second);
+      ++it;
+    }
+    CHECK(it == expected[v].end());
+    for (int key = 0; key < 500; key += 7) {
+      const int* value = version.Find(key);
+      CHECK(expected[v].count(key) ? value && *value == expected[v].at(key) : !value);
+    }
+  }
+  UNSIGNED_LONGS_EQUAL(expected[expected.size() - 2].size(), map.Undo().Size());
+  UNSIGNED_LONGS_EQUAL(map.Size(), map.AtVersion(0).Latest().Size());
+}
+
+TEST(Map, Threaded)
+{
+  pdc::Map<int, int> map;
+  for (int i = 0; i < 100; ++i) {
+    map = map.Insert(2 * i, i);
+  }
+  const auto snapshot = map;
+
+  bool reader_ok = true;
+  std::thread reader([snapshot, &reader_ok] {
+    for (int round = 0; round < 200; ++round) {
+      int expected = 50;
+      for (auto it = snapshot.LowerBound(99); it != snapshot.end(); ++it, ++expected) {
+        if (it.Key() != 2 * expected || it.Value() != expected) {
+          reader_ok = false;
+        }
+      }
+      if (expected != 100 || snapshot.Find(1) != nullptr) {
+        reader_ok = false;
+      }
+    }
+  });
+
+  // Odd keys fall between the keys of the snapshot, so inserting and
+  // removing them rotates the nodes the snapshot reads.
+  for (int i = 0; i < 2000; ++i) {
+    const int key = 2 * (i % 100) + 1;
+    map = i / 100 % 2 ? map.Remove(key) : map.Insert(key, i);
+    map = map.Insert(2 * (i % 100), -i);
+  }
+  reader.join();
+
+  CHECK(reader_ok);
+  UNSIGNED_LONGS_EQUAL(100, snapshot.Size());
+  UNSIGNED_LONGS_EQUAL(100, map.Size());
+  LONGS_EQUAL(-1999, map.At(198));
+}
+
+
+TEST_GROUP(Deque)
+{
+};
+
+TEST(Deque, Ends)
+{
+  pdc::Deque<int> deque;
+  CHECK(deque.IsEmpty());
+  CHECK_THROWS(std::out_of_range, deque.Front());
+  CHECK_THROWS(std::out_of_range, deque.PopBack());
+
+  const auto deque1 = deque.PushBack(2).PushFront(1).PushBack(3);
+  UNSIGNED_LONGS_EQUAL(3, deque1.Size());
+  LONGS_EQUAL(1, deque1.Front());
+  LONGS_EQUAL(3, deque1.Back());
+  LONGS_EQUAL(2, deque1.At(1));
+  CHECK_THROWS(std::out_of_range, deque1.At(3));
+
+  const auto deque2 = deque1.PopFront().PopBack();
+  UNSIGNED_LONGS_EQUAL(1, deque2.Size());
+  LONGS_EQUAL(2, deque2.Front());
+  LONGS_EQUAL(2, deque2.Back());
+  LONGS_EQUAL(1, deque1.Front());
+  CHECK_THROWS(pdc::IncorrectVersionException, deque1.PushBack(4));
+  CHECK(deque2.PopFront().IsEmpty());
+}
+
+TEST(Deque, Versions)
+{
+  std::mt19937 random(17);
+  std::vector<std::deque<int>> expected(1);
+  pdc::Deque<int> deque;
+  for (int i = 0; i < 5000; ++i) {
+    std::deque<int> next = expected.back();
+    const unsigned op = random() % (next.empty() ? 2 : 5);
+    if (op == 0) {
+      next.push_front(i);
+      deque = deque.PushFront(i);
+    } else if (op == 1 || op == 2) {
+      next.push_back(i);
+      deque = deque.PushBack(i);
+    } else if (op == 3) {
+      next.pop_front();
+      deque = deque.PopFront();
+    } else {
+      next.pop_back();
+      deque = deque.PopBack();
+    }
+    expected.push_back(std::move(next));
+  }
+  UNSIGNED_LONGS_EQUAL(expected.size(), deque.VersionCount());
+  for (std::size_t v = 0; v < expected.size(); v += 41) {
+    const auto version = deque.AtVersion(v);
+    UNSIGNED_LONGS_EQUAL(expected[v].size(), version.Size());
+    CHECK(std::equal(expected[v].begin(), expected[v].end(), version.begin(), version.end()));
+    for (std::size_t i = 0; i < expected[v].size(); i += 3) {
+      LONGS_EQUAL(expected[v][i], version[i]);
+    }
+    if (!expected[v].empty()) {
+      LONGS_EQUAL(expected[v].front(), version.Front());
+      LONGS_EQUAL(expected[v].back(), version.Back());
+    }
+  }
+  UNSIGNED_LONGS_EQUAL(expected[expected.size() - 2].size(), deque.Undo().Size());
+  UNSIGNED_LONGS_EQUAL(deque.Size(), deque.AtVersion(0).Latest().Size());
+  CHECK_THROWS(std::out_of_range, deque.AtVersion(expected.size()));
+}
+
+TEST(Deque, Queue)
+{
+  pdc::Deque<std::string> deque;
+  for (int i = 0; i < 10000; ++i) {
+    deque = deque.PushBack(std::to_string(i));
+  }
+  for (int i = 0; i < 10000; i += 7) {
+    STRCMP_EQUAL(std::to_string(i).c_str(), deque[i].c_str());
+  }
+  for (int i = 0; i < 9999; ++i) {
+    STRCMP_EQUAL(std::to_string(i).c_str(), deque.Front().c_str());
+    deque = deque.PopFront();
+  }
+  STRCMP_EQUAL("9999", deque.Front().c_str());
+  STRCMP_EQUAL("4999", deque.AtVersion(5000).Back().c_str());
+}
+
+TEST(Deque, Threaded)
+{
+  pdc::Deque<int> deque;
+  for (int i = 0; i < 100; ++i) {
+    deque = deque.PushBack(i);
+  }
+  const auto snapshot = deque;
+
+  bool reader_ok = true;
+  std::thread reader([snapshot, &reader_ok] {
+    for (int round = 0; round < 200; ++round) {
+      int expected = 0;
+      for (int value : snapshot) {
+        if (value != expected++) {
+          reader_ok = false;
+        }
+      }
+      for (int i = 0; i < 100; i += 9) {
+        if (snapshot[i] != i) {
+          reader_ok = false;
+        }
+      }
+      if (expected != 100 || snapshot.Front() != 0 || snapshot.Back() != 99) {
+        reader_ok = false;
+      }
+    }
+  });
+
+  // Both ends change while the middle of the tree stays shared with the
+  // snapshot.
+  for (int i = 0; i < 2000; ++i) {
+    deque = i % 2 ? deque.PushFront(-i).PopBack() : deque.PushBack(100 + i).PopFront();
+  }
+  reader.join();
+
+  CHECK(reader_ok);
+  UNSIGNED_LONGS_EQUAL(100, snapshot.Size());
+  UNSIGNED_LONGS_EQUAL(100, deque.Size());
+  LONGS_EQUAL(-1999, deque.Front());
+}
+
+
+TEST_GROUP(HashMap)
+{
+};
+
+TEST(HashMap, InsertFind)
+{
+  pdc::HashMap<std::string, int> map;
+  CHECK(map.IsEmpty());
+  for (int i = 0; i < 5000; ++i) {
+    map = map.Insert(std::to_string(i), i);
+  }
+  const auto full = map;
+  for (int i = 0; i < 5000; i += 3) {
+    map = map.Remove(std::to_string(i));
+  }
+  map = map.Insert("1", -1);
+  UNSIGNED_LONGS_EQUAL(5000, full.Size());
+  UNSIGNED_LONGS_EQUAL(5000 - 1667, map.Size());
+  for (int i = 0; i < 5000; ++i) {
+    const std::string key = std::to_string(i);
+    LONGS_EQUAL(i, full.At(key));
+    const int* value = map.Find(key);
+    CHECK(i % 3 ? value && *value == (i == 1 ? -1 : i) : !value);
+  }
+  CHECK_THROWS(std::out_of_range, map.At("0"));
+  CHECK_THROWS(std::out_of_range, map.Remove("0"));
+  CHECK_THROWS(pdc::IncorrectVersionException, full.Insert("x", 0));
+
+  // Removals compact the trie down to an empty root.
+  for (int i = 0; i < 5000; ++i) {
+    if (i % 3) {
+      map = map.Remove(std::to_string(i));
+    }
+  }
+  CHECK(map.IsEmpty());
+  CHECK(map.begin() == map.end());
+  LONGS_EQUAL(4999, full.At("4999"));
+}
+
+namespace {
+
+// Maps keys to four hashes, so most keys collide in every bit.
+struct CollidingHash {
+  std::size_t operator()(int key) const { return static_cast<std::size_t>(key % 4); }
+};
+
+}
+
+TEST(HashMap, Collisions)
+{
+  pdc::HashMap<int, int, CollidingHash> map;
+  for (int i = 0; i < 40; ++i) {
+    map = map.Insert(i, -i);
+  }
+  UNSIGNED_LONGS_EQUAL(40, map.Size());
+  for (int i = 0; i < 40; ++i) {
+    LONGS_EQUAL(-i, map.At(i));
+  }
+  for (int i = 0; i < 40; i += 3) {
+    map = map.Remove(i);
+  }
+  for (int i = 0; i < 40; ++i) {
+    CHECK(i % 3 ? map.At(i) == -i : !map.Contains(i));
+  }
+  int count = 0;
+  for (const auto& element : map) {
+    LONGS_EQUAL(-element.first, element.second);
+    ++count;
+  }
+  LONGS_EQUAL(map.Size(), count);
+}
+
+TEST(HashMap, Versions)
+{
+  std::mt19937 random(13);
+  std::vector<std::unordered_map<int, int>> expected(1);
+  pdc::HashMap<int, int> map;
+  for (int i = 0; i < 3000; ++i) {
+    std::unordered_map<int, int> next = expected.back();
+    const int key = random() % 500;
+    if (random() % 3 == 0 && next.count(key)) {
+      next.erase(key);
+      map = map.Remove(key);
+    } else {
+      next[key] = i;
+      map = map.Insert(key, i);
+    }
+    expected.push_back(std::move(next));
+  }
+  UNSIGNED_LONGS_EQUAL(expected.size(), map.VersionCount());
+  for (std::size_t v = 0; v < expected.size(); v += 37) {
+    const auto version = map.AtVersion(v);
+    UNSIGNED_LONGS_EQUAL(expected[v].size(), version.Size());
+    std::size_t count = 0;
+    for (const auto& element : version) {
+      CHECK(expected[v].count(element.first));
+      LONGS_EQUAL(expected[v].at(element.first), element.second);
+      ++count;
+    }
+    UNSIGNED_LONGS_EQUAL(expected[v].size(), count);
+    for (int key = 0; key < 500; key += 7) {
+      const int* value = version.Find(key);
+      CHECK(expected[v].count(key) ? value && *value == expected[v].at(key) : !value);
+    }
+  }
+  UNSIGNED_LONGS_EQUAL(expected[expected.size() - 2].size(), map.Undo().Size());
+  UNSIGNED_LONGS_EQUAL(map.Size(), map.AtVersion(0).Latest().Size());
+  CHECK_THROWS(std::out_of_range, map.AtVersion(expected.size()));
+  CHECK(map.AsOf(map.GetTime()).GetVersion() == map.GetVersion());
+}
+
+TEST(HashMap, Transient)
+{
+  pdc::HashMap<int, int> map;
+  map = map.Insert(-1, -1);
+  auto builder = map.Transient();
+  for (int i = 0; i < 1000; ++i) {
+    builder.Insert(i, i);
+  }
+  builder.Remove(-1).Remove(500);
+  CHECK_THROWS(std::out_of_range, builder.Remove(500));
+  UNSIGNED_LONGS_EQUAL(999, builder.Size());
+  UNSIGNED_LONGS_EQUAL(2, map.VersionCount());
+
+  const auto built = builder.Persistent();
+  UNSIGNED_LONGS_EQUAL(3, built.VersionCount());
+  UNSIGNED_LONGS_EQUAL(999, built.Size());
+  LONGS_EQUAL(-1, map.At(-1));
+  CHECK(!built.Contains(-1));
+
+  builder.Insert(0, 7).Remove(1);
+  LONGS_EQUAL(0, built.At(0));
+  CHECK(built.Contains(1));
+  LONGS_EQUAL(7, *builder.Find(0));
+  UNSIGNED_LONGS_EQUAL(998, builder.Persistent().Size());
+
+  auto stale = built.Transient();
+  built.Latest().Insert(5000, 0);
+  CHECK_THROWS(pdc::IncorrectVersionException, stale.Persistent());
+}
+
+TEST(HashMap, TransientMove)
+{
+  using Builder = decltype(pdc::HashMap<int, int>().Transient());
+  static_assert(!std::is_copy_constructible<Builder>::value, "Builder shares its nodes");
+  static_assert(!std::is_copy_assignable<Builder>::value, "Builder shares its nodes");
+
+  pdc::HashMap<int, int> map;
+  auto builder = map.Transient();
+  builder.Insert(1, 1);
+  auto moved = std::move(builder);
+  const auto published = moved.Persistent();
+  moved.Insert(1, 99).Insert(2, 2);
+  UNSIGNED_LONGS_EQUAL(1, published.Size());
+  LONGS_EQUAL(1, published.At(1));
+  CHECK(!published.Contains(2));
+
+  builder = std::move(moved);
+  const auto published2 = builder.Persistent();
+  UNSIGNED_LONGS_EQUAL(2, published2.Size());
+  LONGS_EQUAL(99, published2.At(1));
+  LONGS_EQUAL(1, published.At(1));
+}
+
+TEST(HashMap, Threaded)
+{
+  pdc::HashMap<int, int, CollidingHash> map;
+  std::vector<pdc::HashMap<int, int, CollidingHash>> snapshots;
+  for (int i = 0; i < 64; ++i) {
+    map = map.Insert(i, i);
+    if (i % 16 == 15) {
+      snapshots.push_back(map);
+    }
+  }
+
+  bool reader_ok = true;
+  std::thread reader([&snapshots, &reader_ok] {
+    for (int round = 0; round < 100; ++round) {
+      for (std::size_t s = 0; s < snapshots.size(); ++s) {
+        const int size = 16 * static_cast<int>(s + 1);
+        for (int key = 0; key < 64; ++key) {
+          const int* value = snapshots[s].Find(key);
+          if (key < size ? !value || *value != key : value != nullptr) {
+            reader_ok = false;
+          }
+        }
+      }
+    }
+  });
+
+  // The keys share four collision nodes with the snapshots, every change
+  // copies one of them.
+  for (int i = 0; i < 2000; ++i) {
+    const int key = i % 64;
+    map = i / 64 % 2 ? map.Insert(key, -i) : map.Remove(key);
+  }
+  reader.join();
+
+  CHECK(reader_ok);
+  UNSIGNED_LONGS_EQUAL(16, map.Size());
+  LONGS_EQUAL(-1999, map.At(15));
+  CHECK(!map.Contains(16));
+  UNSIGNED_LONGS_EQUAL(64, snapshots.back().Size());
+}
+
+
+TEST_GROUP(Vector)
+{
+};
+
+TEST(Vector, Size)
+{
+  pdc::Vector<int> vector;
+  UNSIGNED_LONGS_EQUAL(0, vector.Size());
+  CHECK(vector.IsEmpty());
+
+  const auto vector2 = vector.PushBack(0);
+  UNSIGNED_LONGS_EQUAL(1, vector2.Size());
+
+  const auto vector3 = vector2.Update(0, 1);
+  UNSIGNED_LONGS_EQUAL(1, vector3.Size());
+
+  UNSIGNED_LONGS_EQUAL(0, vector2.Undo().Size());
+  UNSIGNED_LONGS_EQUAL(100000, pdc::Vector<int>(100000, 1).Size());
+}
+
+TEST(Vector, Update)
+{
+  pdc::Vector<int> vector(2, 0);
+  const auto vector2 = vector.Update(0, 1);
+  LONGS_EQUAL(1, vector2[0]);
+  LONGS_EQUAL(0, vector[0]);
+
+  CHECK_THROWS(std::out_of_range, vector2.Update(2, 0));
+
+  pdc::Vector<int> large_vector(5000, 7);
+  for (std::size_t i = 0; i < large_vector.Size(); i += 3) {
+    large_vector = large_vector.Update(i, i);
+  }
+  for (std::size_t i = 0; i < large_vector.Size(); ++i) {
+    LONGS_EQUAL(i % 3 == 0 ? i : 7, large_vector[i]);
+  }
+}
+
+TEST(Vector, PushBack)
+{
+  pdc::Vector<int> vector;
+  for (int i = 0; i < 40000; ++i) {
+    vector = vector.PushBack(i);
+    UNSIGNED_LONGS_EQUAL(i + 1, vector.Size());
+  }
+  for (int i = 0; i < 40000; ++i) {
+    LONGS_EQUAL(i, vector[i]);
+  }
+
+  pdc::Vector<int> filled(33, 1);
+  filled = filled.PushBack(2);
+  LONGS_EQUAL(1, filled[32]);
+  LONGS_EQUAL(2, filled[33]);
+}
+
+TEST(Vector, Branch)
+{
+  pdc::Vector<int> vector(3, 0);
+  const auto base = vector.Update(0, 1);
+  const auto left = base.Update(1, 2);
+  const auto right = base.Update(1, 3).PushBack(4);
+
+  LONGS_EQUAL(2, left[1]);
+  UNSIGNED_LONGS_EQUAL(3, left.Size());
+  LONGS_EQUAL(3, right[1]);
+  LONGS_EQUAL(4, right[3]);
+  LONGS_EQUAL(0, base[1]);
+
+  const auto back = right.Undo();
+  LONGS_EQUAL(3, back[1]);
+  UNSIGNED_LONGS_EQUAL(3, back.Size());
+  LONGS_EQUAL(0, back.Undo()[1]);
+  LONGS_EQUAL(1, back.Undo()[0]);
+}
+
+TEST(Vector, Undo)
+{
+  pdc::Vector<int> vector;
+  vector = vector.Undo();
+  CHECK(vector.IsEmpty());
+
+  vector = vector.PushBack(0);
+  vector = vector.PushBack(1);
+  vector = vector.Undo();
+  UNSIGNED_LONGS_EQUAL(1, vector.Size());
+  LONGS_EQUAL(0, vector[0]);
+
+  vector = vector.Undo();
+  CHECK(vector.IsEmpty());
+}
+
+TEST(Vector, Redo)
+{
+  pdc::Vector<int> vector;
+  vector = vector.Redo();
+  CHECK(vector.IsEmpty());
+
+  vector = vector.PushBack(0);
+  const auto first = vector.PushBack(1);
+  const auto second = vector.PushBack(2);
+
+  vector = second.Undo().Redo();
+  LONGS_EQUAL(2, vector[1]);
+  vector = vector.Redo();
+  LONGS_EQUAL(2, vector[1]);
+  LONGS_EQUAL(1, first[1]);
+}
+
+TEST(Vector, AtVersion)
+{
+  pdc::Vector<int> vector(1);
+  const auto first = vector.Update(0, 1);
+  const auto second = vector.Update(0, 2);
+  UNSIGNED_LONGS_EQUAL(3, first.VersionCount());
+  UNSIGNED_LONGS_EQUAL(2, second.GetVersion());
+  LONGS_EQUAL(1, second.AtVersion(first.GetVersion())[0]);
+  LONGS_EQUAL(2, first.Latest()[0]);
+  CHECK_THROWS(std::out_of_range, vector.AtVersion(3));
+}
+
+TEST(Vector, Concat)
+{
+  pdc::Vector<int> left;
+  pdc::Vector<int> right;
+  for (int i = 0; i < 100; ++i) {
+    left = left.PushBack(i);
+    right = right.PushBack(100 + i);
+  }
+  const auto both = left.Concat(right);
+  UNSIGNED_LONGS_EQUAL(200, both.Size());
+  for (int i = 0; i < 200; ++i) {
+    LONGS_EQUAL(i, both[i]);
+  }
+  UNSIGNED_LONGS_EQUAL(100, both.Undo().Size());
+
+  auto twice = both.Concat(both);
+  UNSIGNED_LONGS_EQUAL(400, twice.Size());
+  LONGS_EQUAL(199, twice[199]);
+  LONGS_EQUAL(0, twice[200]);
+  twice = twice.PushBack(400).Update(250, -1);
+  LONGS_EQUAL(400, twice[400]);
+  LONGS_EQUAL(-1, twice[250]);
+  LONGS_EQUAL(50, both[50]);
+}
+
+TEST(Vector, Slice)
+{
+  pdc::Vector<int> vector;
+  for (int i = 0; i < 3000; ++i) {
+    vector = vector.PushBack(i);
+  }
+  const auto middle = vector.Slice(1000, 2500);
+  UNSIGNED_LONGS_EQUAL(1500, middle.Size());
+  LONGS_EQUAL(1000, middle[0]);
+  LONGS_EQUAL(2499, middle[1499]);
+  UNSIGNED_LONGS_EQUAL(0, vector.Slice(7, 7).Size());
+  UNSIGNED_LONGS_EQUAL(3000, vector.Slice(0, 3000).Size());
+  CHECK_THROWS(std::out_of_range, vector.Slice(2, 1));
+  CHECK_THROWS(std::out_of_range, vector.Slice(0, 3001));
+
+  const auto joined = middle.Slice(0, 500).Concat(middle.Slice(500, 1500));
+  for (int i = 0; i < 1500; ++i) {
+    LONGS_EQUAL(1000 + i, joined[i]);
+  }
+}
+
+TEST(Vector, ConcatSliceRandom)
+{
+  std::mt19937 random(42);
+  std::vector<int> expected;
+  pdc::Vector<int> vector;
+  for (int step = 0; step < 400; ++step) {
+    const std::size_t size = expected.size();
+    switch (random() % 4) {
+    case 0: {
+      const int count = random() % 100;
+      pdc::Vector<int> other;
+      for (int i = 0; i < count; ++i) {
+        other = other.PushBack(step * 1000 + i);
+        expected.push_back(step * 1000 + i);
+      }
+      vector = vector.Concat(other);
+      break;
+    }
+    case 1: {
+      const std::size_t from = size ? random() % (size + 1) : 0;
+      const std::size_t to = from + (size - from ? random() % (size - from + 1) : 0);
+      vector = vector.Slice(from, to).Concat(vector.Slice(0, from));
+      std::vector<int> next(expected.begin() + from, expected.begin() + to);
+      next.insert(next.end(), expected.begin(), expected.begin() + from);
+      expected = next;
+      break;
+    }
+    case 2:
+      vector = vector.Concat(vector);
+      expected.insert(expected.end(), expected.begin(), expected.end());
+      if (expected.size() > 20000) {
+        vector = vector.Slice(0, 10000);
+        expected.resize(10000);
+      }
+      break;
+    default:
+      if (size) {
+        const std::size_t idx = random() % size;
+        vector = vector.Update(idx, -step);
+        expected[idx] = -step;
+      }
+      vector = vector.PushBack(step);
+      expected.push_back(step);
+    }
+    UNSIGNED_LONGS_EQUAL(expected.size(), vector.Size());
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+      LONGS_EQUAL(expected[i], vector[i]);
+    }
+  }
+}
+
+
+TEST_GROUP(VersionArena)
+{
+};
+
+TEST(VersionArena, Generations)
+{
+  pdc::VersionArena arena(1024);
+  std::pmr::polymorphic_allocator<int> alloc(&arena);
+  UNSIGNED_LONGS_EQUAL(0, arena.Generation());
+
+  pdc::Array<int, std::pmr::polymorphic_allocator<int>> old(100, 1, alloc);
+  for (int i = 0; i < 100; ++i) {
+    old = old.Update(i, i);
+  }
+  const std::size_t reserved = arena.Reserved();
+  CHECK(reserved >= 100 * sizeof(int));
+
+  UNSIGNED_LONGS_EQUAL(1, arena.NewGeneration());
+  {
+    pdc::Array<int, std::pmr::polymorphic_allocator<int>> current(alloc);
+    auto changes = current.Batch();
+    for (std::size_t i = 0; i < old.Size(); ++i) {
+      changes.PushBack(old[i]);
+    }
+    current = changes.Commit();
+    old = current;
+  }
+  CHECK(arena.Reserved() > reserved);
+
+  arena.Release(1);
+  CHECK(arena.Reserved() < reserved + reserved);
+  UNSIGNED_LONGS_EQUAL(100, old.Size());
+  LONGS_EQUAL(99, old[99]);
+  old = old.PushBack(100);
+  LONGS_EQUAL(100, old[100]);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "sliding_vector.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+
+namespace internal {
+
+/* Creation times of the versions of a structure, times[v] is the time of
+ * version v.
+ *
+ * Times never decrease, a clock stepping back gives the time of the previous
+ * version, so the versions made by a time are found by binary search. One
+ * writer adds times, readers may access the times of published versions
+ * without locking. Release() frees the times of versions released by
+ * compaction, Rebase() starts a restored history at its oldest kept version,
+ * PopBack() drops the time of a version which failed to be published. */
+template <typename Allocator = std::allocator<std::int64_t>>
+class Timeline {
+public:
+  using Clock = std::chrono::system_clock;
+  explicit Timeline(const Allocator& alloc = Allocator()) : times_(alloc) { }
+  void Add(Clock::time_point time) { Add(Ticks(time)); }
+  void Add(std::int64_t ticks);
+  void Release(std::size_t version) { times_.Release(version); }
+  void Rebase(std::size_t version) { times_.Rebase(version); }
+  void PopBack() { times_.PopBack(); }
+  std::size_t Size() const { return times_.Size(); }
+  std::int64_t Ticks(std::size_t version) const { return times_[version]; }
+  Clock::time_point Get(std::size_t version) const
+    { return Clock::time_point(std::chrono::nanoseconds(times_[version])); }
+  std::size_t Find(Clock::time_point time, std::size_t from, std::size_t to) const;
+  static std::int64_t Ticks(Clock::time_point time)
+    { return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count(); }
+private:
+  SlidingVector<std::int64_t, Allocator> times_;
+};
+
+template <typename Allocator>
+void Timeline<Allocator>::Add(std::int64_t ticks)
+{
+  const std::size_t size = times_.Size();
+  times_.EmplaceBack(size > times_.First() ? std::max(ticks, times_[size - 1]) : ticks);
+}
+
+/* Returns the first version in [from, to] made after the time, or to + 1 if
+ * all of them were made by the time. */
+template <typename Allocator>
+std::size_t Timeline<Allocator>::Find(Clock::time_point time, std::size_t from, std::size_t to) const
+{
+  const std::int64_t ticks = Ticks(time);
+  std::size_t lo = from;
+  std::size_t hi = to + 1;
+  while (lo < hi) {
+    const std::size_t mid = lo + (hi - lo) / 2;
+    if (times_[mid] <= ticks) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+}
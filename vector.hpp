@@ -0,0 +1,732 @@
+#pragma once
+
+#include "persistent_structure.hpp"
+#include "version_tree.hpp"
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace pdc {
+
+using namespace internal;
+
+/*! \brief Fully persistent vector.
+ *
+ * Any version of the Vector can be modified: the modification creates a new
+ * branch of versions. Versions share structure: the Vector is a relaxed
+ * radix balanced 32-way trie (RRB-tree), a modification copies only the path
+ * to the changed element and shares the rest with the source version.
+ * Elements are stored in contiguous leaves of 32, the last leaf is kept
+ * outside the trie so appending rarely touches the trie.
+ *
+ * Complexity: access, Update, Concat and Slice take O(log n),
+ * PushBack takes O(1) amortized. Reading takes no locks.
+ */
+template <typename T>
+class Vector : public Persisent<Vector<T>> {
+  static constexpr std::size_t kBits = 5;
+  static constexpr std::size_t kWidth = std::size_t(1) << kBits;
+  static constexpr std::size_t kExtraSteps = 2;
+  struct Node { };
+  using NodePtr = std::shared_ptr<const Node>;
+  struct Leaf : Node {
+    std::size_t count = 0;
+    std::array<T, kWidth> values;
+  };
+  using LeafPtr = std::shared_ptr<const Leaf>;
+  using Sizes = std::array<std::size_t, kWidth>;
+  struct Branch : Node {
+    std::size_t count = 0;
+    std::size_t size = 0;
+    std::shared_ptr<const Sizes> sizes;
+    std::array<NodePtr, kWidth> children;
+  };
+  struct Root {
+    NodePtr node;
+    std::size_t shift = 0;
+    LeafPtr tail;
+    std::size_t size = 0;
+    std::size_t TailOffset() const { return size - (tail ? tail->count : 0); }
+  };
+  mutable std::shared_ptr<VersionTree<Root>> versions_;
+  std::size_t version_ = 0;
+  Root root_;
+public:
+  /*! \brief Default constructor. Create empty Vector. */
+  Vector();
+
+  /*! \brief Constructor with count of elements.
+   *
+   * \param count Count elements with default value.
+   */
+  Vector(std::size_t count);
+
+  /*! \brief Constructor with count of elements of a certain value.
+   *
+   * \param count Count of elements.
+   * \param value The value to use for initialization.
+   */
+  Vector(std::size_t count, const T& value);
+
+  /*! \brief Size of Vector.
+   *
+   * \return Vector size.
+   */
+  std::size_t Size() const { return root_.size; }
+
+  /*! \brief Vector empty?
+   *
+   * \return true if the Vector is empty, otherwise false.
+   */
+  bool IsEmpty() const { return Size() == 0; }
+
+  /*! \brief Updates the value of the Vector element.
+   *
+   * Can be called on any version of the Vector.
+   * \param idx The index of the element to be changed.
+   * \param value The new value of the element.
+   * \return New version of the Vector, a child of this version.
+   * \exception std::out_of_range If idx is not less than Size().
+   */
+  Vector<T> Update(std::size_t idx, T value) const;
+
+  /*! \brief Add a value at the end of the Vector.
+   *
+   * Can be called on any version of the Vector.
+   * \param value Value to add.
+   * \return New version of the Vector, a child of this version.
+   */
+  Vector<T> PushBack(T value) const;
+
+  /*! \brief Append the elements of another Vector.
+   *
+   * The other Vector may be any version of any Vector, both share structure
+   * with the result.
+   * \param other Vector to append.
+   * \return New version of the Vector, a child of this version.
+   */
+  Vector<T> Concat(const Vector<T>& other) const;
+
+  /*! \brief Keep the elements in the range [from, to).
+   *
+   * \param from Index of the first element to keep.
+   * \param to Index past the last element to keep.
+   * \return New version of the Vector, a child of this version.
+   * \exception std::out_of_range If from > to or to > Size().
+   */
+  Vector<T> Slice(std::size_t from, std::size_t to) const;
+
+  /*! \brief Access the item for reading.
+   *
+   * \param idx The index of the element.
+   * \return Element to reading.
+   */
+  const T& operator[](std::size_t idx) const;
+
+  /*! \brief Returns the version this version was created from.
+   *
+   * Returns the same version of the Vector if it is the initial one.
+   * \return Parent version of the Vector.
+   */
+  Vector<T> Undo() const override
+    { return Vector<T>(*this, versions_->Parent(version_)); }
+
+  /*! \brief Returns the latest version created from this version.
+   *
+   * Returns the same version of the Vector if it was never modified.
+   * \return Latest child version of the Vector.
+   */
+  Vector<T> Redo() const override
+    { return Vector<T>(*this, versions_->LastChild(version_)); }
+
+  /*! \brief Returns the version of the Vector with the given number.
+   *
+   * Versions of all branches are numbered in the order they are made.
+   * \param version Number of the version.
+   * \return The version of the Vector.
+   * \exception std::out_of_range If version is not less than VersionCount().
+   */
+  Vector<T> AtVersion(std::size_t version) const override;
+
+  /*! \brief Returns the version made last in any branch.
+   *
+   * \return The latest version of the Vector.
+   */
+  Vector<T> Latest() const override
+    { return Vector<T>(*this, versions_->Count() - 1); }
+
+  /*! \brief Count of versions in all branches.
+   *
+   * \return Count of versions.
+   */
+  std::size_t VersionCount() const override { return versions_->Count(); }
+
+  /*! \brief Number of this version.
+   *
+   * \return Number of the version.
+   */
+  std::size_t GetVersion() const override { return version_; }
+
+private:
+  Vector(const Vector<T>& other, std::size_t version);
+  Vector<T> Commit(Root root) const;
+  static Root Fill(std::size_t count, const T& value);
+  static void PushLeaf(Root& root, const LeafPtr& leaf);
+  static void Take(Root& root, std::size_t count);
+  static void Drop(Root& root, std::size_t count);
+  static void Collapse(Root& root);
+  static std::size_t Slots(const NodePtr& node, std::size_t shift);
+  static std::size_t NodeSize(const NodePtr& node, std::size_t shift);
+  static std::size_t Slot(const Branch& branch, std::size_t shift, std::size_t& idx);
+  static NodePtr MakeBranch(const NodePtr* children, std::size_t count,
+                            std::size_t shift);
+  static NodePtr Assoc(const NodePtr& node, std::size_t shift,
+                       std::size_t idx, T value);
+  static NodePtr PushTail(const NodePtr& node, std::size_t shift, const LeafPtr& leaf);
+  static NodePtr NewPath(std::size_t shift, const NodePtr& node);
+  static NodePtr TakeNode(const NodePtr& node, std::size_t shift, std::size_t count);
+  static NodePtr DropNode(const NodePtr& node, std::size_t shift, std::size_t count);
+  static std::vector<NodePtr> Merge(const NodePtr& left, const NodePtr& right,
+                                    std::size_t shift);
+  static std::vector<NodePtr> Rebalance(const std::vector<NodePtr>& nodes,
+                                        std::size_t shift);
+};
+
+template <typename T>
+Vector<T>::Vector()
+  : Vector(0)
+{
+}
+
+template <typename T>
+Vector<T>::Vector(std::size_t count)
+  : Vector(count, T())
+{
+}
+
+template <typename T>
+Vector<T>::Vector(std::size_t count, const T& value)
+  : versions_(std::make_shared<VersionTree<Root>>(Fill(count, value)))
+  , root_(versions_->Get(0))
+{
+}
+
+template <typename T>
+Vector<T>::Vector(const Vector<T>& other, std::size_t version)
+  : versions_(other.versions_)
+  , version_(version)
+  , root_(versions_->Get(version))
+{
+}
+
+template <typename T>
+Vector<T> Vector<T>::AtVersion(std::size_t version) const
+{
+  if (version >= versions_->Count()) {
+    throw std::out_of_range("AtVersion");
+  }
+  return Vector<T>(*this, version);
+}
+
+template <typename T>
+Vector<T> Vector<T>::Update(std::size_t idx, T value) const
+{
+  if (idx >= Size()) {
+    throw std::out_of_range("Update");
+  }
+  Root root = root_;
+  const std::size_t offset = root.TailOffset();
+  if (idx >= offset) {
+    auto tail = std::make_shared<Leaf>(*root.tail);
+    tail->values[idx - offset] = std::move(value);
+    root.tail = std::move(tail);
+  } else {
+    root.node = Assoc(root.node, root.shift, idx, std::move(value));
+  }
+  return Commit(std::move(root));
+}
+
+template <typename T>
+Vector<T> Vector<T>::PushBack(T value) const
+{
+  Root root = root_;
+  std::shared_ptr<Leaf> tail;
+  if (root.tail && root.tail->count < kWidth) {
+    tail = std::make_shared<Leaf>(*root.tail);
+  } else {
+    if (root.tail) {
+      PushLeaf(root, root.tail);
+    }
+    tail = std::make_shared<Leaf>();
+  }
+  tail->values[tail->count++] = std::move(value);
+  root.tail = std::move(tail);
+  ++root.size;
+  return Commit(std::move(root));
+}
+
+template <typename T>
+Vector<T> Vector<T>::Concat(const Vector<T>& other) const
+{
+  Root root = root_;
+  const Root& right = other.root_;
+  if (right.size == 0) {
+    return Commit(std::move(root));
+  }
+  if (root.size == 0) {
+    return Commit(right);
+  }
+  if (root.tail) {
+    PushLeaf(root, root.tail);
+  }
+  if (right.node) {
+    NodePtr left_node = root.node;
+    NodePtr right_node = right.node;
+    std::size_t shift = std::max(root.shift, right.shift);
+    for (std::size_t s = root.shift; s < shift; s += kBits) {
+      left_node = MakeBranch(&left_node, 1, s + kBits);
+    }
+    for (std::size_t s = right.shift; s < shift; s += kBits) {
+      right_node = MakeBranch(&right_node, 1, s + kBits);
+    }
+    auto nodes = Merge(left_node, right_node, shift);
+    if (nodes.size() > 1) {
+      shift += kBits;
+      root.node = MakeBranch(nodes.data(), nodes.size(), shift);
+    } else {
+      root.node = nodes.front();
+    }
+    root.shift = shift;
+    Collapse(root);
+  }
+  root.tail = right.tail;
+  root.size += right.size;
+  return Commit(std::move(root));
+}
+
+template <typename T>
+Vector<T> Vector<T>::Slice(std::size_t from, std::size_t to) const
+{
+  if (from > to || to > Size()) {
+    throw std::out_of_range("Slice");
+  }
+  Root root = root_;
+  Take(root, to);
+  Drop(root, from);
+  return Commit(std::move(root));
+}
+
+template <typename T>
+const T& Vector<T>::operator[](std::size_t idx) const
+{
+  const std::size_t offset = root_.TailOffset();
+  if (idx >= offset) {
+    return root_.tail->values[idx - offset];
+  }
+  const Node* node = root_.node.get();
+  for (std::size_t shift = root_.shift; shift > 0; shift -= kBits) {
+    const auto* branch = static_cast<const Branch*>(node);
+    node = branch->children[Slot(*branch, shift, idx)].get();
+  }
+  return static_cast<const Leaf*>(node)->values[idx];
+}
+
+template <typename T>
+Vector<T> Vector<T>::Commit(Root root) const
+{
+  return Vector<T>(*this, versions_->Add(version_, std::move(root)));
+}
+
+/* Every full leaf of the trie filled with the same value is the same node, and
+ * so are full branches on each level, so the initial version takes O(log n)
+ * space whatever the count is. */
+template <typename T>
+typename Vector<T>::Root Vector<T>::Fill(std::size_t count, const T& value)
+{
+  Root root;
+  root.size = count;
+  if (count == 0) {
+    return root;
+  }
+  auto leaf = std::make_shared<Leaf>();
+  leaf->values.fill(value);
+  leaf->count = kWidth;
+  const std::size_t tail_count = (count - 1) % kWidth + 1;
+  if (tail_count == kWidth) {
+    root.tail = leaf;
+  } else {
+    auto tail = std::make_shared<Leaf>(*leaf);
+    tail->count = tail_count;
+    root.tail = std::move(tail);
+  }
+
+  std::size_t nodes = (count - tail_count) / kWidth;
+  if (nodes == 0) {
+    return root;
+  }
+  NodePtr full = leaf;
+  NodePtr last = leaf;
+  std::array<NodePtr, kWidth> children;
+  while (nodes > 1) {
+    root.shift += kBits;
+    const std::size_t parents = (nodes + kWidth - 1) / kWidth;
+    const std::size_t rest = nodes - (parents - 1) * kWidth;
+    children.fill(full);
+    const NodePtr full_parent = MakeBranch(children.data(), kWidth, root.shift);
+    children[rest - 1] = last;
+    last = (rest == kWidth && last == full)
+      ? full_parent : MakeBranch(children.data(), rest, root.shift);
+    full = full_parent;
+    nodes = parents;
+  }
+  root.node = last;
+  return root;
+}
+
+template <typename T>
+void Vector<T>::PushLeaf(Root& root, const LeafPtr& leaf)
+{
+  if (!root.node) {
+    root.node = leaf;
+    root.shift = 0;
+    return;
+  }
+  if (root.shift > 0) {
+    if (NodePtr node = PushTail(root.node, root.shift, leaf)) {
+      root.node = std::move(node);
+      return;
+    }
+  }
+  const NodePtr children[] = { root.node, NewPath(root.shift, leaf) };
+  root.shift += kBits;
+  root.node = MakeBranch(children, 2, root.shift);
+}
+
+template <typename T>
+void Vector<T>::Take(Root& root, std::size_t count)
+{
+  const std::size_t offset = root.TailOffset();
+  if (count > offset) {
+    if (count - offset < root.tail->count) {
+      auto tail = std::make_shared<Leaf>(*root.tail);
+      tail->count = count - offset;
+      root.tail = std::move(tail);
+    }
+  } else {
+    root.tail = nullptr;
+    root.node = count > 0 ? TakeNode(root.node, root.shift, count) : nullptr;
+    Collapse(root);
+  }
+  root.size = count;
+}
+
+template <typename T>
+void Vector<T>::Drop(Root& root, std::size_t count)
+{
+  const std::size_t offset = root.TailOffset();
+  if (count >= offset) {
+    root.node = nullptr;
+    if (count - offset == (root.tail ? root.tail->count : 0)) {
+      root.tail = nullptr;
+    } else if (count > offset) {
+      auto tail = std::make_shared<Leaf>();
+      tail->count = root.tail->count - (count - offset);
+      std::copy_n(root.tail->values.begin() + (count - offset), tail->count,
+                  tail->values.begin());
+      root.tail = std::move(tail);
+    }
+  } else {
+    root.node = DropNode(root.node, root.shift, count);
+  }
+  Collapse(root);
+  root.size -= count;
+}
+
+template <typename T>
+void Vector<T>::Collapse(Root& root)
+{
+  if (!root.node) {
+    root.shift = 0;
+    return;
+  }
+  while (root.shift > 0) {
+    const auto& branch = static_cast<const Branch&>(*root.node);
+    if (branch.count > 1) {
+      break;
+    }
+    root.node = NodePtr(branch.children[0]);
+    root.shift -= kBits;
+  }
+}
+
+template <typename T>
+std::size_t Vector<T>::Slots(const NodePtr& node, std::size_t shift)
+{
+  return shift == 0 ? static_cast<const Leaf&>(*node).count
+                    : static_cast<const Branch&>(*node).count;
+}
+
+template <typename T>
+std::size_t Vector<T>::NodeSize(const NodePtr& node, std::size_t shift)
+{
+  return shift == 0 ? static_cast<const Leaf&>(*node).count
+                    : static_cast<const Branch&>(*node).size;
+}
+
+/* Returns the child containing the element and makes idx relative to it.
+ * Children of a regular branch are full except the last one, so the child is
+ * found by radix. A relaxed branch keeps the cumulative sizes of children,
+ * the radix is a lower bound of the child there. */
+template <typename T>
+std::size_t Vector<T>::Slot(const Branch& branch, std::size_t shift, std::size_t& idx)
+{
+  std::size_t slot = idx >> shift;
+  if (branch.sizes) {
+    const auto& sizes = *branch.sizes;
+    while (sizes[slot] <= idx) {
+      ++slot;
+    }
+    if (slot > 0) {
+      idx -= sizes[slot - 1];
+    }
+  } else {
+    idx -= slot << shift;
+  }
+  return slot;
+}
+
+template <typename T>
+typename Vector<T>::NodePtr Vector<T>::MakeBranch(
+  const NodePtr* children, std::size_t count, std::size_t shift)
+{
+  auto branch = std::make_shared<Branch>();
+  const std::size_t full = kWidth << (shift - kBits);
+  bool regular = true;
+  Sizes sizes;
+  for (std::size_t i = 0; i < count; ++i) {
+    branch->children[i] = children[i];
+    const std::size_t size = NodeSize(children[i], shift - kBits);
+    regular = regular && (i + 1 == count || size == full);
+    branch->size += size;
+    sizes[i] = branch->size;
+  }
+  branch->count = count;
+  if (!regular) {
+    branch->sizes = std::make_shared<const Sizes>(sizes);
+  }
+  return branch;
+}
+
+/* Returns a copy of the node with the element at idx replaced, copying only
+ * the nodes on the path to it. */
+template <typename T>
+typename Vector<T>::NodePtr Vector<T>::Assoc(
+  const NodePtr& node, std::size_t shift, std::size_t idx, T value)
+{
+  if (shift == 0) {
+    auto leaf = std::make_shared<Leaf>(static_cast<const Leaf&>(*node));
+    leaf->values[idx] = std::move(value);
+    return leaf;
+  }
+  auto branch = std::make_shared<Branch>(static_cast<const Branch&>(*node));
+  auto& child = branch->children[Slot(*branch, shift, idx)];
+  child = Assoc(child, shift - kBits, idx, std::move(value));
+  return branch;
+}
+
+/* Appends the leaf after the rightmost leaf of the subtree. Returns nullptr if
+ * the subtree has no free slot on the rightmost path. */
+template <typename T>
+typename Vector<T>::NodePtr Vector<T>::PushTail(
+  const NodePtr& node, std::size_t shift, const LeafPtr& leaf)
+{
+  const auto& branch = static_cast<const Branch&>(*node);
+  std::array<NodePtr, kWidth> children = branch.children;
+  std::size_t count = branch.count;
+  NodePtr last;
+  if (shift > kBits) {
+    last = PushTail(children[count - 1], shift - kBits, leaf);
+  }
+  if (last) {
+    children[count - 1] = std::move(last);
+  } else if (count < kWidth) {
+    children[count++] = NewPath(shift - kBits, leaf);
+  } else {
+    return nullptr;
+  }
+  return MakeBranch(children.data(), count, shift);
+}
+
+/* Wraps the node into single child branches up to the level of shift. */
+template <typename T>
+typename Vector<T>::NodePtr Vector<T>::NewPath(std::size_t shift, const NodePtr& node)
+{
+  NodePtr path = node;
+  for (std::size_t s = kBits; s <= shift; s += kBits) {
+    path = MakeBranch(&path, 1, s);
+  }
+  return path;
+}
+
+/* Returns the subtree of first count elements of the node, 0 < count. */
+template <typename T>
+typename Vector<T>::NodePtr Vector<T>::TakeNode(
+  const NodePtr& node, std::size_t shift, std::size_t count)
+{
+  if (count == NodeSize(node, shift)) {
+    return node;
+  }
+  if (shift == 0) {
+    auto leaf = std::make_shared<Leaf>(static_cast<const Leaf&>(*node));
+    leaf->count = count;
+    return leaf;
+  }
+  const auto& branch = static_cast<const Branch&>(*node);
+  std::size_t idx = count - 1;
+  const std::size_t slot = Slot(branch, shift, idx);
+  std::array<NodePtr, kWidth> children = branch.children;
+  children[slot] = TakeNode(children[slot], shift - kBits, idx + 1);
+  return MakeBranch(children.data(), slot + 1, shift);
+}
+
+/* Returns the subtree of the node without first count elements,
+ * count < size of the node. */
+template <typename T>
+typename Vector<T>::NodePtr Vector<T>::DropNode(
+  const NodePtr& node, std::size_t shift, std::size_t count)
+{
+  if (count == 0) {
+    return node;
+  }
+  if (shift == 0) {
+    const auto& source = static_cast<const Leaf&>(*node);
+    auto leaf = std::make_shared<Leaf>();
+    leaf->count = source.count - count;
+    std::copy_n(source.values.begin() + count, leaf->count, leaf->values.begin());
+    return leaf;
+  }
+  const auto& branch = static_cast<const Branch&>(*node);
+  std::size_t idx = count;
+  const std::size_t slot = Slot(branch, shift, idx);
+  std::array<NodePtr, kWidth> children;
+  children[0] = DropNode(branch.children[slot], shift - kBits, idx);
+  std::copy(branch.children.begin() + slot + 1, branch.children.begin() + branch.count,
+            children.begin() + 1);
+  return MakeBranch(children.data(), branch.count - slot, shift);
+}
+
+/* Concatenates two subtrees of the same height. Returns one or two nodes of
+ * that height. The rightmost path of the left subtree is merged with the
+ * leftmost path of the right one, and the nodes on each level are
+ * rebalanced, so the search in relaxed branches stays bounded. */
+template <typename T>
+std::vector<typename Vector<T>::NodePtr> Vector<T>::Merge(
+  const NodePtr& left, const NodePtr& right, std::size_t shift)
+{
+  if (shift == 0) {
+    const auto& l = static_cast<const Leaf&>(*left);
+    const auto& r = static_cast<const Leaf&>(*right);
+    if (l.count + r.count > kWidth) {
+      return { left, right };
+    }
+    auto leaf = std::make_shared<Leaf>(l);
+    std::copy_n(r.values.begin(), r.count, leaf->values.begin() + l.count);
+    leaf->count += r.count;
+    return { leaf };
+  }
+  const auto& l = static_cast<const Branch&>(*left);
+  const auto& r = static_cast<const Branch&>(*right);
+  auto middle = Merge(l.children[l.count - 1], r.children[0], shift - kBits);
+  std::vector<NodePtr> children(l.children.begin(), l.children.begin() + l.count - 1);
+  children.insert(children.end(), middle.begin(), middle.end());
+  children.insert(children.end(), r.children.begin() + 1, r.children.begin() + r.count);
+  children = Rebalance(children, shift - kBits);
+  if (children.size() <= kWidth) {
+    return { MakeBranch(children.data(), children.size(), shift) };
+  }
+  return { MakeBranch(children.data(), kWidth, shift),
+           MakeBranch(children.data() + kWidth, children.size() - kWidth, shift) };
+}
+
+/* Redistributes the slots of consecutive nodes of a level so there are at most
+ * kExtraSteps nodes more than the optimal count. Nodes which are not
+ * changed are reused. */
+template <typename T>
+std::vector<typename Vector<T>::NodePtr> Vector<T>::Rebalance(
+  const std::vector<NodePtr>& nodes, std::size_t shift)
+{
+  std::vector<std::size_t> plan;
+  std::size_t total = 0;
+  for (const auto& node : nodes) {
+    plan.push_back(Slots(node, shift));
+    total += plan.back();
+  }
+  const std::size_t optimal = (total + kWidth - 1) / kWidth;
+  std::size_t count = plan.size();
+  if (count <= optimal + kExtraSteps) {
+    return nodes;
+  }
+  std::size_t i = 0;
+  while (count > optimal + kExtraSteps) {
+    while (plan[i] >= kWidth - kExtraSteps / 2) {
+      ++i;
+    }
+    std::size_t rest = plan[i];
+    while (rest > 0) {
+      const std::size_t size = std::min(rest + plan[i + 1], kWidth);
+      plan[i] = size;
+      rest = rest + plan[i + 1] - size;
+      ++i;
+    }
+    std::copy(plan.begin() + i + 1, plan.begin() + count, plan.begin() + i);
+    --count;
+    --i;
+  }
+
+  std::vector<NodePtr> result;
+  std::size_t node = 0;
+  std::size_t offset = 0;
+  for (std::size_t p = 0; p < count; ++p) {
+    if (offset == 0 && Slots(nodes[node], shift) == plan[p]) {
+      result.push_back(nodes[node++]);
+      continue;
+    }
+    if (shift == 0) {
+      auto leaf = std::make_shared<Leaf>();
+      while (leaf->count < plan[p]) {
+        const auto& source = static_cast<const Leaf&>(*nodes[node]);
+        const std::size_t n = std::min(plan[p] - leaf->count, source.count - offset);
+        std::copy_n(source.values.begin() + offset, n, leaf->values.begin() + leaf->count);
+        leaf->count += n;
+        offset += n;
+        if (offset == source.count) {
+          ++node;
+          offset = 0;
+        }
+      }
+      result.push_back(std::move(leaf));
+    } else {
+      std::array<NodePtr, kWidth> children;
+      std::size_t filled = 0;
+      while (filled < plan[p]) {
+        const auto& source = static_cast<const Branch&>(*nodes[node]);
+        const std::size_t n = std::min(plan[p] - filled, source.count - offset);
+        std::copy_n(source.children.begin() + offset, n, children.begin() + filled);
+        filled += n;
+        offset += n;
+        if (offset == source.count) {
+          ++node;
+          offset = 0;
+        }
+      }
+      result.push_back(MakeBranch(children.data(), filled, shift));
+    }
+  }
+  return result;
+}
+
+} // namespace pdc
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <memory_resource>
+#include <new>
+#include <mutex>
+
+namespace pdc {
+
+/*! \brief Monotonic memory resource which releases memory by generations.
+ *
+ * Memory is handed out from large blocks by bumping a pointer and is never
+ * reused after deallocation, so modifications of a container allocate almost
+ * for free and the history of the container is laid out contiguously. Every
+ * block belongs to the generation which was current when the block was taken,
+ * Release() frees the blocks of older generations at once.
+ *
+ * A typical use is to build a container in one generation, later copy the
+ * versions which are still needed to a container allocated in a new
+ * generation, drop the old container and release its generation.
+ *
+ * Allocation is thread-safe.
+ */
+class VersionArena : public std::pmr::memory_resource {
+  struct Block {
+    Block* next;
+    std::size_t generation;
+    std::size_t size;
+  };
+  std::pmr::memory_resource* upstream_;
+  std::size_t block_size_;
+  std::size_t generation_ = 0;
+  Block* blocks_ = nullptr;
+  char* current_ = nullptr;
+  char* end_ = nullptr;
+  std::size_t reserved_ = 0;
+  mutable std::mutex mutex_;
+public:
+  /*! \brief Constructor.
+   *
+   * \param block_size Size of blocks requested from the upstream resource.
+   * \param upstream Resource to request blocks from.
+   */
+  explicit VersionArena(std::size_t block_size = std::size_t(1) << 16,
+                        std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+    : upstream_(upstream), block_size_(block_size) { }
+  VersionArena(const VersionArena&) = delete;
+  VersionArena& operator=(const VersionArena&) = delete;
+  ~VersionArena() override { Free(blocks_); }
+
+  /*! \brief Current generation.
+   *
+   * \return Number of the generation new memory is allocated in.
+   */
+  std::size_t Generation() const { std::lock_guard<std::mutex> l(mutex_); return generation_; }
+
+  /*! \brief Starts a new generation.
+   *
+   * Memory allocated after the call never shares blocks with memory of
+   * older generations.
+   * \return Number of the new generation.
+   */
+  std::size_t NewGeneration();
+
+  /*! \brief Frees the memory of all generations older than the given one.
+   *
+   * Nothing allocated in these generations may be used after the call.
+   * \param generation The oldest generation to keep.
+   */
+  void Release(std::size_t generation);
+
+  /*! \brief Memory taken from the upstream resource.
+   *
+   * \return Total size of the blocks held by the arena.
+   */
+  std::size_t Reserved() const { std::lock_guard<std::mutex> l(mutex_); return reserved_; }
+
+protected:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void*, std::size_t, std::size_t) override { }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    { return this == &other; }
+
+private:
+  static constexpr std::size_t kHeader =
+    (sizeof(Block) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t)
+      * alignof(std::max_align_t);
+  void Free(Block* block);
+};
+
+inline std::size_t VersionArena::NewGeneration()
+{
+  std::lock_guard<std::mutex> l(mutex_);
+  current_ = end_ = nullptr;
+  return ++generation_;
+}
+
+/* Blocks are listed newest first and generations never decrease, so the
+ * blocks to free are a suffix of the list. */
+inline void VersionArena::Release(std::size_t generation)
+{
+  std::lock_guard<std::mutex> l(mutex_);
+  Block** link = &blocks_;
+  while (*link && (*link)->generation >= generation) {
+    link = &(*link)->next;
+  }
+  if (!*link) {
+    return;
+  }
+  if (*link == blocks_) {
+    current_ = end_ = nullptr;
+  }
+  Block* released = *link;
+  *link = nullptr;
+  Free(released);
+}
+
+inline void* VersionArena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+  std::lock_guard<std::mutex> l(mutex_);
+  const auto aligned = [alignment](char* ptr) {
+    const std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(ptr);
+    return reinterpret_cast<char*>((addr + alignment - 1) & ~(alignment - 1));
+  };
+  char* ptr = current_ ? aligned(current_) : nullptr;
+  if (!ptr || ptr + bytes > end_) {
+    const std::size_t size = std::max(block_size_, kHeader + bytes + alignment);
+    void* memory = upstream_->allocate(size, alignof(std::max_align_t));
+    blocks_ = new (memory) Block{blocks_, generation_, size};
+    reserved_ += size;
+    current_ = static_cast<char*>(memory) + kHeader;
+    end_ = static_cast<char*>(memory) + size;
+    ptr = aligned(current_);
+  }
+  current_ = ptr + bytes;
+  return ptr;
+}
+
+inline void VersionArena::Free(Block* block)
+{
+  while (block) {
+    Block* next = block->next;
+    reserved_ -= block->size;
+    upstream_->deallocate(block, block->size, alignof(std::max_align_t));
+    block = next;
+  }
+}
+
+} // namespace pdc
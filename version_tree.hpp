@@ -0,0 +1,56 @@
+#pragma once
+
+#include "segmented_vector.hpp"
+
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <utility>
+
+
+namespace internal {
+
+/* Versions of a fully persistent structure.
+ *
+ * A modification of any version creates a child of it, so versions form a
+ * tree with version 0 as the root. Each version keeps the state of the
+ * structure and the latest of its children. Reading published versions takes
+ * no locks, adding versions is serialized. */
+template <typename State>
+class VersionTree {
+  struct Version {
+    Version(std::size_t ver, std::size_t par, State st)
+      : state(std::move(st)), parent(par), last_child(ver) { }
+    State state;
+    std::size_t parent;
+    std::atomic<std::size_t> last_child;
+  };
+  SegmentedVector<Version> versions_;
+  std::mutex mutex_;
+public:
+  explicit VersionTree(State state);
+  std::size_t Add(std::size_t parent, State state);
+  const State& Get(std::size_t version) const { return versions_[version].state; }
+  std::size_t Parent(std::size_t version) const { return versions_[version].parent; }
+  std::size_t LastChild(std::size_t version) const
+    { return versions_[version].last_child.load(std::memory_order_acquire); }
+  std::size_t Count() const { return versions_.Size(); }
+};
+
+template <typename State>
+VersionTree<State>::VersionTree(State state)
+{
+  versions_.EmplaceBack(0, 0, std::move(state));
+}
+
+template <typename State>
+std::size_t VersionTree<State>::Add(std::size_t parent, State state)
+{
+  std::lock_guard<std::mutex> lk(mutex_);
+  const std::size_t version = versions_.Size();
+  versions_.EmplaceBack(version, parent, std::move(state));
+  versions_[parent].last_child.store(version, std::memory_order_release);
+  return version;
+}
+
+}